@@ -57,6 +57,7 @@ typedef struct {
 	code_ptr           handle_code_write;
 	code_ptr           handle_align_error_write;
 	code_ptr           handle_align_error_read;
+	code_ptr           handle_watch_write;
 	system_str_fun_r8  debug_cmd_handler;
 	uint32_t           memmap_chunks;
 	uint32_t           address_mask;
@@ -67,7 +68,10 @@ typedef struct {
 	uint32_t           move_pc_size;
 	int32_t            mem_ptr_off;
 	int32_t            ram_flags_off;
+	int32_t            watch_flags_off;
+	int32_t            watch_count_off;
 	uint8_t            ram_flags_shift;
+	uint8_t            watch_flags_shift;
 	uint8_t            address_size;
 	uint8_t            byte_swap;
 	int8_t             context_reg;
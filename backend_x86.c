@@ -122,6 +122,28 @@ code_ptr gen_mem_fun(cpu_options * opts, memmap_chunk const * memmap, uint32_t n
 	} else if (opts->address_size == SZ_W && opts->address_mask != 0xFFFF) {
 		and_ir(code, opts->address_mask, adr_reg, SZ_W);
 	}
+	if (is_write && opts->handle_watch_write) {
+		//cheap check of the watchpoint count first so writes only pay for the page lookup while watchpoints are set
+		cmp_irdisp(code, 0, opts->context_reg, opts->watch_count_off, SZ_D);
+		code_ptr no_watch = code->cur + 1;
+		jcc(code, CC_Z, code->cur + 2);
+		push_r(code, adr_reg);
+		shr_ir(code, opts->watch_flags_shift, adr_reg, opts->address_size);
+		bt_rrdisp(code, adr_reg, opts->context_reg, opts->watch_flags_off, opts->address_size);
+		pop_r(code, adr_reg);
+		code_ptr not_watched = code->cur + 1;
+		jcc(code, CC_NC, code->cur + 2);
+		push_r(code, opts->scratch1);
+		push_r(code, opts->scratch2);
+		call(code, opts->save_context);
+		call_args_abi(code, opts->handle_watch_write, 3, opts->scratch2, opts->context_reg, opts->scratch1);
+		mov_rr(code, RAX, opts->context_reg, SZ_PTR);
+		call(code, opts->load_context);
+		pop_r(code, opts->scratch2);
+		pop_r(code, opts->scratch1);
+		*no_watch = code->cur - (no_watch + 1);
+		*not_watched = code->cur - (not_watched + 1);
+	}
 	code_ptr lb_jcc = NULL, ub_jcc = NULL;
 	uint16_t access_flag = is_write ? MMAP_WRITE : MMAP_READ;
 	uint32_t ram_flags_off = opts->ram_flags_off;
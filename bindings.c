@@ -11,6 +11,11 @@
 #include "menu.h"
 #include "bindings.h"
 #include "controller_info.h"
+#include "telemetry.h"
+#include "netplay.h"
+#ifndef DISABLE_ZLIB
+#include "recorder.h"
+#endif
 #ifndef DISABLE_NUKLEAR
 #include "nuklear_ui/blastem_nuklear.h"
 #endif
@@ -26,6 +31,7 @@ typedef enum {
 	UI_DEBUG_MODE_INC,
 	UI_ENTER_DEBUGGER,
 	UI_SAVE_STATE,
+	UI_REWIND,
 	UI_SET_SPEED,
 	UI_NEXT_SPEED,
 	UI_PREV_SPEED,
@@ -41,7 +47,10 @@ typedef enum {
 	UI_PLANE_DEBUG,
 	UI_VRAM_DEBUG,
 	UI_CRAM_DEBUG,
-	UI_COMPOSITE_DEBUG
+	UI_COMPOSITE_DEBUG,
+	UI_TELEMETRY,
+	UI_TELEMETRY_LOG,
+	UI_VIDEO_RECORD
 } ui_action;
 
 typedef struct {
@@ -209,6 +218,10 @@ void handle_binding_down(keybinding * binding)
 	{
 		current_system->mouse_down(current_system, binding->subtype_a, binding->subtype_b);
 	}
+	else if (binding->bind_type == BIND_UI && binding->subtype_a == UI_REWIND && content_binds_enabled)
+	{
+		current_system->rewinding = 1;
+	}
 }
 
 static uint8_t keyboard_captured;
@@ -322,7 +335,16 @@ void handle_binding_up(keybinding * binding)
 			break;
 		case UI_SAVE_STATE:
 			if (allow_content_binds) {
-				current_system->save_state = QUICK_SAVE_SLOT+1;
+				if (netplay_active()) {
+					warning("Save states are not available during netplay\n");
+				} else {
+					current_system->save_state = QUICK_SAVE_SLOT+1;
+				}
+			}
+			break;
+		case UI_REWIND:
+			if (current_system) {
+				current_system->rewinding = 0;
 			}
 			break;
 		case UI_NEXT_SPEED:
@@ -403,6 +425,36 @@ void handle_binding_up(keybinding * binding)
 				}
 			}
 			break;
+		case UI_TELEMETRY:
+			telemetry_toggle_overlay();
+			break;
+		case UI_TELEMETRY_LOG:
+			if (allow_content_binds) {
+				char *path = get_content_config_path("ui\0telemetry_path\0", "ui\0telemetry_template\0", "blastem_telemetry_%c.csv");
+				if (telemetry_save_csv(path)) {
+					debug_message("Saved telemetry to %s\n", path);
+				} else {
+					warning("Failed to open telemetry file %s for writing\n", path);
+				}
+				free(path);
+			}
+			break;
+		case UI_VIDEO_RECORD:
+#ifndef DISABLE_ZLIB
+			if (recorder_running()) {
+				recorder_stop();
+				debug_message("Stopped video recording\n");
+			} else if (allow_content_binds) {
+				char *path = get_content_config_path("ui\0video_path\0", "ui\0video_template\0", "blastem_%c.avi");
+				if (recorder_start(path)) {
+					debug_message("Recording video to %s\n", path);
+				} else {
+					warning("Failed to open video file %s for writing\n", path);
+				}
+				free(path);
+			}
+#endif
+			break;
 		case UI_EXIT:
 #ifndef DISABLE_NUKLEAR
 			if (is_nuklear_active()) {
@@ -630,6 +682,8 @@ int parse_binding_target(int device_num, char * target, tern_node * padbuttons,
 			*subtype_a = UI_ENTER_DEBUGGER;
 		} else if(!strcmp(target + 3, "save_state")) {
 			*subtype_a = UI_SAVE_STATE;
+		} else if(!strcmp(target + 3, "rewind")) {
+			*subtype_a = UI_REWIND;
 		} else if(startswith(target + 3, "set_speed.")) {
 			*subtype_a = UI_SET_SPEED;
 			*subtype_b = atoi(target + 3 + strlen("set_speed."));
@@ -663,6 +717,12 @@ int parse_binding_target(int device_num, char * target, tern_node * padbuttons,
 			*subtype_a = UI_CRAM_DEBUG;
 		} else if (!strcmp(target + 3, "compositing_debug")) {
 			*subtype_a = UI_COMPOSITE_DEBUG;
+		} else if (!strcmp(target + 3, "telemetry")) {
+			*subtype_a = UI_TELEMETRY;
+		} else if (!strcmp(target + 3, "telemetry_log")) {
+			*subtype_a = UI_TELEMETRY_LOG;
+		} else if (!strcmp(target + 3, "video_record")) {
+			*subtype_a = UI_VIDEO_RECORD;
 		} else {
 			warning("Unreconized UI binding type %s\n", target);
 			return 0;
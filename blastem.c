@@ -31,6 +31,10 @@
 #include "menu.h"
 #include "zip.h"
 #include "event_log.h"
+#include "netplay.h"
+#ifdef USE_NULL_RENDER
+#include "host.h"
+#endif
 #ifndef DISABLE_NUKLEAR
 #include "nuklear_ui/blastem_nuklear.h"
 #endif
@@ -466,6 +470,7 @@ int main(int argc, char ** argv)
 	uint8_t start_in_debugger = 0;
 	uint8_t fullscreen = FULLSCREEN_DEFAULT, use_gl = 1;
 	uint8_t debug_target = 0;
+	uint32_t host_instances = 0;
 	char *port;
 	for (int i = 1; i < argc; i++) {
 		if (argv[i][0] == '-') {
@@ -478,6 +483,18 @@ int main(int argc, char ** argv)
 				headless = 1;
 				exit_after = atoi(argv[i]);
 				break;
+#ifdef USE_NULL_RENDER
+			case 'H':
+				i++;
+				if (i >= argc) {
+					fatal_error("-H must be followed by an instance count\n");
+				}
+				host_instances = atoi(argv[i]);
+				if (!host_instances) {
+					fatal_error("-H must be followed by an instance count\n");
+				}
+				break;
+#endif
 			case 'd':
 				start_in_debugger = 1;
 				//allow debugging the menu
@@ -486,7 +503,7 @@ int main(int argc, char ** argv)
 				}
 				break;
 			case 'D':
-				gdb_remote_init();
+				gdb_remote_init(argv[i][2] ? argv[i] + 2 : NULL);
 				dtype = DEBUGGER_GDB;
 				start_in_debugger = 1;
 				break;
@@ -502,6 +519,29 @@ int main(int argc, char ** argv)
 					event_log_file(argv[i]);
 				}
 				break;
+			case 'p':
+				i++;
+				if (i >= argc) {
+					fatal_error("-p must be followed by a port number\n");
+				}
+				port = parse_addr_port(argv[i]);
+				if (port) {
+					netplay_host(argv[i], port);
+				} else {
+					netplay_host(NULL, argv[i]);
+				}
+				break;
+			case 'c':
+				i++;
+				if (i >= argc) {
+					fatal_error("-c must be followed by an address and port\n");
+				}
+				port = parse_addr_port(argv[i]);
+				if (!port) {
+					fatal_error("-c must be followed by an address and port in the form ADDRESS:PORT\n");
+				}
+				netplay_join(argv[i], port);
+				break;
 			case 'f':
 				fullscreen = !fullscreen;
 				break;
@@ -585,11 +625,17 @@ int main(int argc, char ** argv)
 					"	-s FILE     Load a GST format savestate from FILE\n"
 					"	-o FILE     Load FILE as a lock-on cartridge\n"
 					"	-d          Enter debugger on startup\n"
+					"	-D[PORT]    Start the GDB remote stub on stdio or on localhost:PORT\n"
 					"	-n          Disable Z80\n"
 					"	-v          Display version number and exit\n"
 					"	-l          Log 68K code addresses (useful for assemblers)\n"
 					"	-y          Log individual YM-2612 channels to WAVE files\n"
 					"   -e FILE     Write hardware event log to FILE\n"
+					"	-p [ADDR:]PORT Host a rollback netplay session as player 1\n"
+					"	-c ADDR:PORT   Join a rollback netplay session as player 2\n"
+#ifdef USE_NULL_RENDER
+					"	-H COUNT    Run COUNT copies of ROMFILE on a thread pool, needs -b\n"
+#endif
 				);
 				return 0;
 			default:
@@ -616,6 +662,26 @@ int main(int argc, char ** argv)
 		}
 	}
 	
+#ifdef USE_NULL_RENDER
+	if (host_instances) {
+		if (!loaded || reader_addr) {
+			fatal_error("-H needs a ROM file\n");
+		}
+		if (!exit_after) {
+			fatal_error("-H needs a frame count from -b\n");
+		}
+		if (stype == SYSTEM_UNKNOWN) {
+			stype = detect_system_type(&cart);
+		}
+		set_bindings();
+		//each instance counts its own frames
+		uint32_t frames = exit_after;
+		exit_after = 0;
+		host_run(stype, &cart, opts, force_region, host_instances, frames);
+		return 0;
+	}
+#endif
+	
 	int def_width = 0, def_height = 0;
 	char *config_width = tern_find_path(config, "video\0width\0", TVAL_PTR).ptrval;
 	if (config_width) {
@@ -1,6 +1,6 @@
 #include <string.h>
 #include <stdlib.h>
-#ifndef USE_FBDEV
+#if !defined(USE_FBDEV) && !defined(USE_NULL_RENDER)
 #include "render_sdl.h"
 #endif
 #include "controller_info.h"
@@ -78,7 +78,7 @@ static void load_ctype_config(void)
 
 controller_info get_controller_info(int joystick)
 {
-#ifndef USE_FBDEV
+#if !defined(USE_FBDEV) && !defined(USE_NULL_RENDER)
 	load_ctype_config();
 	char guid_string[33];
 	SDL_Joystick *stick = render_get_joystick(joystick);
@@ -171,7 +171,7 @@ controller_info get_controller_info(int joystick)
 
 static void mappings_iter(char *key, tern_val val, uint8_t valtype, void *data)
 {
-#ifndef USE_FBDEV
+#if !defined(USE_FBDEV) && !defined(USE_NULL_RENDER)
 	if (valtype != TVAL_NODE) {
 		return;
 	}
@@ -195,7 +195,7 @@ void controller_add_mappings(void)
 
 void save_controller_info(int joystick, controller_info *info)
 {
-#ifndef USE_FBDEV
+#if !defined(USE_FBDEV) && !defined(USE_NULL_RENDER)
 	char guid_string[33];
 	SDL_JoystickGetGUIDString(SDL_JoystickGetGUID(render_get_joystick(joystick)), guid_string, sizeof(guid_string));
 	tern_node *existing = tern_find_node(info_config, guid_string);
@@ -209,7 +209,7 @@ void save_controller_info(int joystick, controller_info *info)
 
 void save_controller_mapping(int joystick, char *mapping_string)
 {
-#ifndef USE_FBDEV
+#if !defined(USE_FBDEV) && !defined(USE_NULL_RENDER)
 	char guid_string[33];
 	SDL_JoystickGetGUIDString(SDL_JoystickGetGUID(render_get_joystick(joystick)), guid_string, sizeof(guid_string));
 	tern_node *existing = tern_find_node(info_config, guid_string);
@@ -299,7 +299,7 @@ static const char** label_source(controller_info *info)
 
 const char *get_button_label(controller_info *info, int button)
 {
-#ifndef USE_FBDEV
+#if !defined(USE_FBDEV) && !defined(USE_NULL_RENDER)
 	if (button >= SDL_CONTROLLER_BUTTON_DPAD_UP) {
 		static char const * dirs[] = {"Up", "Down", "Left", "Right"};
 		return dirs[button - SDL_CONTROLLER_BUTTON_DPAD_UP];
@@ -313,7 +313,7 @@ static char const *axis_labels[] = {
 };
 const char *get_axis_label(controller_info *info, int axis)
 {
-#ifndef USE_FBDEV
+#if !defined(USE_FBDEV) && !defined(USE_NULL_RENDER)
 	if (axis < SDL_CONTROLLER_AXIS_TRIGGERLEFT) {
 		return axis_labels[axis];
 	} else {
@@ -366,7 +366,7 @@ char *make_human_readable_type_name(controller_info *info)
 		prefix = "Normal ";
 	} else {
 		static const char *parts[] = {"6 button (", NULL, "/", NULL, ") "};
-#ifdef USE_FBDEV
+#if defined(USE_FBDEV) || defined(USE_NULL_RENDER)
 		parts[1] = parts[3] = "??";
 #else
 		if (info->variant == VARIANT_6B_BUMPERS) {
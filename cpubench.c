@@ -0,0 +1,502 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef NEW_CORE
+#include "z80.h"
+#else
+#include "m68k_core.h"
+#include "z80_to_x86.h"
+#endif
+#include "mem.h"
+#include "util.h"
+
+//Runs small generated loops of one class of instructions on the CPU cores and reports how long the host takes
+//per emulated instruction, plus how many bytes of native code the dynarecs generate per instruction. Each loop
+//is the body of a class repeated a few times followed by a counter update and a branch back to the start, the
+//counter tells us how many trips were made. Build with NEW_CORE=1 to measure the new cores instead. The new 68K
+//core does not implement branches yet, so the 68K scenarios are only available with the x86 dynarec.
+
+#define DEFAULT_CYCLES 100000000
+#define WARMUP_CYCLES 100000
+//minimum number of instructions in the repeated part of a loop
+#define MIN_BODY_INSTS 32
+//the Z80 loop counter is 16-bit so the Z80 runs in chunks short enough that it can't wrap
+#define Z80_CHUNK 1000000
+
+int headless = 1;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void render_errorbox(char *title, char *message)
+{
+}
+
+void render_infobox(char *title, char *message)
+{
+}
+
+void init_terminal(void)
+{
+}
+
+typedef struct {
+	char          *name;
+	char          *description;
+	uint16_t const *setup;
+	uint8_t       setup_words;
+	uint16_t const *body;
+	uint8_t       body_words;
+	uint8_t       setup_insts;
+	uint8_t       body_insts;
+} m68k_bench;
+
+typedef struct {
+	char          *name;
+	char          *description;
+	uint8_t const *setup;
+	uint8_t       setup_len;
+	uint8_t const *body;
+	uint8_t       body_len;
+	uint8_t       setup_insts;
+	uint8_t       body_insts;
+	//instructions run by one copy of the body, more than body_insts when it has repeating block instructions
+	uint8_t       body_executed;
+} z80_bench;
+
+typedef struct {
+	uint64_t elapsed;
+	uint64_t executed;
+	uint32_t code_bytes;
+	uint32_t static_insts;
+} bench_result;
+
+#define CODE(arr) arr, sizeof(arr)/sizeof(*arr)
+
+static void print_result(char *name, bench_result *res, uint8_t has_code)
+{
+	if (!res->executed) {
+		printf("%-16s %10s %10s\n", name, "stalled", "-");
+	} else if (has_code) {
+		printf("%-16s %10.2f %10.1f\n", name, (double)res->elapsed / res->executed, (double)res->code_bytes / res->static_insts);
+	} else {
+		printf("%-16s %10.2f %10s\n", name, (double)res->elapsed / res->executed, "-");
+	}
+}
+
+#ifndef NEW_CORE
+//moveq #1, d1
+static const uint16_t m68k_alu_setup[] = {0x7201};
+//add.l d1, d0; sub.w d2, d3; and.l d4, d5; or.b d0, d2; eor.l d1, d3; addq.w #3, d4; lsl.l #2, d5; move.l d0, d7
+static const uint16_t m68k_alu_body[] = {0xD081, 0x9642, 0xCA84, 0x8400, 0xB383, 0x5644, 0xE58D, 0x2E00};
+//movea.l #$FF0000, a0
+static const uint16_t m68k_mem_setup[] = {0x207C, 0x00FF, 0x0000};
+//add.l (a0), d0; move.w d1, 4(a0); move.l 8(a0), d2; or.w d3, (a0); sub.l 12(a0), d4
+static const uint16_t m68k_mem_body[] = {0xD090, 0x3141, 0x0004, 0x2428, 0x0008, 0x8750, 0x98A8, 0x000C};
+//movem.l d0-d5/a0-a4, -(a7); movem.l (a7)+, d0-d5/a0-a4
+static const uint16_t m68k_movem_body[] = {0x48E7, 0xFCF8, 0x4CDF, 0x1F3F};
+//moveq #7, d1; move.l #$12345, d3
+static const uint16_t m68k_div_setup[] = {0x7207, 0x263C, 0x0001, 0x2345};
+//move.l d3, d0; divu.w d1, d0; move.l d3, d2; divs.w d1, d2
+static const uint16_t m68k_div_body[] = {0x2003, 0x80C1, 0x2403, 0x85C1};
+//moveq #7, d1; movea.l #$FF0000, a0
+static const uint16_t m68k_bit_setup[] = {0x7207, 0x207C, 0x00FF, 0x0000};
+//btst #3, d0; bset d1, d2; bclr #5, d3; bchg d1, d4; btst d1, d5; bset #2, (a0)
+static const uint16_t m68k_bit_body[] = {0x0800, 0x0003, 0x03C2, 0x0883, 0x0005, 0x0344, 0x0305, 0x08D0, 0x0002};
+
+static m68k_bench m68k_benches[] = {
+	{"m68k_alu", "68K register to register ALU, shift and move", CODE(m68k_alu_setup), CODE(m68k_alu_body), 1, 8},
+	{"m68k_mem", "68K ALU and move with (An) and d16(An) operands", CODE(m68k_mem_setup), CODE(m68k_mem_body), 1, 5},
+	{"m68k_movem", "68K MOVEM.L of 11 registers to and from the stack", NULL, 0, CODE(m68k_movem_body), 0, 2},
+	{"m68k_div", "68K DIVU.W and DIVS.W", CODE(m68k_div_setup), CODE(m68k_div_body), 2, 4},
+	{"m68k_bit", "68K BTST, BSET, BCLR and BCHG on registers and memory", CODE(m68k_bit_setup), CODE(m68k_bit_body), 2, 6}
+};
+#define NUM_M68K_BENCHES (sizeof(m68k_benches)/sizeof(*m68k_benches))
+
+#define M68K_CODE_START 0x100
+#define M68K_ROM_WORDS 0x8000
+#define M68K_RAM_BYTES (64 * 1024)
+
+m68k_context *sync_components(m68k_context *context, uint32_t address)
+{
+	//nothing else is emulated, so the only reason to get here is the end of a run
+	if (context->current_cycle >= context->sync_cycle) {
+		context->should_return = 1;
+		context->sync_cycle = CYCLE_NEVER;
+		context->target_cycle = context->current_cycle;
+	}
+	return context;
+}
+
+static m68k_context *bench_reset_handler(m68k_context *context)
+{
+	fatal_error("68K benchmark program executed a RESET instruction\n");
+	return context;
+}
+
+//writes the benchmark program to rom, returns the number of instructions in one trip around the loop
+static uint32_t m68k_generate(m68k_bench *b, uint16_t *rom, uint32_t *static_insts)
+{
+	memset(rom, 0, M68K_ROM_WORDS * sizeof(uint16_t));
+	//initial SSP and PC
+	rom[0] = 0x00FF;
+	rom[1] = 0xFE00;
+	rom[2] = M68K_CODE_START >> 16;
+	rom[3] = M68K_CODE_START & 0xFFFF;
+	uint16_t *cur = rom + M68K_CODE_START / 2;
+	//suba.l a6, a6
+	*(cur++) = 0x9DCE;
+	memcpy(cur, b->setup, b->setup_words * sizeof(uint16_t));
+	cur += b->setup_words;
+	uint16_t *loop = cur;
+	uint32_t copies = (MIN_BODY_INSTS + b->body_insts - 1) / b->body_insts;
+	for (uint32_t i = 0; i < copies; i++)
+	{
+		memcpy(cur, b->body, b->body_words * sizeof(uint16_t));
+		cur += b->body_words;
+	}
+	//addq.l #1, a6
+	*(cur++) = 0x528E;
+	//bra.w loop
+	*(cur++) = 0x6000;
+	*cur = (loop - cur) * 2;
+	*static_insts = 1 + b->setup_insts + copies * b->body_insts + 2;
+	return copies * b->body_insts + 2;
+}
+
+static void m68k_run(m68k_context *context, uint32_t cycles)
+{
+	context->should_return = 0;
+	context->target_cycle = context->sync_cycle = context->current_cycle + cycles;
+	if (context->resume_pc) {
+		resume_68k(context);
+	} else {
+		m68k_reset(context);
+	}
+}
+
+static void m68k_run_bench(m68k_bench *b, uint32_t cycles)
+{
+	uint16_t *rom = malloc(M68K_ROM_WORDS * sizeof(uint16_t));
+	uint16_t *ram = calloc(1, M68K_RAM_BYTES);
+	bench_result res;
+	uint32_t loop_insts = m68k_generate(b, rom, &res.static_insts);
+
+	memmap_chunk memmap[2];
+	memset(memmap, 0, sizeof(memmap));
+	memmap[0].end = M68K_ROM_WORDS * sizeof(uint16_t);
+	memmap[0].mask = 0xFFFF;
+	memmap[0].flags = MMAP_READ;
+	memmap[0].buffer = rom;
+	memmap[1].start = 0xE00000;
+	memmap[1].end = 0x1000000;
+	memmap[1].mask = 0xFFFF;
+	memmap[1].flags = MMAP_READ | MMAP_WRITE | MMAP_CODE;
+	memmap[1].buffer = ram;
+	m68k_options *opts = malloc(sizeof(m68k_options));
+	init_m68k_opts(opts, memmap, 2, 1);
+	m68k_context *context = init_68k_context(opts, bench_reset_handler);
+	context->mem_pointers[0] = rom;
+	context->mem_pointers[1] = ram;
+	code_ptr code_start = opts->gen.code.cur;
+
+	//the first run translates the program
+	m68k_run(context, WARMUP_CYCLES);
+	res.code_bytes = opts->gen.code.cur - code_start;
+	uint32_t start_count = context->aregs[6];
+	uint64_t start = now_ns();
+	m68k_run(context, cycles);
+	res.elapsed = now_ns() - start;
+	res.executed = (uint64_t)(context->aregs[6] - start_count) * loop_insts;
+	print_result(b->name, &res, 1);
+
+	free(context);
+	m68k_options_free(opts);
+	free(ram);
+	free(rom);
+}
+#endif
+
+//ld hl, $1800; ld ix, $1000
+static const uint8_t z80_bit_setup[] = {0x21, 0x00, 0x18, 0xDD, 0x21, 0x00, 0x10};
+static const uint8_t z80_alu_body[] = {
+	0x80, //add a, b
+	0x91, //sub c
+	0xA2, //and d
+	0xB3, //or e
+	0xAC, //xor h
+	0x2C, //inc l
+	0x05, //dec b
+	0xB9, //cp c
+	0x19, //add hl, de
+	0x8D  //adc a, l
+};
+static const uint8_t z80_bit_body[] = {
+	0xCB, 0x5F,            //bit 3, a
+	0xCB, 0xC8,            //set 1, b
+	0xCB, 0x91,            //res 2, c
+	0xCB, 0x02,            //rlc d
+	0xCB, 0x3B,            //srl e
+	0xCB, 0x7E,            //bit 7, (hl)
+	0xDD, 0xCB, 0x02, 0xC6 //set 0, (ix+2)
+};
+static const uint8_t z80_block_body[] = {
+	0x21, 0x00, 0x10, //ld hl, $1000
+	0x11, 0x00, 0x14, //ld de, $1400
+	0x01, 0x10, 0x00, //ld bc, 16
+	0xED, 0xB0,       //ldir
+	0x21, 0x00, 0x10, //ld hl, $1000
+	0x01, 0x10, 0x00, //ld bc, 16
+	0x3E, 0x55,       //ld a, $55
+	0xED, 0xB1,       //cpir, never matches since the memory is all zeros
+	0x21, 0x00, 0x11, //ld hl, $1100
+	0x11, 0x00, 0x15, //ld de, $1500
+	0xED, 0xA0,       //ldi
+	0xED, 0xA8        //ldd
+};
+//ld ix, $1000; ld hl, $1100; ld de, $1200; ld sp, $2000
+static const uint8_t z80_mem_setup[] = {0xDD, 0x21, 0x00, 0x10, 0x21, 0x00, 0x11, 0x11, 0x00, 0x12, 0x31, 0x00, 0x20};
+static const uint8_t z80_mem_body[] = {
+	0xDD, 0x7E, 0x05, //ld a, (ix+5)
+	0xDD, 0x70, 0x03, //ld (ix+3), b
+	0x7E,             //ld a, (hl)
+	0x12,             //ld (de), a
+	0xC5,             //push bc
+	0xC1,             //pop bc
+	0x3A, 0x00, 0x11, //ld a, ($1100)
+	0x32, 0x01, 0x11  //ld ($1101), a
+};
+
+static z80_bench z80_benches[] = {
+	{"z80_alu", "Z80 8-bit and 16-bit register ALU", NULL, 0, CODE(z80_alu_body), 0, 10, 10},
+	{"z80_bit", "Z80 CB and DDCB prefixed bit and shift instructions", CODE(z80_bit_setup), CODE(z80_bit_body), 2, 7, 7},
+	//LDIR and CPIR with BC=16 each run 16 times
+	{"z80_block", "Z80 LDIR, CPIR, LDI and LDD", NULL, 0, CODE(z80_block_body), 0, 12, 42},
+	{"z80_mem", "Z80 loads and stores through (HL), (DE), (IX+d) and the stack", CODE(z80_mem_setup), CODE(z80_mem_body), 4, 8, 8}
+};
+#define NUM_Z80_BENCHES (sizeof(z80_benches)/sizeof(*z80_benches))
+
+static uint8_t z80_ram[0x2000];
+
+static uint8_t z80_unmapped_read(uint32_t location, void *context)
+{
+	return 0xFF;
+}
+
+static void *z80_unmapped_write(uint32_t location, void *context, uint8_t value)
+{
+	return context;
+}
+
+static const memmap_chunk z80_map[] = {
+	{ 0x0000, 0x4000,  0x1FFF, 0, 0, MMAP_READ | MMAP_WRITE | MMAP_CODE, z80_ram, NULL, NULL, NULL,              NULL },
+	{ 0x4000, 0x10000, 0xFFFF, 0, 0, 0,                                  NULL,    NULL, NULL, z80_unmapped_read, z80_unmapped_write}
+};
+
+static const memmap_chunk z80_port_map[] = {
+	{ 0x0000, 0x100, 0xFF, 0, 0, 0, NULL, NULL, NULL, z80_unmapped_read, z80_unmapped_write}
+};
+
+#ifndef NEW_CORE
+void z80_next_int_pulse(z80_context *context)
+{
+	context->int_pulse_start = context->int_pulse_end = CYCLE_NEVER;
+}
+#endif
+
+//writes the benchmark program to RAM, returns the number of instructions run in one trip around the loop
+static uint32_t z80_generate(z80_bench *b, uint32_t *static_insts)
+{
+	memset(z80_ram, 0, sizeof(z80_ram));
+	uint8_t *cur = z80_ram;
+	//di
+	*(cur++) = 0xF3;
+	//ld iy, 0
+	*(cur++) = 0xFD;
+	*(cur++) = 0x21;
+	*(cur++) = 0;
+	*(cur++) = 0;
+	memcpy(cur, b->setup, b->setup_len);
+	cur += b->setup_len;
+	uint16_t loop = cur - z80_ram;
+	uint32_t copies = (MIN_BODY_INSTS + b->body_insts - 1) / b->body_insts;
+	for (uint32_t i = 0; i < copies; i++)
+	{
+		memcpy(cur, b->body, b->body_len);
+		cur += b->body_len;
+	}
+	//inc iy
+	*(cur++) = 0xFD;
+	*(cur++) = 0x23;
+	//jp loop
+	*(cur++) = 0xC3;
+	*(cur++) = loop;
+	*(cur++) = loop >> 8;
+	*static_insts = 2 + b->setup_insts + copies * b->body_insts + 2;
+	return copies * b->body_executed + 2;
+}
+
+static uint16_t z80_loop_count(z80_context *context)
+{
+#ifdef NEW_CORE
+	return context->iy;
+#else
+	return context->regs[Z80_IYH] << 8 | context->regs[Z80_IYL];
+#endif
+}
+
+//runs for at least the given number of cycles and returns the number of trips around the loop
+static uint64_t z80_run_loops(z80_context *context, uint32_t cycles)
+{
+	uint64_t loops = 0;
+	uint16_t last = z80_loop_count(context);
+	for (uint32_t done = 0; done < cycles; done += Z80_CHUNK)
+	{
+		uint32_t chunk = cycles - done < Z80_CHUNK ? cycles - done : Z80_CHUNK;
+		z80_run(context, chunk);
+		z80_adjust_cycles(context, chunk);
+		uint16_t count = z80_loop_count(context);
+		loops += (uint16_t)(count - last);
+		last = count;
+	}
+	return loops;
+}
+
+static void z80_run_bench(z80_bench *b, uint32_t cycles)
+{
+	bench_result res;
+	uint32_t loop_insts = z80_generate(b, &res.static_insts);
+	z80_options *opts = malloc(sizeof(z80_options));
+	init_z80_opts(opts, z80_map, 2, z80_port_map, 1, 1, 0xFF);
+	z80_context *context = init_z80_context(opts);
+#ifndef NEW_CORE
+	context->mem_pointers[0] = z80_ram;
+	code_ptr code_start = opts->gen.code.cur;
+#endif
+
+	//the first run translates the program
+	z80_run_loops(context, WARMUP_CYCLES);
+#ifndef NEW_CORE
+	res.code_bytes = opts->gen.code.cur - code_start;
+#endif
+	uint64_t start = now_ns();
+	uint64_t loops = z80_run_loops(context, cycles);
+	res.elapsed = now_ns() - start;
+	res.executed = loops * loop_insts;
+#ifdef NEW_CORE
+	print_result(b->name, &res, 0);
+#else
+	print_result(b->name, &res, 1);
+#endif
+
+	free(context);
+	z80_options_free(opts);
+}
+
+static uint8_t selected(char **names, int num_names, char *name)
+{
+	if (!num_names) {
+		return 1;
+	}
+	for (int i = 0; i < num_names; i++)
+	{
+		if (!strcmp(names[i], name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static uint8_t known_bench(char *name)
+{
+#ifndef NEW_CORE
+	for (int i = 0; i < NUM_M68K_BENCHES; i++)
+	{
+		if (!strcmp(name, m68k_benches[i].name)) {
+			return 1;
+		}
+	}
+#endif
+	for (int i = 0; i < NUM_Z80_BENCHES; i++)
+	{
+		if (!strcmp(name, z80_benches[i].name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t cycles = DEFAULT_CYCLES;
+	char **names = calloc(argc, sizeof(char *));
+	int num_names = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-') {
+			switch (argv[i][1])
+			{
+			case 'c':
+				i++;
+				if (i >= argc) {
+					fatal_error("-c must be followed by a cycle count\n");
+				}
+				cycles = strtoul(argv[i], NULL, 0);
+				if (cycles < Z80_CHUNK) {
+					fatal_error("Cycle count must be at least %d\n", Z80_CHUNK);
+				}
+				break;
+			case 'l':
+#ifndef NEW_CORE
+				for (int j = 0; j < NUM_M68K_BENCHES; j++)
+				{
+					printf("%-16s %s\n", m68k_benches[j].name, m68k_benches[j].description);
+				}
+#endif
+				for (int j = 0; j < NUM_Z80_BENCHES; j++)
+				{
+					printf("%-16s %s\n", z80_benches[j].name, z80_benches[j].description);
+				}
+				return 0;
+			case 'h':
+				puts("Usage: cpubench [OPTIONS] [SCENARIO...]\n"
+					"Measures CPU core speed per class of instructions, runs every scenario if none are named\n\n"
+					"Options:\n"
+					"	-h          Print this help text\n"
+					"	-l          List the available scenarios\n"
+					"	-c CYCLES   Number of CPU cycles to time for each scenario, defaults to 100000000");
+				return 0;
+			default:
+				fatal_error("Unrecognized switch %s\n", argv[i]);
+			}
+		} else {
+			if (!known_bench(argv[i])) {
+				fatal_error("Unknown scenario %s, use -l to list them\n", argv[i]);
+			}
+			names[num_names++] = argv[i];
+		}
+	}
+	printf("%-16s %10s %10s\n", "scenario", "ns/inst", "bytes/inst");
+#ifndef NEW_CORE
+	for (int i = 0; i < NUM_M68K_BENCHES; i++)
+	{
+		if (selected(names, num_names, m68k_benches[i].name)) {
+			m68k_run_bench(m68k_benches + i, cycles);
+		}
+	}
+#endif
+	for (int i = 0; i < NUM_Z80_BENCHES; i++)
+	{
+		if (selected(names, num_names, z80_benches[i].name)) {
+			z80_run_bench(z80_benches + i, cycles);
+		}
+	}
+	free(names);
+	return 0;
+}
@@ -44,6 +44,105 @@ bp_def ** find_breakpoint_idx(bp_def ** cur, uint32_t index)
 	return cur;
 }
 
+static uint32_t bp_hash_slot(bp_hash *hash, uint32_t address)
+{
+	return (address * 0x9E3779B1) >> 8 & (hash->size - 1);
+}
+
+bp_def * bp_hash_find(bp_hash *hash, uint32_t address)
+{
+	if (!hash->count) {
+		return NULL;
+	}
+	uint32_t mask = hash->size - 1;
+	for (uint32_t i = bp_hash_slot(hash, address); hash->slots[i]; i = (i + 1) & mask)
+	{
+		if (hash->slots[i]->address == address) {
+			return hash->slots[i];
+		}
+	}
+	return NULL;
+}
+
+static void bp_hash_add(bp_hash *hash, bp_def *bp)
+{
+	uint32_t mask = hash->size - 1;
+	uint32_t i = bp_hash_slot(hash, bp->address);
+	while (hash->slots[i] && hash->slots[i]->address != bp->address)
+	{
+		i = (i + 1) & mask;
+	}
+	if (!hash->slots[i]) {
+		hash->count++;
+	}
+	hash->slots[i] = bp;
+}
+
+void bp_hash_insert(bp_hash *hash, bp_def *bp)
+{
+	if ((hash->count + 1) * 4 > hash->size * 3) {
+		bp_def **old = hash->slots;
+		uint32_t old_size = hash->size;
+		hash->size = old_size ? old_size * 2 : 16;
+		hash->slots = calloc(hash->size, sizeof(bp_def *));
+		hash->count = 0;
+		for (uint32_t i = 0; i < old_size; i++)
+		{
+			if (old[i]) {
+				bp_hash_add(hash, old[i]);
+			}
+		}
+		free(old);
+	}
+	bp_hash_add(hash, bp);
+}
+
+void bp_hash_remove(bp_hash *hash, uint32_t address)
+{
+	if (!hash->count) {
+		return;
+	}
+	uint32_t mask = hash->size - 1;
+	uint32_t hole = bp_hash_slot(hash, address);
+	while (hash->slots[hole] && hash->slots[hole]->address != address)
+	{
+		hole = (hole + 1) & mask;
+	}
+	if (!hash->slots[hole]) {
+		return;
+	}
+	//shift back later entries of the probe sequence so lookups never stop at the hole
+	for (uint32_t i = (hole + 1) & mask; hash->slots[i]; i = (i + 1) & mask)
+	{
+		uint32_t home = bp_hash_slot(hash, hash->slots[i]->address);
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			hash->slots[hole] = hash->slots[i];
+			hole = i;
+		}
+	}
+	hash->slots[hole] = NULL;
+	hash->count--;
+}
+
+static bp_hash breakpoint_hash;
+static wp_def * watchpoints = NULL;
+static uint32_t wp_index = 0;
+
+static void watchpoint_hit(m68k_context *context, uint32_t address)
+{
+	genesis_context *gen = context->system;
+	for (wp_def *cur = watchpoints; cur; cur = cur->next)
+	{
+		if (address >= (cur->start & ~1) && address <= cur->end) {
+			printf("68K Watchpoint %d hit, write to %X\n", cur->index, address);
+			break;
+		}
+	}
+	//break at the start of the next instruction
+	gen->header.enter_debugger = 1;
+	context->sync_cycle = context->target_cycle = context->current_cycle;
+}
+
 disp_def * displays = NULL;
 disp_def * zdisplays = NULL;
 uint32_t disp_index = 0;
@@ -111,81 +210,130 @@ uint32_t m68k_read_long(uint32_t address, m68k_context *context)
 	return m68k_read_word(address, context) << 16 | m68k_read_word(address + 2, context);
 }
 
-void debugger_print(m68k_context *context, char format_char, char *param, uint32_t address)
+//reads the register, memory location or other value named by param, returns 0 if param isn't recognized
+static uint8_t m68k_debugger_value(m68k_context *context, char *param, uint32_t address, uint32_t *out)
 {
-	uint32_t value;
-	char format[8];
-	strcpy(format, "%s: %d\n");
-	switch (format_char)
-	{
-	case 'x':
-	case 'X':
-	case 'd':
-	case 'c':
-		format[5] = format_char;
-		break;
-	case '\0':
-		break;
-	default:
-		fprintf(stderr, "Unrecognized format character: %c\n", format_char);
-	}
 	if (param[0] == 'd' && param[1] >= '0' && param[1] <= '7') {
-		value = context->dregs[param[1]-'0'];
+		*out = context->dregs[param[1]-'0'];
 		if (param[2] == '.') {
 			if (param[3] == 'w') {
-				value &= 0xFFFF;
+				*out &= 0xFFFF;
 			} else if (param[3] == 'b') {
-				value &= 0xFF;
+				*out &= 0xFF;
 			}
 		}
 	} else if (param[0] == 'a' && param[1] >= '0' && param[1] <= '7') {
-		value = context->aregs[param[1]-'0'];
+		*out = context->aregs[param[1]-'0'];
 		if (param[2] == '.') {
 			if (param[3] == 'w') {
-				value &= 0xFFFF;
+				*out &= 0xFFFF;
 			} else if (param[3] == 'b') {
-				value &= 0xFF;
+				*out &= 0xFF;
 			}
 		}
 	} else if (param[0] == 's' && param[1] == 'r') {
-		value = (context->status << 8);
+		*out = (context->status << 8);
 		for (int flag = 0; flag < 5; flag++) {
-			value |= context->flags[flag] << (4-flag);
+			*out |= context->flags[flag] << (4-flag);
 		}
 	} else if(param[0] == 'c') {
-		value = context->current_cycle;
+		*out = context->current_cycle;
 	} else if(param[0] == 'f') {
 		genesis_context *gen = context->system;
-		value = gen->vdp->frame;
+		*out = gen->vdp->frame;
 	} else if (param[0] == 'p' && param[1] == 'c') {
-		value = address;
+		*out = address;
 	} else if ((param[0] == '0' && param[1] == 'x') || param[0] == '$') {
 		char *after;
 		uint32_t p_addr = strtol(param+(param[0] == '0' ? 2 : 1), &after, 16);
 		if (after[0] == '.' && after[1] == 'l') {
-			value = m68k_read_long(p_addr, context);
+			*out = m68k_read_long(p_addr, context);
 		} else if (after[0] == '.' && after[1] == 'b') {
-			value = m68k_read_byte(p_addr, context);
+			*out = m68k_read_byte(p_addr, context);
 		} else {
-			value = m68k_read_word(p_addr, context);
+			*out = m68k_read_word(p_addr, context);
 		}
 	} else if(param[0] == '(' && (param[1] == 'a' || param[1] == 'd') && param[2] >= '0' && param[2] <= '7' && param[3] == ')') {
 		uint8_t reg = param[2] - '0';
 		uint32_t p_addr = param[1] == 'a' ? context->aregs[reg] : context->dregs[reg];
 		if (param[4] == '.' && param[5] == 'l') {
-			value = m68k_read_long(p_addr, context);
+			*out = m68k_read_long(p_addr, context);
 		} else if (param[4] == '.' && param[5] == 'b') {
-			value = m68k_read_byte(p_addr, context);
+			*out = m68k_read_byte(p_addr, context);
 		} else {
-			value = m68k_read_word(p_addr, context);
+			*out = m68k_read_word(p_addr, context);
 		}
 	} else {
+		return 0;
+	}
+	return 1;
+}
+
+void debugger_print(m68k_context *context, char format_char, char *param, uint32_t address)
+{
+	uint32_t value;
+	char format[8];
+	strcpy(format, "%s: %d\n");
+	switch (format_char)
+	{
+	case 'x':
+	case 'X':
+	case 'd':
+	case 'c':
+		format[5] = format_char;
+		break;
+	case '\0':
+		break;
+	default:
+		fprintf(stderr, "Unrecognized format character: %c\n", format_char);
+	}
+	if (!m68k_debugger_value(context, param, address, &value)) {
 		fprintf(stderr, "Unrecognized parameter to p: %s\n", param);
 		return;
 	}
 	printf(format, param, value);
 }
 
+//operands of a breakpoint condition can be anything p accepts or a number prefixed with #, like #10 or #$FF
+static uint8_t condition_operand(m68k_context *context, char *operand, uint32_t address, uint32_t *out)
+{
+	if (operand[0] == '#') {
+		char *start = operand + (operand[1] == '$' ? 2 : 1);
+		char *end;
+		*out = strtoul(start, &end, operand[1] == '$' ? 16 : 0);
+		return end != start && !*end;
+	}
+	return m68k_debugger_value(context, operand, address, out);
+}
+
+//evaluates a condition of the form OPERAND OP OPERAND where OP is one of == != < > <= >=
+//returns 1 if it holds, 0 if it doesn't and -1 if it can't be parsed
+static int eval_condition(m68k_context *context, char *condition, uint32_t address)
+{
+	char lhs[64], op[3], rhs[64];
+	if (sscanf(condition, "%63s %2s %63s", lhs, op, rhs) != 3) {
+		return -1;
+	}
+	uint32_t left, right;
+	if (!condition_operand(context, lhs, address, &left) || !condition_operand(context, rhs, address, &right)) {
+		return -1;
+	}
+	if (!strcmp(op, "==")) {
+		return left == right;
+	} else if (!strcmp(op, "!=")) {
+		return left != right;
+	} else if (!strcmp(op, "<")) {
+		return left < right;
+	} else if (!strcmp(op, ">")) {
+		return left > right;
+	} else if (!strcmp(op, "<=")) {
+		return left <= right;
+	} else if (!strcmp(op, ">=")) {
+		return left >= right;
+	}
+	return -1;
+}
+
 #ifndef NO_Z80
 
 void zdebugger_print(z80_context * context, char format_char, char * param)
@@ -437,6 +585,7 @@ z80_context * zdebugger(z80_context * context, uint16_t address)
 				new_bp->address = value;
 				new_bp->index = zbp_index++;
 				new_bp->commands = NULL;
+				new_bp->condition = NULL;
 				zbreakpoints = new_bp;
 				printf("Z80 Breakpoint %d set at %X\n", new_bp->index, value);
 				break;
@@ -595,10 +744,33 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 	switch(input_buf[0])
 	{
 		case 'c':
-			if (input_buf[1] == 0 || input_buf[1] == 'o' && input_buf[2] == 'n')
+			if (input_buf[1] == 0 || input_buf[1] == 'o' && input_buf[2] == 'n' && input_buf[3] != 'd')
 			{
 				puts("Continuing");
 				return 0;
+			} else if (input_buf[1] == 'o' && input_buf[2] == 'n' && input_buf[3] == 'd') {
+				param = find_param(input_buf);
+				if (!param) {
+					fputs("cond command requires a parameter\n", stderr);
+					break;
+				}
+				bp_def **target = find_breakpoint_idx(&breakpoints, atoi(param));
+				if (!*target) {
+					fprintf(stderr, "Breakpoint %s does not exist!\n", param);
+					break;
+				}
+				char *condition = find_param(param);
+				if (condition && eval_condition(context, condition, address) < 0) {
+					fprintf(stderr, "Invalid condition %s\n", condition);
+					break;
+				}
+				free((*target)->condition);
+				(*target)->condition = condition ? strdup(condition) : NULL;
+				if (condition) {
+					printf("Breakpoint %d now stops when %s\n", (*target)->index, condition);
+				} else {
+					printf("Breakpoint %d is now unconditional\n", (*target)->index);
+				}
 			} else if (input_buf[1] == 'o' && input_buf[2] == 'm') {
 				param = find_param(input_buf);
 				if (!param) {
@@ -670,14 +842,25 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 					break;
 				}
 				value = strtol(param, NULL, 16);
+				char *condition = find_param(param);
+				if (condition && eval_condition(context, condition, address) < 0) {
+					fprintf(stderr, "Invalid condition %s\n", condition);
+					break;
+				}
 				insert_breakpoint(context, value, debugger);
 				new_bp = malloc(sizeof(bp_def));
 				new_bp->next = breakpoints;
 				new_bp->address = value;
 				new_bp->index = bp_index++;
 				new_bp->commands = NULL;
+				new_bp->condition = condition ? strdup(condition) : NULL;
 				breakpoints = new_bp;
-				printf("68K Breakpoint %d set at %X\n", new_bp->index, value);
+				bp_hash_insert(&breakpoint_hash, new_bp);
+				if (condition) {
+					printf("68K Breakpoint %d set at %X when %s\n", new_bp->index, value, condition);
+				} else {
+					printf("68K Breakpoint %d set at %X\n", new_bp->index, value);
+				}
 			}
 			break;
 		case 'a':
@@ -705,6 +888,26 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 				}
 				debugger_print(context, format_char, param, address);
 				add_display(&displays, &disp_index, format_char, param);
+			} else if (input_buf[1] == 'w') {
+				param = find_param(input_buf);
+				if (!param) {
+					fputs("dw command requires a parameter\n", stderr);
+					break;
+				}
+				value = atoi(param);
+				wp_def **this_wp = &watchpoints;
+				while (*this_wp && (*this_wp)->index != value)
+				{
+					this_wp = &(*this_wp)->next;
+				}
+				if (!*this_wp) {
+					fprintf(stderr, "Watchpoint %d does not exist\n", value);
+					break;
+				}
+				wp_def *to_remove = *this_wp;
+				*this_wp = to_remove->next;
+				remove_watchpoint(context, to_remove->start, to_remove->end);
+				free(to_remove);
 			} else {
 				param = find_param(input_buf);
 				if (!param) {
@@ -719,12 +922,42 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 				}
 				new_bp = *this_bp;
 				*this_bp = (*this_bp)->next;
+				//another breakpoint may still be set at the same address
+				bp_def **other = find_breakpoint(&breakpoints, new_bp->address);
+				if (*other) {
+					bp_hash_insert(&breakpoint_hash, *other);
+				} else {
+					bp_hash_remove(&breakpoint_hash, new_bp->address);
+				}
 				if (new_bp->commands) {
 					free(new_bp->commands);
 				}
+				free(new_bp->condition);
 				free(new_bp);
 			}
 			break;
+		case 'w': {
+			param = find_param(input_buf);
+			if (!param) {
+				fputs("w command requires a parameter\n", stderr);
+				break;
+			}
+			char *size_param;
+			value = strtol(param, &size_param, 16);
+			uint32_t size = strtol(size_param, NULL, 16);
+			if (!size) {
+				size = 1;
+			}
+			wp_def *new_wp = malloc(sizeof(wp_def));
+			new_wp->next = watchpoints;
+			new_wp->start = value & 0xFFFFFF;
+			new_wp->end = (value + size - 1) & 0xFFFFFF;
+			new_wp->index = wp_index++;
+			watchpoints = new_wp;
+			insert_watchpoint(context, new_wp->start, new_wp->end, watchpoint_hit);
+			printf("68K Watchpoint %d set at %X-%X\n", new_wp->index, new_wp->start, new_wp->end);
+			break;
+		}
 		case 'p':
 			format_char = 0;
 			for(int i = 1; input_buf[i] != 0 && input_buf[i] != ' '; i++) {
@@ -933,6 +1166,8 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 				new_bp->next = zbreakpoints;
 				new_bp->address = value;
 				new_bp->index = zbp_index++;
+				new_bp->commands = NULL;
+				new_bp->condition = NULL;
 				zbreakpoints = new_bp;
 				printf("Z80 Breakpoint %d set at %X\n", new_bp->index, value);
 				break;
@@ -964,10 +1199,17 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 void print_m68k_help()
 {
 	printf("M68k Debugger Commands\n");
-	printf("    b ADDRESS            - Set a breakpoint at ADDRESS\n");
+	printf("    b ADDRESS [COND]     - Set a breakpoint at ADDRESS, if COND is given\n");
+	printf("                           only stop when it is true\n");
+	printf("    cond BREAKPOINT [COND] - Set or clear the condition of a breakpoint\n");
+	printf("                           COND is VALUE OP VALUE, OP is one of\n");
+	printf("                           == != < > <= >=, VALUE is anything p accepts\n");
+	printf("                           or a number like #10 or #$FF\n");
 	printf("    d BREAKPOINT         - Delete a 68K breakpoint\n");
 	printf("    co BREAKPOINT        - Run a list of debugger commands each time\n");
 	printf("                           BREAKPOINT is hit\n");
+	printf("    w ADDRESS [SIZE]     - Set a watchpoint on writes to SIZE bytes at ADDRESS\n");
+	printf("    dw WATCHPOINT        - Delete a 68K watchpoint\n");
 	printf("    a ADDRESS            - Advance to address\n");
 	printf("    n                    - Advance to next instruction\n");
 	printf("    o                    - Advance to next instruction ignoring branches to\n");
@@ -1014,18 +1256,17 @@ void debugger(m68k_context * context, uint32_t address)
 
 	sync_components(context, 0);
 	genesis_context *gen = context->system;
+	vdp_run_context(gen->vdp, context->current_cycle);
 	vdp_force_update_framebuffer(gen->vdp);
 	//probably not necessary, but let's play it safe
 	address &= 0xFFFFFF;
 	if (address == branch_t) {
-		bp_def ** f_bp = find_breakpoint(&breakpoints, branch_f);
-		if (!*f_bp) {
+		if (!bp_hash_find(&breakpoint_hash, branch_f)) {
 			remove_breakpoint(context, branch_f);
 		}
 		branch_t = branch_f = 0;
 	} else if(address == branch_f) {
-		bp_def ** t_bp = find_breakpoint(&breakpoints, branch_t);
-		if (!*t_bp) {
+		if (!bp_hash_find(&breakpoint_hash, branch_t)) {
 			remove_breakpoint(context, branch_t);
 		}
 		branch_t = branch_f = 0;
@@ -1039,12 +1280,15 @@ void debugger(m68k_context * context, uint32_t address)
 	uint32_t after = address + (after_pc-pc)*2;
 	int debugging = 1;
 	//Check if this is a user set breakpoint, or just a temporary one
-	bp_def ** this_bp = find_breakpoint(&breakpoints, address);
-	if (*this_bp) {
+	bp_def * this_bp = bp_hash_find(&breakpoint_hash, address);
+	if (this_bp) {
+		if (this_bp->condition && !eval_condition(context, this_bp->condition, address)) {
+			return;
+		}
 
-		if ((*this_bp)->commands)
+		if (this_bp->commands)
 		{
-			char *commands = strdup((*this_bp)->commands);
+			char *commands = strdup(this_bp->commands);
 			char *copy = commands;
 
 			while (debugging && *commands)
@@ -1057,7 +1301,7 @@ void debugger(m68k_context * context, uint32_t address)
 			free(copy);
 		}
 		if (debugging) {
-			printf("68K Breakpoint %d hit\n", (*this_bp)->index);
+			printf("68K Breakpoint %d hit\n", this_bp->index);
 		} else {
 			return;
 		}
@@ -19,12 +19,31 @@ typedef struct disp_def {
 typedef struct bp_def {
 	struct bp_def *next;
 	char          *commands;
+	//only stop when this evaluates to true, NULL for an unconditional breakpoint
+	char          *condition;
 	uint32_t      address;
 	uint32_t      index;
 } bp_def;
 
+//open-addressed index of a bp_def list by address so breakpoint hits don't walk the list
+typedef struct {
+	bp_def   **slots;
+	uint32_t size;
+	uint32_t count;
+} bp_hash;
+
+typedef struct wp_def {
+	struct wp_def *next;
+	uint32_t      start;
+	uint32_t      end;
+	uint32_t      index;
+} wp_def;
+
 bp_def ** find_breakpoint(bp_def ** cur, uint32_t address);
 bp_def ** find_breakpoint_idx(bp_def ** cur, uint32_t index);
+bp_def * bp_hash_find(bp_hash *hash, uint32_t address);
+void bp_hash_insert(bp_hash *hash, bp_def *bp);
+void bp_hash_remove(bp_hash *hash, uint32_t address);
 void add_display(disp_def ** head, uint32_t *index, char format_char, char * param);
 void remove_display(disp_def ** head, uint32_t index);
 void debugger(m68k_context * context, uint32_t address);
@@ -126,6 +126,11 @@ cleanup_address:
 	freeaddrinfo(result);
 }
 
+uint8_t event_log_active(void)
+{
+	return active;
+}
+
 static uint8_t *system_start;
 static size_t system_start_size;
 void event_system_start(system_type stype, vid_std video_std, char *name)
@@ -734,6 +739,82 @@ uint8_t reader_next_event(event_reader *reader, uint32_t *cycle_out)
 	return ret;
 }
 
+void reader_replay_event(event_reader *reader, uint8_t event, uint32_t cycle, event_replay_handlers const *handlers, void *data)
+{
+	switch (event)
+	{
+	case EVENT_FLUSH:
+		if (handlers->sound_run) {
+			handlers->sound_run(data, cycle);
+		}
+		if (handlers->video_run) {
+			handlers->video_run(data, cycle);
+		}
+		break;
+	case EVENT_ADJUST: {
+		if (handlers->sound_run) {
+			handlers->sound_run(data, cycle);
+		}
+		if (handlers->video_run) {
+			handlers->video_run(data, cycle);
+		}
+		reader_ensure_data(reader, 4);
+		uint32_t deduction = load_int32(&reader->buffer);
+		if (handlers->adjust_cycles) {
+			handlers->adjust_cycles(data, deduction);
+		}
+		break;
+	}
+	case EVENT_PSG_REG: {
+		if (handlers->sound_run) {
+			handlers->sound_run(data, cycle);
+		}
+		reader_ensure_data(reader, 1);
+		uint8_t value = load_int8(&reader->buffer);
+		if (handlers->psg_write) {
+			handlers->psg_write(data, value);
+		}
+		break;
+	}
+	case EVENT_YM_REG: {
+		if (handlers->sound_run) {
+			handlers->sound_run(data, cycle);
+		}
+		reader_ensure_data(reader, 3);
+		uint8_t part = load_int8(&reader->buffer);
+		uint8_t reg = load_int8(&reader->buffer);
+		uint8_t value = load_int8(&reader->buffer);
+		if (handlers->ym_write) {
+			handlers->ym_write(data, part, reg, value);
+		}
+		break;
+	}
+	case EVENT_STATE: {
+		reader_ensure_data(reader, 3);
+		uint32_t size = load_int8(&reader->buffer) << 16;
+		size |= load_int16(&reader->buffer);
+		reader_ensure_data(reader, size);
+		if (handlers->state_sections) {
+			deserialize_buffer buffer;
+			init_deserialize(&buffer, reader->buffer.data + reader->buffer.cur_pos, size);
+			handlers->state_sections(data, &buffer);
+			while (buffer.cur_pos < buffer.size)
+			{
+				load_section(&buffer);
+			}
+			free(buffer.handlers);
+		}
+		reader->buffer.cur_pos += size;
+		break;
+	}
+	default:
+		if (handlers->video_run) {
+			handlers->video_run(data, cycle);
+		}
+		handlers->video_event(data, event, reader);
+	}
+}
+
 uint8_t reader_system_type(event_reader *reader)
 {
 	return load_int8(&reader->buffer);
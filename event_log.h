@@ -39,8 +39,25 @@ typedef struct {
 #include "system.h"
 #include "render.h"
 
+//callbacks used by reader_replay_event to apply the events in a log, all but video_event can be NULL to skip that kind
+typedef struct {
+	//runs the sound chips up to cycle
+	void (*sound_run)(void *data, uint32_t cycle);
+	//runs the VDP up to cycle
+	void (*video_run)(void *data, uint32_t cycle);
+	//subtracts deduction from the cycle counters of every component
+	void (*adjust_cycles)(void *data, uint32_t deduction);
+	//applies a VDP event and reads its payload from reader
+	void (*video_event)(void *data, uint8_t event, event_reader *reader);
+	void (*psg_write)(void *data, uint8_t value);
+	void (*ym_write)(void *data, uint8_t part, uint8_t reg, uint8_t value);
+	//registers the section handlers for a state event
+	void (*state_sections)(void *data, deserialize_buffer *state);
+} event_replay_handlers;
+
 void event_log_file(char *fname);
 void event_log_tcp(char *address, char *port);
+uint8_t event_log_active(void);
 void event_system_start(system_type stype, vid_std video_std, char *name);
 void event_cycle_adjust(uint32_t cycle, uint32_t deduction);
 void event_log(uint8_t type, uint32_t cycle, uint8_t size, uint8_t *payload);
@@ -53,6 +70,7 @@ void event_soft_flush(uint32_t cycle);
 void init_event_reader(event_reader *reader, uint8_t *data, size_t size);
 void init_event_reader_tcp(event_reader *reader, char *address, char *port);
 uint8_t reader_next_event(event_reader *reader, uint32_t *cycle_out);
+void reader_replay_event(event_reader *reader, uint8_t event, uint32_t cycle, event_replay_handlers const *handlers, void *data);
 void reader_ensure_data(event_reader *reader, size_t bytes);
 uint8_t reader_system_type(event_reader *reader);
 void reader_send_gamepad_event(event_reader *reader, uint8_t pad, uint8_t button, uint8_t down);
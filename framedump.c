@@ -0,0 +1,368 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vdp.h"
+#include "event_log.h"
+#include "render.h"
+#include "util.h"
+#ifndef DISABLE_ZLIB
+#include "png.h"
+#endif
+
+//Replays an event log recorded with blastem -e without a window, sound or any throttling and prints a hash
+//of every field the VDP outputs. Only the VDP is emulated, PSG and YM-2612 events are skipped since they
+//can't affect the picture. Given the output of a previous run, it reports the fields that differ and can
+//save them as PNG files, which makes it easy to compare the output of two builds over a set of logs.
+
+//enough for a PAL frame with full borders plus the extra lines the VDP can draw when the mode changes mid-frame
+#define FRAMEBUFFER_LINES 512
+
+int headless = 0;
+system_header *current_system;
+
+static uint32_t framebuffers[2][LINEBUF_SIZE * FRAMEBUFFER_LINES];
+//only used with -i, fields are expanded into framebuffers before they're hashed
+static uint8_t indexed;
+static uint8_t index_buffers[2][LINEBUF_SIZE * FRAMEBUFFER_LINES];
+static uint32_t palettes[2][256 * FRAMEBUFFER_LINES];
+static vid_std video_standard;
+static uint32_t frame_count, max_frames, mismatches;
+static uint64_t *reference;
+static uint32_t reference_count;
+static FILE *hash_out;
+static char *png_prefix;
+
+uint16_t read_dma_value(system_header *system, uint32_t address)
+{
+	//DMA transfers are logged as the writes they turn into
+	return 0;
+}
+
+void init_terminal(void)
+{
+}
+
+uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b)
+{
+	return 255 << 24 | r << 16 | g << 8 | b;
+}
+
+uint8_t render_create_window(char *caption, uint32_t width, uint32_t height, window_close_handler close_handler)
+{
+	return 0;
+}
+
+void render_destroy_window(uint8_t which)
+{
+}
+
+uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
+{
+	if (indexed) {
+		*pitch = LINEBUF_SIZE;
+		return (uint32_t *)index_buffers[which == FRAMEBUFFER_EVEN];
+	}
+	*pitch = LINEBUF_SIZE * sizeof(uint32_t);
+	return framebuffers[which == FRAMEBUFFER_EVEN];
+}
+
+uint32_t *render_get_palettes(uint8_t which, int *pitch)
+{
+	*pitch = 256 * sizeof(uint32_t);
+	return palettes[which == FRAMEBUFFER_EVEN];
+}
+
+void render_framebuffer_dirty_lines(uint8_t which, uint32_t first_line, uint32_t last_line)
+{
+}
+
+framebuffer_format render_framebuffer_format(void)
+{
+	return indexed ? FRAMEBUFFER_INDEXED8 : FRAMEBUFFER_XRGB8888;
+}
+
+uint8_t render_get_active_framebuffer(void)
+{
+	return FRAMEBUFFER_ODD;
+}
+
+uint32_t render_overscan_top()
+{
+	return 0;
+}
+
+uint32_t render_overscan_bot()
+{
+	return 0;
+}
+
+void render_errorbox(char *title, char *message)
+{
+}
+
+void render_infobox(char *title, char *message)
+{
+}
+
+//64-bit FNV-1a that consumes two pixels at a time
+static uint64_t hash_field(uint32_t *buffer, uint32_t width, uint32_t height)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL ^ ((uint64_t)width << 32 | height);
+	for (uint32_t y = 0; y < height; y++, buffer += LINEBUF_SIZE)
+	{
+		uint32_t x;
+		for (x = 0; x + 1 < width; x += 2)
+		{
+			hash = (hash ^ ((uint64_t)buffer[x + 1] << 32 | buffer[x])) * 0x100000001B3ULL;
+		}
+		if (x < width) {
+			hash = (hash ^ buffer[x]) * 0x100000001B3ULL;
+		}
+	}
+	return hash;
+}
+
+static void save_field(uint32_t *buffer, uint32_t width, uint32_t height)
+{
+#ifndef DISABLE_ZLIB
+	char number[16];
+	sprintf(number, "%u.png", frame_count);
+	char *path = alloc_concat(png_prefix, number);
+	FILE *f = fopen(path, "wb");
+	if (f) {
+		save_png(f, buffer, width, height, LINEBUF_SIZE * sizeof(uint32_t));
+		fclose(f);
+	} else {
+		warning("Failed to open %s for writing\n", path);
+	}
+	free(path);
+#endif
+}
+
+void render_framebuffer_updated(uint8_t which, int width)
+{
+	if (which > FRAMEBUFFER_EVEN) {
+		return;
+	}
+	uint32_t *buffer = framebuffers[which == FRAMEBUFFER_EVEN];
+	uint32_t height = video_standard == VID_NTSC ? 243 : 294;
+	if (indexed) {
+		uint8_t *src = index_buffers[which == FRAMEBUFFER_EVEN];
+		uint32_t *palette = palettes[which == FRAMEBUFFER_EVEN];
+		for (uint32_t y = 0; y < height; y++, palette += 256)
+		{
+			for (uint32_t x = 0; x < LINEBUF_SIZE; x++)
+			{
+				buffer[y * LINEBUF_SIZE + x] = palette[*(src++)];
+			}
+		}
+	}
+	uint64_t hash = hash_field(buffer, width, height);
+	if (hash_out) {
+		fprintf(hash_out, "%u %08X%08X\n", frame_count, (uint32_t)(hash >> 32), (uint32_t)hash);
+	}
+	if (reference && (frame_count >= reference_count || reference[frame_count] != hash)) {
+		mismatches++;
+		if (png_prefix) {
+			save_field(buffer, width, height);
+		}
+	}
+	frame_count++;
+}
+
+static void skip_section(deserialize_buffer *buf, void *data)
+{
+}
+
+static void dump_video_run(void *data, uint32_t cycle)
+{
+	vdp_run_context(data, cycle);
+}
+
+static void dump_adjust_cycles(void *data, uint32_t deduction)
+{
+	vdp_adjust_cycles(data, deduction);
+}
+
+static void dump_video_event(void *data, uint8_t event, event_reader *reader)
+{
+	vdp_replay_event(data, event, reader);
+}
+
+static void dump_state_sections(void *data, deserialize_buffer *state)
+{
+	register_section_handler(state, (section_handler){.fun = vdp_deserialize, .data = data}, SECTION_VDP);
+	register_section_handler(state, (section_handler){.fun = skip_section}, SECTION_YM2612);
+	register_section_handler(state, (section_handler){.fun = skip_section}, SECTION_PSG);
+}
+
+//sound events are read but not applied
+static const event_replay_handlers dump_handlers = {
+	.video_run = dump_video_run,
+	.adjust_cycles = dump_adjust_cycles,
+	.video_event = dump_video_event,
+	.state_sections = dump_state_sections
+};
+
+static void replay(vdp_context *vdp, event_reader *reader)
+{
+	while (reader->buffer.cur_pos < reader->buffer.size && (!max_frames || frame_count < max_frames))
+	{
+		uint32_t cycle;
+		uint8_t event = reader_next_event(reader, &cycle);
+		reader_replay_event(reader, event, cycle, &dump_handlers, vdp);
+		reader_ensure_data(reader, 1);
+	}
+}
+
+static void load_reference(char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		fatal_error("Failed to open reference hashes %s\n", path);
+	}
+	uint32_t storage = 1024;
+	reference = calloc(storage, sizeof(uint64_t));
+	char line[64];
+	while (fgets(line, sizeof(line), f))
+	{
+		char *hash = strchr(line, ' ');
+		if (!hash) {
+			continue;
+		}
+		uint32_t index = strtoul(line, NULL, 10);
+		if (index >= storage) {
+			uint32_t old_storage = storage;
+			while (index >= storage)
+			{
+				storage *= 2;
+			}
+			reference = realloc(reference, storage * sizeof(uint64_t));
+			//fields missing from the reference never match
+			memset(reference + old_storage, 0, (storage - old_storage) * sizeof(uint64_t));
+		}
+		reference[index] = strtoull(hash + 1, NULL, 16);
+		if (index >= reference_count) {
+			reference_count = index + 1;
+		}
+	}
+	fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	char *log_path = NULL, *out_path = NULL, *ref_path = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-') {
+			switch (argv[i][1])
+			{
+			case 'o':
+				i++;
+				if (i >= argc) {
+					fatal_error("-o must be followed by a file name\n");
+				}
+				out_path = argv[i];
+				break;
+			case 'r':
+				i++;
+				if (i >= argc) {
+					fatal_error("-r must be followed by a file name\n");
+				}
+				ref_path = argv[i];
+				break;
+			case 'p':
+				i++;
+				if (i >= argc) {
+					fatal_error("-p must be followed by a path prefix\n");
+				}
+				png_prefix = argv[i];
+				break;
+			case 'i':
+				indexed = 1;
+				break;
+			case 'n':
+				i++;
+				if (i >= argc) {
+					fatal_error("-n must be followed by a frame count\n");
+				}
+				max_frames = atoi(argv[i]);
+				break;
+			case 'h':
+				puts("Usage: framedump [OPTIONS] EVENT_LOG\n"
+					"Replays an event log recorded with blastem -e and writes a hash of every field\n\n"
+					"Options:\n"
+					"	-h          Print this help text\n"
+					"	-o FILE     Write the hashes to FILE instead of stdout\n"
+					"	-r FILE     Compare against hashes written by a previous run\n"
+					"	-p PREFIX   Save fields that don't match the reference as PREFIX<field>.png\n"
+					"	-n FRAMES   Stop after FRAMES fields\n"
+					"	-i          Have the VDP output palette indices and expand them before hashing");
+				return 0;
+			default:
+				fatal_error("Unrecognized switch %s\n", argv[i]);
+			}
+		} else if (!log_path) {
+			log_path = argv[i];
+		} else {
+			fatal_error("Unexpected argument %s\n", argv[i]);
+		}
+	}
+	if (!log_path) {
+		fatal_error("Usage: framedump [OPTIONS] EVENT_LOG\n");
+	}
+#ifdef DISABLE_ZLIB
+	if (png_prefix) {
+		warning("PNG output is not supported in this build\n");
+		png_prefix = NULL;
+	}
+#endif
+	FILE *f = fopen(log_path, "rb");
+	if (!f) {
+		fatal_error("Failed to open event log %s\n", log_path);
+	}
+	long size = file_size(f);
+	uint8_t *data = malloc(size);
+	if (fread(data, 1, size, f) != size) {
+		fatal_error("Failed to read event log %s\n", log_path);
+	}
+	fclose(f);
+	if (size < 12 || memcmp(data, "BLSTEL\x02\x00", 8)) {
+		fatal_error("%s is not an event log\n", log_path);
+	}
+	if (data[8] + 1 != SYSTEM_GENESIS_PLAYER) {
+		fatal_error("%s was not recorded from a Genesis game\n", log_path);
+	}
+	if (ref_path) {
+		load_reference(ref_path);
+	}
+	if (out_path) {
+		hash_out = fopen(out_path, "w");
+		if (!hash_out) {
+			fatal_error("Failed to open %s for writing\n", out_path);
+		}
+	} else if (!ref_path) {
+		hash_out = stdout;
+	}
+
+	event_reader reader;
+	init_event_reader(&reader, data + 9, size - 9);
+	video_standard = load_int8(&reader.buffer);
+	uint8_t name_len = load_int8(&reader.buffer);
+	reader.buffer.cur_pos += name_len;
+	vdp_context *vdp = init_vdp_context(video_standard == VID_PAL, 0);
+	replay(vdp, &reader);
+
+	if (hash_out && hash_out != stdout) {
+		fclose(hash_out);
+	}
+	if (ref_path) {
+		if (!max_frames && frame_count < reference_count) {
+			mismatches += reference_count - frame_count;
+		}
+		fprintf(stderr, "%u fields, %u did not match %s\n", frame_count, mismatches, ref_path);
+		return mismatches ? 1 : 0;
+	}
+	return 0;
+}
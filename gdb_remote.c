@@ -8,14 +8,14 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 
-int gdb_sock;
-#define GDB_IN_FD gdb_sock
-#define GDB_OUT_FD gdb_sock
 #define GDB_READ(fd, buf, bufsize) recv(fd, buf, bufsize, 0)
 #define GDB_WRITE(fd, buf, bufsize) send(fd, buf, bufsize, 0)
 #else
-#define GDB_IN_FD STDIN_FILENO
-#define GDB_OUT_FD STDOUT_FILENO
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
 #define GDB_READ read
 #define GDB_WRITE write
 #include <unistd.h>
@@ -25,6 +25,7 @@ int gdb_sock;
 #include "68kinst.h"
 #include "debug.h"
 #include "util.h"
+#include "render.h"
 #include <fcntl.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -49,11 +50,18 @@ int cont = 0;
 int expect_break_response=0;
 uint32_t resume_pc;
 
+static int gdb_in_fd, gdb_out_fd;
+//outgoing packet including framing, kept around in case GDB asks for a resend
+static char *send_packet;
+static size_t send_packet_storage, send_packet_size;
+static uint8_t no_ack_mode;
+
 
 static uint16_t branch_t;
 static uint16_t branch_f;
 
 static bp_def * breakpoints = NULL;
+static bp_hash breakpoint_hash;
 static uint32_t bp_index = 0;
 
 
@@ -83,32 +91,54 @@ void hex_8(uint8_t num, char * out)
 	*out = nibble > 9 ? nibble - 0xA + 'A' : nibble + '0';
 }
 
-void gdb_calc_checksum(char * command, char *out)
+static uint8_t gdb_checksum(const char *data, size_t len)
 {
 	uint8_t checksum = 0;
-	while (*command)
+	while (len--)
 	{
-		checksum += *(command++);
+		checksum += *(data++);
 	}
-	hex_8(checksum, out);
+	return checksum;
+}
+
+void gdb_calc_checksum(char * command, char *out)
+{
+	hex_8(gdb_checksum(command, strlen(command)), out);
 }
 
 void write_or_die(int fd, const void *buf, size_t count)
 {
 	if (GDB_WRITE(fd, buf, count) < count) {
-		fatal_error("Error writing to stdout\n");
+		fatal_error("Error writing to GDB output\n");
 	}
 }
 
+static void gdb_send_packet(char *data, size_t len)
+{
+	//frame the whole packet in a single buffer so it goes out with one write
+	if (len + 4 > send_packet_storage) {
+		send_packet_storage = len + 4;
+		send_packet = realloc(send_packet, send_packet_storage);
+	}
+	send_packet_size = len + 4;
+	send_packet[0] = '$';
+	memcpy(send_packet + 1, data, len);
+	send_packet[len + 1] = '#';
+	hex_8(gdb_checksum(data, len), send_packet + len + 2);
+	write_or_die(gdb_out_fd, send_packet, len + 4);
+	dfprintf(stderr, "Sent %.*s\n", (int)len + 4, send_packet);
+}
+
 void gdb_send_command(char * command)
 {
-	char end[3];
-	write_or_die(GDB_OUT_FD, "$", 1);
-	write_or_die(GDB_OUT_FD, command, strlen(command));
-	end[0] = '#';
-	gdb_calc_checksum(command, end+1);
-	write_or_die(GDB_OUT_FD, end, 3);
-	dfprintf(stderr, "Sent $%s#%c%c\n", command, end[1], end[2]);
+	gdb_send_packet(command, strlen(command));
+}
+
+static void gdb_resend(void)
+{
+	if (send_packet_size) {
+		write_or_die(gdb_out_fd, send_packet, send_packet_size);
+	}
 }
 
 uint32_t calc_status(m68k_context * context)
@@ -167,7 +197,124 @@ void m68k_write_byte(m68k_context * context, uint32_t address, uint8_t value)
 	}
 }
 
-void gdb_run_command(m68k_context * context, uint32_t pc, char * command)
+static void m68k_read_hex(m68k_context *context, uint32_t address, uint32_t size, char *out)
+{
+	cpu_options *opts = &context->options->gen;
+	while (size)
+	{
+		//resolve the memory map chunk once and copy straight from its buffer where possible
+		memmap_chunk const *chunk = find_map_chunk(address, opts, 0, NULL);
+		uint8_t *base = NULL;
+		uint32_t span = 1;
+		if (chunk && (chunk->flags & MMAP_READ) && !(chunk->flags & (MMAP_ONLY_ODD|MMAP_ONLY_EVEN))) {
+			base = chunk->flags & MMAP_PTR_IDX ? (uint8_t *)context->mem_pointers[chunk->ptr_index] : chunk->buffer;
+		}
+		if (base) {
+			uint32_t masked = address & opts->address_mask;
+			uint32_t offset = masked & chunk->mask;
+			span = chunk->end - masked;
+			if (chunk->mask - offset + 1 < span) {
+				span = chunk->mask - offset + 1;
+			}
+			if (span > size) {
+				span = size;
+			}
+			for (uint32_t i = 0; i < span; i++, offset++, out += 2)
+			{
+				hex_8(base[opts->byte_swap ? offset ^ 1 : offset], out);
+			}
+		} else {
+			hex_8(m68k_read_byte(context, address), out);
+			out += 2;
+		}
+		address += span;
+		size -= span;
+	}
+	*out = 0;
+}
+
+static uint8_t hex_val(char digit)
+{
+	if (digit >= '0' && digit <= '9') {
+		return digit - '0';
+	} else if (digit >= 'a' && digit <= 'f') {
+		return digit - 'a' + 0xA;
+	} else if (digit >= 'A' && digit <= 'F') {
+		return digit - 'A' + 0xA;
+	}
+	return 0;
+}
+
+//decodes the hex payload of an 'M' packet in place, returns the number of bytes decoded
+static uint32_t decode_hex(char *data, uint32_t size)
+{
+	uint8_t *out = (uint8_t *)data;
+	uint32_t decoded = 0;
+	while (decoded < size && data[0] && data[1])
+	{
+		out[decoded++] = hex_val(data[0]) << 4 | hex_val(data[1]);
+		data += 2;
+	}
+	return decoded;
+}
+
+//decodes the binary payload of an 'X' packet in place, '}' escapes the next byte XORed with 0x20
+static uint32_t decode_binary(char *data, char *end, uint32_t size)
+{
+	uint8_t *out = (uint8_t *)data;
+	uint32_t decoded = 0;
+	while (decoded < size && data < end)
+	{
+		uint8_t value = *(data++);
+		if (value == '}' && data < end) {
+			value = *(data++) ^ 0x20;
+		}
+		out[decoded++] = value;
+	}
+	return decoded;
+}
+
+static void m68k_write_bytes(m68k_context *context, uint32_t address, uint8_t *data, uint32_t size)
+{
+	cpu_options *opts = &context->options->gen;
+	while (size)
+	{
+		//resolve the memory map chunk once and copy straight into its buffer where possible
+		uint8_t *base = get_native_write_pointer(address, (void **)context->mem_pointers, opts);
+		memmap_chunk const *chunk = base ? find_map_chunk(address, opts, 0, NULL) : NULL;
+		uint32_t span = 1;
+		if (chunk && !(chunk->flags & (MMAP_ONLY_ODD|MMAP_ONLY_EVEN|MMAP_AUX_BUFF))) {
+			uint32_t masked = address & opts->address_mask;
+			uint32_t offset = masked & chunk->mask;
+			base -= offset;
+			span = chunk->end - masked;
+			if (chunk->mask - offset + 1 < span) {
+				span = chunk->mask - offset + 1;
+			}
+			if (span > size) {
+				span = size;
+			}
+			if (opts->byte_swap) {
+				for (uint32_t i = 0; i < span; i++)
+				{
+					base[(offset + i) ^ 1] = data[i];
+				}
+			} else {
+				memcpy(base + offset, data, span);
+			}
+			if (masked >= 0xE00000) {
+				m68k_invalidate_code_range(context, masked, masked + span - 1);
+			}
+		} else {
+			m68k_write_byte(context, address, *data);
+		}
+		address += span;
+		data += span;
+		size -= span;
+	}
+}
+
+void gdb_run_command(m68k_context * context, uint32_t pc, char * command, char *packet_end)
 {
 	char send_buf[512];
 	dfprintf(stderr, "Received command %s\n", command);
@@ -197,9 +344,9 @@ void gdb_run_command(m68k_context * context, uint32_t pc, char * command)
 		uint32_t after = pc + (after_pc-pc_ptr)*2;
 
 		if (inst.op == M68K_RTS) {
-			after = (read_dma_value(context->aregs[7]/2) << 16) | read_dma_value(context->aregs[7]/2 + 1);
+			after = (read_dma_value(context->system, context->aregs[7]/2) << 16) | read_dma_value(context->system, context->aregs[7]/2 + 1);
 		} else if (inst.op == M68K_RTE || inst.op == M68K_RTR) {
-			after = (read_dma_value((context->aregs[7]+2)/2) << 16) | read_dma_value((context->aregs[7]+2)/2 + 1);
+			after = (read_dma_value(context->system, (context->aregs[7]+2)/2) << 16) | read_dma_value(context->system, (context->aregs[7]+2)/2 + 1);
 		} else if(m68k_is_branch(&inst)) {
 			if (inst.op == M68K_BCC && inst.extra.cond != COND_TRUE) {
 				branch_f = after;
@@ -236,7 +383,10 @@ void gdb_run_command(m68k_context * context, uint32_t pc, char * command)
 			new_bp->next = breakpoints;
 			new_bp->address = address;
 			new_bp->index = bp_index++;
+			new_bp->commands = NULL;
+			new_bp->condition = NULL;
 			breakpoints = new_bp;
+			bp_hash_insert(&breakpoint_hash, new_bp);
 			gdb_send_command("OK");
 		} else {
 			//watchpoints are not currently supported
@@ -255,6 +405,7 @@ void gdb_run_command(m68k_context * context, uint32_t pc, char * command)
 				bp_def * to_remove = *found;
 				*found = to_remove->next;
 				free(to_remove);
+				bp_hash_remove(&breakpoint_hash, address);
 			}
 			gdb_send_command("OK");
 		} else {
@@ -287,19 +438,14 @@ void gdb_run_command(m68k_context * context, uint32_t pc, char * command)
 		char * rest;
 		uint32_t address = strtoul(command+1, &rest, 16);
 		uint32_t size = strtoul(rest+1, NULL, 16);
-		if (size > (sizeof(send_buf)-1)/2) {
-			size = (sizeof(send_buf)-1)/2;
-		}
-		char *cur = send_buf;
-		while (size)
-		{
-			hex_8(m68k_read_byte(context, address), cur);
-			cur += 2;
-			address++;
-			size--;
+		//reply is limited by the packet size we advertised in qSupported
+		if (size > (bufsize - 4) / 2) {
+			size = (bufsize - 4) / 2;
 		}
-		*cur = 0;
-		gdb_send_command(send_buf);
+		char *reply = malloc(size * 2 + 1);
+		m68k_read_hex(context, address, size, reply);
+		gdb_send_packet(reply, size * 2);
+		free(reply);
 		break;
 	}
 	case 'M': {
@@ -307,24 +453,20 @@ void gdb_run_command(m68k_context * context, uint32_t pc, char * command)
 		uint32_t address = strtoul(command+1, &rest, 16);
 		uint32_t size = strtoul(rest+1, &rest, 16);
 
-		char *cur = rest+1;
-		while (size)
-		{
-			char tmp[3];
-			tmp[0] = *(cur++);
-			tmp[1] = *(cur++);
-			tmp[2] = 0;
-			m68k_write_byte(context, address, strtoul(tmp, NULL, 16));
-			address++;
-			size--;
-		}
+		size = decode_hex(rest+1, size);
+		m68k_write_bytes(context, address, (uint8_t *)rest+1, size);
 		gdb_send_command("OK");
 		break;
 	}
-	case 'X':
-		//binary transfers aren't supported currently as I don't feel like dealing with the escaping
-		gdb_send_command("");
+	case 'X': {
+		char * rest;
+		uint32_t address = strtoul(command+1, &rest, 16);
+		uint32_t size = strtoul(rest+1, &rest, 16);
+		size = decode_binary(rest+1, packet_end, size);
+		m68k_write_bytes(context, address, (uint8_t *)rest+1, size);
+		gdb_send_command("OK");
 		break;
+	}
 	case 'p': {
 		unsigned long reg = strtoul(command+1, NULL, 16);
 
@@ -364,7 +506,7 @@ void gdb_run_command(m68k_context * context, uint32_t pc, char * command)
 	}
 	case 'q':
 		if (!memcmp("Supported", command+1, strlen("Supported"))) {
-			sprintf(send_buf, "PacketSize=%X", (int)bufsize);
+			sprintf(send_buf, "PacketSize=%X;QStartNoAckMode+;vContSupported+", (int)bufsize);
 			gdb_send_command(send_buf);
 		} else if (!memcmp("Attached", command+1, strlen("Attached"))) {
 			//not really meaningful for us, but saying we spawned a new process
@@ -425,9 +567,9 @@ void gdb_run_command(m68k_context * context, uint32_t pc, char * command)
 				uint32_t after = pc + (after_pc-pc_ptr)*2;
 
 				if (inst.op == M68K_RTS) {
-					after = (read_dma_value(context->aregs[7]/2) << 16) | read_dma_value(context->aregs[7]/2 + 1);
+					after = (read_dma_value(context->system, context->aregs[7]/2) << 16) | read_dma_value(context->system, context->aregs[7]/2 + 1);
 				} else if (inst.op == M68K_RTE || inst.op == M68K_RTR) {
-					after = (read_dma_value((context->aregs[7]+2)/2) << 16) | read_dma_value((context->aregs[7]+2)/2 + 1);
+					after = (read_dma_value(context->system, (context->aregs[7]+2)/2) << 16) | read_dma_value(context->system, (context->aregs[7]+2)/2 + 1);
 				} else if(m68k_is_branch(&inst)) {
 					if (inst.op == M68K_BCC && inst.extra.cond != COND_TRUE) {
 						branch_f = after;
@@ -454,6 +596,15 @@ void gdb_run_command(m68k_context * context, uint32_t pc, char * command)
 			goto not_impl;
 		}
 		break;
+	case 'Q':
+		if (!strcmp("StartNoAckMode", command + 1)) {
+			//acknowledge this one last time, neither side sends +/- after this
+			gdb_send_command("OK");
+			no_ack_mode = 1;
+		} else {
+			gdb_send_command("");
+		}
+		break;
 	case '?':
 		gdb_send_command("S05");
 		break;
@@ -466,6 +617,22 @@ not_impl:
 	fatal_error("Command %s is not implemented, exiting...\n", command);
 }
 
+static uint8_t gdb_wait_input(void)
+{
+	fd_set read_fds;
+	struct timeval timeout;
+	FD_ZERO(&read_fds);
+	FD_SET(gdb_in_fd, &read_fds);
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 16667;
+	if (select(gdb_in_fd + 1, &read_fds, NULL, NULL, &timeout) < 1) {
+		//keep the UI responsive while GDB is idle
+		process_events();
+		return 0;
+	}
+	return 1;
+}
+
 void  gdb_debug_enter(m68k_context * context, uint32_t pc)
 {
 	dfprintf(stderr, "Entered debugger at address %X\n", pc);
@@ -474,101 +641,103 @@ void  gdb_debug_enter(m68k_context * context, uint32_t pc)
 		expect_break_response = 0;
 	}
 	if ((pc & 0xFFFFFF) == branch_t) {
-		bp_def ** f_bp = find_breakpoint(&breakpoints, branch_f);
-		if (!*f_bp) {
+		if (!bp_hash_find(&breakpoint_hash, branch_f)) {
 			remove_breakpoint(context, branch_f);
 		}
 		branch_t = branch_f = 0;
 	} else if((pc & 0xFFFFFF) == branch_f) {
-		bp_def ** t_bp = find_breakpoint(&breakpoints, branch_t);
-		if (!*t_bp) {
+		if (!bp_hash_find(&breakpoint_hash, branch_t)) {
 			remove_breakpoint(context, branch_t);
 		}
 		branch_t = branch_f = 0;
 	}
 	//Check if this is a user set breakpoint, or just a temporary one
-	bp_def ** this_bp = find_breakpoint(&breakpoints, pc & 0xFFFFFF);
-	if (!*this_bp) {
+	if (!bp_hash_find(&breakpoint_hash, pc & 0xFFFFFF)) {
 		remove_breakpoint(context, pc & 0xFFFFFF);
 	}
 	resume_pc = pc;
 	cont = 0;
-	uint8_t partial = 0;
 	while(!cont)
 	{
-		if (!curbuf) {
-			int numread = GDB_READ(GDB_IN_FD, buf, bufsize);
-			if (numread < 0) {
-				fatal_error("Failed to read on GDB input file descriptor\n");
-			}
-			dfprintf(stderr, "read %d bytes\n", numread);
-			curbuf = buf;
-			end = buf + numread;
-		} else if (partial) {
-			if (curbuf != buf) {
-				memmove(curbuf, buf, end-curbuf);
-				end -= curbuf - buf;
-			}
-			int numread = GDB_READ(GDB_IN_FD, end, bufsize - (end-buf));
-			end += numread;
-			curbuf = buf;
-		}
-		for (; curbuf < end; curbuf++)
+		//handle every complete packet we have buffered before waiting for more
+		while (curbuf && curbuf < end && !cont)
 		{
-			if (*curbuf == '$')
-			{
+			if (*curbuf == '-') {
+				gdb_resend();
 				curbuf++;
-				char * start = curbuf;
-				while (curbuf < end && *curbuf != '#') {
-					curbuf++;
-				}
-				if (*curbuf == '#') {
-					//check to make sure we've received the checksum bytes
-					if (end-curbuf >= 2) {
-						//TODO: verify checksum
-						//Null terminate payload
-						*curbuf = 0;
-						//send acknowledgement
-						if (GDB_WRITE(GDB_OUT_FD, "+", 1) < 1) {
-							fatal_error("Error writing to stdout\n");
-						}
-						gdb_run_command(context, pc, start);
-						curbuf += 2;
-					}
-				} else {
-					curbuf--;
-					partial = 1;
-					break;
-				}
-			} else {
+				continue;
+			}
+			if (*curbuf != '$') {
 				dfprintf(stderr, "Ignoring character %c\n", *curbuf);
+				curbuf++;
+				continue;
+			}
+			char *start = curbuf + 1;
+			char *hash = memchr(start, '#', end - start);
+			if (!hash || end - hash < 3) {
+				//wait for the rest of the packet
+				break;
 			}
+			uint8_t checksum = hex_val(hash[1]) << 4 | hex_val(hash[2]);
+			curbuf = hash + 3;
+			if (checksum != gdb_checksum(start, hash - start)) {
+				dfprintf(stderr, "Bad checksum on packet %.*s\n", (int)(hash - start), start);
+				if (!no_ack_mode) {
+					write_or_die(gdb_out_fd, "-", 1);
+				}
+				continue;
+			}
+			if (!no_ack_mode) {
+				write_or_die(gdb_out_fd, "+", 1);
+			}
+			//Null terminate payload
+			*hash = 0;
+			gdb_run_command(context, pc, start, hash);
+		}
+		if (cont) {
+			break;
+		}
+		if (!curbuf || curbuf == end) {
+			curbuf = end = buf;
+		} else if (curbuf != buf) {
+			memmove(buf, curbuf, end - curbuf);
+			end -= curbuf - buf;
+			curbuf = buf;
+		}
+		if (end - buf == bufsize) {
+			//packet is larger than the size we advertised, discard it
+			curbuf = end = buf;
 		}
-		if (curbuf == end) {
-			curbuf = NULL;
+		if (!gdb_wait_input()) {
+			continue;
 		}
+		int numread = GDB_READ(gdb_in_fd, end, bufsize - (end - buf));
+		if (numread <= 0) {
+			fatal_error("Failed to read from GDB connection\n");
+		}
+		dfprintf(stderr, "read %d bytes\n", numread);
+		end += numread;
 	}
 }
 
-void gdb_remote_init(void)
+static int gdb_listen(char *port)
 {
-	buf = malloc(INITIAL_BUFFER_SIZE);
-	curbuf = NULL;
-	bufsize = INITIAL_BUFFER_SIZE;
-#ifdef _WIN32
-	socket_init();
-
 	struct addrinfo request, *result;
+	socket_init();
 	memset(&request, 0, sizeof(request));
 	request.ai_family = AF_INET;
 	request.ai_socktype = SOCK_STREAM;
 	request.ai_flags = AI_PASSIVE;
-	getaddrinfo("localhost", "1234", &request, &result);
+	if (getaddrinfo("localhost", port, &request, &result)) {
+		fatal_error("Failed to resolve GDB remote debugging address localhost:%s\n", port);
+	}
 
 	int listen_sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
 	if (listen_sock < 0) {
 		fatal_error("Failed to open GDB remote debugging socket");
 	}
+	int param = 1;
+	setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&param, sizeof(param));
 	if (bind(listen_sock, result->ai_addr, result->ai_addrlen) < 0) {
 		fatal_error("Failed to bind GDB remote debugging socket");
 	}
@@ -576,12 +745,33 @@ void gdb_remote_init(void)
 	if (listen(listen_sock, 1) < 0) {
 		fatal_error("Failed to listen on GDB remote debugging socket");
 	}
-	gdb_sock = accept(listen_sock, NULL, NULL);
-	if (gdb_sock < 0) {
+	int sock = accept(listen_sock, NULL, NULL);
+	if (sock < 0) {
 		fatal_error("accept returned an error while listening on GDB remote debugging socket");
 	}
 	socket_close(listen_sock);
-#else
-	disable_stdout_messages();
+	//replies are small and latency sensitive
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&param, sizeof(param));
+	return sock;
+}
+
+void gdb_remote_init(char *port)
+{
+	buf = malloc(INITIAL_BUFFER_SIZE);
+	curbuf = NULL;
+	bufsize = INITIAL_BUFFER_SIZE;
+#ifdef _WIN32
+	if (!port) {
+		port = "1234";
+	}
 #endif
+	if (port) {
+		gdb_in_fd = gdb_out_fd = gdb_listen(port);
+	} else {
+#ifndef _WIN32
+		gdb_in_fd = STDIN_FILENO;
+		gdb_out_fd = STDOUT_FILENO;
+		disable_stdout_messages();
+#endif
+	}
 }
@@ -31,69 +31,73 @@ static void sync_sound(gen_player *gen, uint32_t target)
 	//printf("Target: %d, YM bufferpos: %d, PSG bufferpos: %d\n", target, gen->ym->buffer_pos, gen->psg->buffer_pos * 2);
 }
 
+static void player_sound_run(void *data, uint32_t cycle)
+{
+	sync_sound(data, cycle);
+}
+
+static void player_video_run(void *data, uint32_t cycle)
+{
+	gen_player *player = data;
+	vdp_run_context(player->vdp, cycle);
+}
+
+static void player_adjust_cycles(void *data, uint32_t deduction)
+{
+	gen_player *player = data;
+	ym_adjust_cycles(player->ym, deduction);
+	vdp_adjust_cycles(player->vdp, deduction);
+	player->psg->cycles -= deduction;
+}
+
+static void player_video_event(void *data, uint8_t event, event_reader *reader)
+{
+	gen_player *player = data;
+	vdp_replay_event(player->vdp, event, reader);
+}
+
+static void player_psg_write(void *data, uint8_t value)
+{
+	gen_player *player = data;
+	psg_write(player->psg, value);
+}
+
+static void player_ym_write(void *data, uint8_t part, uint8_t reg, uint8_t value)
+{
+	gen_player *player = data;
+	if (part) {
+		ym_address_write_part2(player->ym, reg);
+	} else {
+		ym_address_write_part1(player->ym, reg);
+	}
+	ym_data_write(player->ym, value);
+}
+
+static void player_state_sections(void *data, deserialize_buffer *state)
+{
+	gen_player *player = data;
+	register_section_handler(state, (section_handler){.fun = vdp_deserialize, .data = player->vdp}, SECTION_VDP);
+	register_section_handler(state, (section_handler){.fun = ym_deserialize, .data = player->ym}, SECTION_YM2612);
+	register_section_handler(state, (section_handler){.fun = psg_deserialize, .data = player->psg}, SECTION_PSG);
+}
+
+static const event_replay_handlers player_handlers = {
+	.sound_run = player_sound_run,
+	.video_run = player_video_run,
+	.adjust_cycles = player_adjust_cycles,
+	.video_event = player_video_event,
+	.psg_write = player_psg_write,
+	.ym_write = player_ym_write,
+	.state_sections = player_state_sections
+};
+
 static void run(gen_player *player)
 {
 	while(player->reader.socket || player->reader.buffer.cur_pos < player->reader.buffer.size)
 	{
 		uint32_t cycle;
 		uint8_t event = reader_next_event(&player->reader, &cycle);
-		switch (event)
-		{
-		case EVENT_FLUSH:
-			sync_sound(player, cycle);
-			vdp_run_context(player->vdp, cycle);
-			break;
-		case EVENT_ADJUST: {
-			sync_sound(player, cycle);
-			vdp_run_context(player->vdp, cycle);
-			uint32_t deduction = load_int32(&player->reader.buffer);
-			ym_adjust_cycles(player->ym, deduction);
-			vdp_adjust_cycles(player->vdp, deduction);
-			player->psg->cycles -= deduction;
-			break;
-		case EVENT_PSG_REG:
-			sync_sound(player, cycle);
-			reader_ensure_data(&player->reader, 1);
-			psg_write(player->psg, load_int8(&player->reader.buffer));
-			break;
-		case EVENT_YM_REG: {
-			sync_sound(player, cycle);
-			reader_ensure_data(&player->reader, 3);
-			uint8_t part = load_int8(&player->reader.buffer);
-			uint8_t reg = load_int8(&player->reader.buffer);
-			uint8_t value = load_int8(&player->reader.buffer);
-			if (part) {
-				ym_address_write_part2(player->ym, reg);
-			} else {
-				ym_address_write_part1(player->ym, reg);
-			}
-			ym_data_write(player->ym, value);
-			break;
-		case EVENT_STATE: {
-			reader_ensure_data(&player->reader, 3);
-			uint32_t size = load_int8(&player->reader.buffer) << 16;
-			size |= load_int16(&player->reader.buffer);
-			reader_ensure_data(&player->reader, size);
-			deserialize_buffer buffer;
-			init_deserialize(&buffer, player->reader.buffer.data + player->reader.buffer.cur_pos, size);
-			register_section_handler(&buffer, (section_handler){.fun = vdp_deserialize, .data = player->vdp}, SECTION_VDP);
-			register_section_handler(&buffer, (section_handler){.fun = ym_deserialize, .data = player->ym}, SECTION_YM2612);
-			register_section_handler(&buffer, (section_handler){.fun = psg_deserialize, .data = player->psg}, SECTION_PSG);
-			while (buffer.cur_pos < buffer.size)
-			{
-				load_section(&buffer);
-			}
-			player->reader.buffer.cur_pos += size;
-			free(buffer.handlers);
-			break;
-		}
-		default:
-			vdp_run_context(player->vdp, cycle);
-			vdp_replay_event(player->vdp, event, &player->reader);
-		}
-		}
-			
-		}
+		reader_replay_event(&player->reader, event, cycle, &player_handlers, player);
 		if (!player->reader.socket) {
 			reader_ensure_data(&player->reader, 1);
 		}
@@ -20,6 +20,7 @@
 #include "jcart.h"
 #include "config.h"
 #include "event_log.h"
+#include "netplay.h"
 #define MCLKS_NTSC 53693175
 #define MCLKS_PAL  53203395
 
@@ -29,6 +30,8 @@ uint32_t MCLKS_PER_68K;
 #define MCLKS_PER_PSG (MCLKS_PER_Z80*16)
 #define Z80_INT_PULSE_MCLKS 2573 //measured value is ~171.5 Z80 clocks
 #define DEFAULT_SYNC_INTERVAL MCLKS_LINE
+//periodic syncs let the VDP fall this far behind so it can render whole lines at a time
+#define MAX_VDP_LAG (8*MCLKS_LINE)
 #define DEFAULT_LOWPASS_CUTOFF 3390
 
 //TODO: Figure out the exact value for this
@@ -140,7 +143,7 @@ static void ram_deserialize(deserialize_buffer *buf, void *vgen)
 		fatal_error("State has a RAM size of %d bytes", ram_size * 2);
 	}
 	load_buffer16(buf, gen->work_ram, ram_size);
-	m68k_invalidate_code_range(gen->m68k, 0xE00000, 0x1000000);
+	m68k_invalidate_code_range(gen->m68k, 0xE00000, 0xFFFFFF);
 }
 
 static void zram_deserialize(deserialize_buffer *buf, void *vgen)
@@ -208,22 +211,239 @@ static void deserialize(system_header *sys, uint8_t *data, size_t size)
 	gen->m68k->resume_pc = get_native_address_trans(gen->m68k, gen->m68k->last_prefetch_address);
 }
 
-uint16_t read_dma_value(uint32_t address)
+//My refresh emulation isn't currently good enough and causes more problems than it solves
+#define REFRESH_EMULATION
+#ifdef REFRESH_EMULATION
+#define REFRESH_INTERVAL 128
+#define REFRESH_DELAY 2
+#endif
+
+struct genesis_snapshot {
+	uint8_t          *data;
+	uint32_t         size;
+	serialize_buffer mapper;
+	uint8_t          valid;
+};
+
+//bits of genesis_context that aren't owned by any one component
+typedef struct {
+	uint32_t     frame_end;
+	uint32_t     reset_cycle;
+	uint32_t     last_frame;
+	uint32_t     last_flush_cycle;
+	uint16_t     z80_bank_reg;
+	uint16_t     tmss_lock[2];
+	uint8_t      bus_busy;
+	eeprom_state eeprom;
+#ifdef REFRESH_EMULATION
+	uint32_t     last_sync_cycle;
+	uint32_t     refresh_counter;
+#endif
+} snapshot_misc;
+
+genesis_snapshot *genesis_alloc_snapshot(genesis_context *gen)
+{
+#ifdef NEW_CORE
+	//the Z80 core generated from z80.cpu doesn't support snapshots yet
+	return NULL;
+#else
+	genesis_snapshot *snap = calloc(1, sizeof(genesis_snapshot));
+	snap->size = m68k_snapshot_size() + z80_snapshot_size() + vdp_snapshot_size()
+		+ sizeof(ym2612_context) + sizeof(psg_context) + 3 * sizeof(io_port)
+		+ RAM_WORDS * 2 + Z80_RAM_BYTES + (gen->save_storage ? gen->save_size : 0) + sizeof(snapshot_misc);
+	snap->data = malloc(snap->size);
+	init_serialize(&snap->mapper);
+	return snap;
+#endif
+}
+
+void genesis_free_snapshot(genesis_snapshot *snap)
+{
+	free(snap->data);
+	free(snap->mapper.data);
+	free(snap);
+}
+
+void genesis_save_snapshot(genesis_context *gen, genesis_snapshot *snap, uint32_t m68k_pc)
+{
+	uint8_t *dst = snap->data;
+	dst = m68k_save_snapshot(gen->m68k, m68k_pc, dst);
+#ifndef NEW_CORE
+	dst = z80_save_snapshot(gen->z80, dst);
+#endif
+	dst = vdp_save_snapshot(gen->vdp, dst);
+	dst = ym_save_snapshot(gen->ym, dst);
+	dst = psg_save_snapshot(gen->psg, dst);
+	for (int i = 0; i < 3; i++)
+	{
+		dst = io_save_snapshot(gen->io.ports + i, dst);
+	}
+	memcpy(dst, gen->work_ram, RAM_WORDS * 2);
+	dst += RAM_WORDS * 2;
+	memcpy(dst, gen->zram, Z80_RAM_BYTES);
+	dst += Z80_RAM_BYTES;
+	if (gen->save_storage) {
+		memcpy(dst, gen->save_storage, gen->save_size);
+		dst += gen->save_size;
+	}
+	snapshot_misc misc = {
+		.frame_end = gen->frame_end,
+		.reset_cycle = gen->reset_cycle,
+		.last_frame = gen->last_frame,
+		.last_flush_cycle = gen->last_flush_cycle,
+		.z80_bank_reg = gen->z80_bank_reg,
+		.tmss_lock = {gen->tmss_lock[0], gen->tmss_lock[1]},
+		.bus_busy = gen->bus_busy,
+		.eeprom = gen->eeprom,
+#ifdef REFRESH_EMULATION
+		//sync_components updates last_sync_cycle after taking the snapshot
+		.last_sync_cycle = gen->m68k->current_cycle,
+		.refresh_counter = gen->refresh_counter
+#endif
+	};
+	memcpy(dst, &misc, sizeof(misc));
+	//mapper state is small and mapper specific, so it goes through the portable format
+	snap->mapper.size = 0;
+	cart_serialize(&gen->header, &snap->mapper);
+	snap->valid = 1;
+}
+
+void genesis_request_snapshot(genesis_context *gen, genesis_snapshot *snap)
+{
+	gen->snapshot = snap;
+	gen->header.save_state = SNAPSHOT_SLOT + 1;
+}
+
+#define SNAPSHOT_COMPARE_BLOCK 256
+//finds the next run of blocks at or after *offset that differ between the live RAM and the snapshot
+//returns its size in bytes and updates *offset to point at its start, returns 0 if the rest is unchanged
+static uint32_t snapshot_changed_range(uint8_t *live, uint8_t *saved, uint32_t size, uint32_t *offset)
+{
+	uint32_t start = *offset;
+	while (start < size && !memcmp(live + start, saved + start, SNAPSHOT_COMPARE_BLOCK))
+	{
+		start += SNAPSHOT_COMPARE_BLOCK;
+	}
+	if (start >= size) {
+		return 0;
+	}
+	uint32_t end = start + SNAPSHOT_COMPARE_BLOCK;
+	while (end < size && memcmp(live + end, saved + end, SNAPSHOT_COMPARE_BLOCK))
+	{
+		end += SNAPSHOT_COMPARE_BLOCK;
+	}
+	*offset = start;
+	return end - start;
+}
+
+uint8_t genesis_load_snapshot(genesis_context *gen, genesis_snapshot *snap)
+{
+	if (!snap->valid) {
+		return 0;
+	}
+	uint8_t *src = snap->data;
+	src = m68k_load_snapshot(gen->m68k, src);
+#ifndef NEW_CORE
+	src = z80_load_snapshot(gen->z80, src);
+#endif
+	src = vdp_load_snapshot(gen->vdp, src);
+	src = ym_load_snapshot(gen->ym, src);
+	src = psg_load_snapshot(gen->psg, src);
+	for (int i = 0; i < 3; i++)
+	{
+		src = io_load_snapshot(gen->io.ports + i, src);
+	}
+	//snapshots are usually only a few frames apart, so only retranslate code in the parts of RAM that changed
+	uint32_t offset = 0, size;
+	while ((size = snapshot_changed_range((uint8_t *)gen->work_ram, src, RAM_WORDS * 2, &offset)))
+	{
+		//0x1000000 would wrap around to the ROM at 0, instructions never start at odd addresses so stop one byte short
+		m68k_invalidate_code_range(gen->m68k, 0xFF0000 + offset, 0xFF0000 + offset + size - 1);
+		offset += size;
+	}
+	memcpy(gen->work_ram, src, RAM_WORDS * 2);
+	src += RAM_WORDS * 2;
+	offset = 0;
+	while ((size = snapshot_changed_range(gen->zram, src, Z80_RAM_BYTES, &offset)))
+	{
+		//the end of RAM would alias back to the start, so use the end of the mirrored area instead
+		z80_invalidate_code_range(gen->z80, offset, offset + size < Z80_RAM_BYTES ? offset + size : 0x4000);
+		offset += size;
+	}
+	memcpy(gen->zram, src, Z80_RAM_BYTES);
+	src += Z80_RAM_BYTES;
+	if (gen->save_storage) {
+		memcpy(gen->save_storage, src, gen->save_size);
+		src += gen->save_size;
+	}
+	snapshot_misc misc;
+	memcpy(&misc, src, sizeof(misc));
+	gen->frame_end = misc.frame_end;
+	gen->reset_cycle = misc.reset_cycle;
+	gen->last_frame = misc.last_frame;
+	gen->last_flush_cycle = misc.last_flush_cycle;
+	gen->tmss_lock[0] = misc.tmss_lock[0];
+	gen->tmss_lock[1] = misc.tmss_lock[1];
+	gen->bus_busy = misc.bus_busy;
+	misc.eeprom.buffer = gen->eeprom.buffer;
+	gen->eeprom = misc.eeprom;
+#ifdef REFRESH_EMULATION
+	gen->last_sync_cycle = misc.last_sync_cycle;
+	gen->refresh_counter = misc.refresh_counter;
+#endif
+	if (snap->mapper.size) {
+		deserialize_buffer buf;
+		init_deserialize(&buf, snap->mapper.data, snap->mapper.size);
+		register_section_handler(&buf, (section_handler){.fun = cart_deserialize, .data = gen}, SECTION_MAPPER);
+		load_section(&buf);
+		free(buf.handlers);
+	}
+	if (misc.z80_bank_reg != gen->z80_bank_reg) {
+		gen->z80_bank_reg = misc.z80_bank_reg;
+		update_z80_bank_pointer(gen);
+	}
+	adjust_int_cycle(gen->m68k, gen->vdp);
+	gen->m68k->resume_pc = get_native_address_trans(gen->m68k, gen->m68k->last_prefetch_address);
+	return 1;
+}
+
+uint16_t read_dma_value(system_header *system, uint32_t address)
 {
-	genesis_context *genesis = (genesis_context *)current_system;
+	genesis_context *genesis = (genesis_context *)system;
 	//TODO: Figure out what happens when you try to DMA from weird adresses like IO or banked Z80 area
 	if ((address >= 0xA00000 && address < 0xB00000) || (address >= 0xC00000 && address <= 0xE00000)) {
 		return 0;
 	}
 	
 	//addresses here are word addresses (i.e. bit 0 corresponds to A1), so no need to do multiply by 2
-	return read_word(address * 2, (void **)genesis->m68k->mem_pointers, &genesis->m68k->options->gen, genesis->m68k);
+	address = (address * 2) & genesis->m68k->options->gen.address_mask;
+	//DMA reads sequential words so remember the last chunk we read from, the base pointer is checked
+	//on every read so bank switches and SRAM toggles between or during transfers are picked up
+	memmap_chunk const *chunk = genesis->dma_chunk;
+	if (chunk && address >= chunk->start && address < chunk->end) {
+		uint8_t *base = chunk->flags & MMAP_PTR_IDX ? genesis->m68k->mem_pointers[chunk->ptr_index] : chunk->buffer;
+		if (base && base == genesis->dma_base) {
+			return *(uint16_t *)(base + (address & chunk->mask));
+		}
+	}
+	cpu_options *opts = &genesis->m68k->options->gen;
+	chunk = find_map_chunk(address, opts, 0, NULL);
+	genesis->dma_chunk = NULL;
+	if (chunk && (chunk->flags & MMAP_READ) && !(chunk->flags & (MMAP_ONLY_ODD|MMAP_ONLY_EVEN))) {
+		uint8_t *base = chunk->flags & MMAP_PTR_IDX ? genesis->m68k->mem_pointers[chunk->ptr_index] : chunk->buffer;
+		if (base) {
+			genesis->dma_chunk = chunk;
+			genesis->dma_base = base;
+			return *(uint16_t *)(base + (address & chunk->mask));
+		}
+	}
+	return read_word(address, (void **)genesis->m68k->mem_pointers, opts, genesis->m68k);
 }
 
 static uint16_t get_open_bus_value(system_header *system)
 {
 	genesis_context *genesis = (genesis_context *)system;
-	return read_dma_value(genesis->m68k->last_prefetch_address/2);
+	return read_dma_value(system, genesis->m68k->last_prefetch_address/2);
 }
 
 static void adjust_int_cycle(m68k_context * context, vdp_context * v_context)
@@ -348,19 +568,155 @@ static void sync_sound(genesis_context * gen, uint32_t target)
 	//printf("Target: %d, YM bufferpos: %d, PSG bufferpos: %d\n", target, gen->ym->buffer_pos, gen->psg->buffer_pos * 2);
 }
 
-//My refresh emulation isn't currently good enough and causes more problems than it solves
-#define REFRESH_EMULATION
-#ifdef REFRESH_EMULATION
-#define REFRESH_INTERVAL 128
-#define REFRESH_DELAY 2
-uint32_t last_sync_cycle;
-uint32_t refresh_counter;
-#endif
-
 #include <limits.h>
 #define ADJUST_BUFFER (8*MCLKS_LINE*313)
 #define MAX_NO_ADJUST (UINT_MAX-ADJUST_BUFFER)
 
+//Run-ahead: after each real frame a snapshot is taken and runahead_frames more frames are emulated with the
+//same input, only the last of which is shown. The snapshot is then restored so the next real frame continues
+//from where the last one ended. Video is suppressed for real frames and audio for speculative ones.
+static void runahead_set_output(genesis_context *gen, uint8_t video, uint8_t audio)
+{
+	gen->vdp->suppress_output = !video;
+	gen->ym->audio->suppressed = !audio;
+	gen->psg->audio->suppressed = !audio;
+}
+
+static void runahead_frame_end(genesis_context *gen, m68k_context *context)
+{
+	if (!gen->runahead_count) {
+		if (gen->runahead_wanted) {
+			//no snapshot could be taken after this frame, so show the next one normally
+			gen->runahead_wanted = 0;
+			runahead_set_output(gen, 1, 1);
+		} else if (!gen->vdp->suppress_output) {
+			//this frame was shown normally, run-ahead starts with the next one
+			runahead_set_output(gen, 0, 1);
+		} else {
+			gen->runahead_wanted = 1;
+		}
+	} else if (gen->runahead_count < gen->runahead_frames) {
+		if (++gen->runahead_count == gen->runahead_frames) {
+			runahead_set_output(gen, 1, 0);
+		}
+		if (!gen->header.save_state) {
+			//taking a snapshot adds a sync point, which affects timing slightly, so stop at the
+			//same place a real frame would to keep speculative frames identical to real ones
+			gen->snapshot = NULL;
+			gen->header.save_state = SNAPSHOT_SLOT + 1;
+		}
+	} else {
+		gen->runahead_restore = 1;
+		context->should_return = 1;
+	}
+}
+
+//returns to the real timeline, must be called while the 68K is stopped
+static void runahead_cancel(genesis_context *gen)
+{
+	if (gen->runahead_count) {
+		genesis_load_snapshot(gen, gen->runahead_snapshot);
+		gen->runahead_count = 0;
+	}
+	gen->runahead_restore = 0;
+	gen->runahead_wanted = 0;
+	runahead_set_output(gen, 1, 1);
+}
+
+//Rollback netplay: a snapshot is taken at the start of every frame and the input for that frame is applied
+//right after it. When the peer's input turns out to differ from what was predicted, the snapshot of the first
+//mispredicted frame is loaded and everything up to the current frame is emulated again with output suppressed.
+static void netplay_apply_input(genesis_context *gen)
+{
+	uint16_t pads[2];
+	netplay_frame_input(pads, pads + 1);
+	for (int pad = 0; pad < 2; pad++)
+	{
+		uint16_t changed = pads[pad] ^ gen->netplay_buttons[pad];
+		for (uint8_t button = DPAD_UP; button < NUM_GAMEPAD_BUTTONS; button++)
+		{
+			if (!(changed & 1 << button)) {
+				continue;
+			}
+			if (pads[pad] & 1 << button) {
+				io_gamepad_down(&gen->io, pad + 1, button);
+			} else {
+				io_gamepad_up(&gen->io, pad + 1, button);
+			}
+		}
+		gen->netplay_buttons[pad] = pads[pad];
+	}
+}
+
+static genesis_snapshot *netplay_frame_snapshot(genesis_context *gen)
+{
+	return gen->netplay_snapshots[netplay_frame() % (gen->netplay_rollback + 1)];
+}
+
+//both peers load the state serialized by the host so they start out identical, must be called while the 68K is stopped
+static void netplay_begin(genesis_context *gen)
+{
+	uint8_t *state = gen->netplay_state;
+	uint32_t size = gen->netplay_state_size;
+	gen->netplay_state = NULL;
+	if (!netplay_is_host()) {
+		state = netplay_recv_state(&size);
+	}
+	if (!state) {
+		return;
+	}
+	deserialize(&gen->header, state, size);
+	free(state);
+	//the frame counter isn't part of the serialized state, don't treat the load as the end of a frame
+	gen->last_frame = gen->vdp->frame;
+#ifdef REFRESH_EMULATION
+	gen->last_sync_cycle = gen->m68k->current_cycle;
+	gen->refresh_counter = 0;
+#endif
+	gen->m68k->sync_cycle = gen->m68k->current_cycle;
+	adjust_int_cycle(gen->m68k, gen->vdp);
+	for (int pad = 0; pad < 2; pad++)
+	{
+		for (uint8_t button = DPAD_UP; button < NUM_GAMEPAD_BUTTONS; button++)
+		{
+			io_gamepad_up(&gen->io, pad + 1, button);
+		}
+		gen->netplay_buttons[pad] = 0;
+	}
+	netplay_start(gen->netplay_rollback, gen->netplay_delay);
+	genesis_request_snapshot(gen, netplay_frame_snapshot(gen));
+}
+
+static void netplay_handle_frame_end(genesis_context *gen, m68k_context *context)
+{
+	if (!netplay_started()) {
+		if (!netplay_is_host()) {
+			gen->netplay_sync = 1;
+			context->should_return = 1;
+		} else if (gen->netplay_state) {
+			//the state was serialized during the last frame, roll back to it so both peers use the same one
+			gen->netplay_sync = 1;
+			context->should_return = 1;
+		} else if (!gen->header.save_state) {
+			gen->header.save_state = NETPLAY_SLOT + 1;
+		}
+		return;
+	}
+	uint32_t restore = netplay_frame_end();
+	if (!netplay_active()) {
+		runahead_set_output(gen, 1, 1);
+		return;
+	}
+	if (restore != NETPLAY_NO_ROLLBACK) {
+		gen->netplay_restore = 1;
+		context->should_return = 1;
+		return;
+	}
+	uint8_t resimulating = netplay_resimulating();
+	runahead_set_output(gen, !resimulating, !resimulating);
+	genesis_request_snapshot(gen, netplay_frame_snapshot(gen));
+}
+
 m68k_context * sync_components(m68k_context * context, uint32_t address)
 {
 	genesis_context * gen = context->system;
@@ -368,17 +724,23 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 	z80_context * z_context = gen->z80;
 #ifdef REFRESH_EMULATION
 	//lame estimation of refresh cycle delay
-	refresh_counter += context->current_cycle - last_sync_cycle;
+	gen->refresh_counter += context->current_cycle - gen->last_sync_cycle;
 	if (!gen->bus_busy) {
-		context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
+		context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (gen->refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
 	}
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
 #endif
 
 	uint32_t mclks = context->current_cycle;
 	sync_z80(z_context, mclks);
 	sync_sound(gen, mclks);
-	vdp_run_context(v_context, mclks);
+	if (
+		mclks >= gen->frame_end || mclks >= gen->reset_cycle || mclks - v_context->cycles >= MAX_VDP_LAG
+		|| context->int_ack || context->should_return || (v_context->flags & FLAG_DMA_RUN)
+		|| gen->header.enter_debugger || gen->header.save_state
+	) {
+		vdp_run_context(v_context, mclks);
+	}
 	if (mclks >= gen->reset_cycle) {
 		gen->reset_requested = 1;
 		context->should_return = 1;
@@ -389,6 +751,24 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 		gen->last_frame = v_context->frame;
 		event_flush(mclks);
 		gen->last_flush_cycle = mclks;
+		if (netplay_active()) {
+			netplay_handle_frame_end(gen, context);
+		} else if (gen->runahead_count) {
+			//speculative frames never become part of the rewind history
+			runahead_frame_end(gen, context);
+		} else {
+			if (gen->rewind) {
+				if (gen->header.rewinding) {
+					gen->rewind_pending = 1;
+					context->should_return = 1;
+				} else if (!gen->header.save_state && rewind_frame(gen->rewind)) {
+					gen->header.save_state = REWIND_SLOT + 1;
+				}
+			}
+			if (gen->runahead_frames && !gen->rewind_pending) {
+				runahead_frame_end(gen, context);
+			}
+		}
 
 		if(exit_after){
 			--exit_after;
@@ -430,6 +810,10 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 		vdp_int_ack(v_context);
 		context->int_ack = 0;
 	}
+	if (gen->runahead_wanted && !gen->header.save_state) {
+		gen->runahead_wanted = 0;
+		genesis_request_snapshot(gen, gen->runahead_snapshot);
+	}
 	if (!address && (gen->header.enter_debugger || gen->header.save_state)) {
 		context->sync_cycle = context->current_cycle + 1;
 	}
@@ -459,7 +843,18 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 			}
 #endif
 			char *save_path = slot >= SERIALIZE_SLOT ? NULL : get_slot_name(&gen->header, slot, use_native_states ? "state" : "gst");
-			if (use_native_states || slot >= SERIALIZE_SLOT) {
+			if (slot == SNAPSHOT_SLOT) {
+				if (gen->snapshot) {
+					genesis_save_snapshot(gen, gen->snapshot, address);
+					if (gen->snapshot == gen->runahead_snapshot) {
+						gen->runahead_count = 1;
+						runahead_set_output(gen, gen->runahead_frames == 1, 0);
+					} else if (netplay_active()) {
+						netplay_apply_input(gen);
+					}
+					gen->snapshot = NULL;
+				}
+			} else if (use_native_states || slot >= SERIALIZE_SLOT) {
 				serialize_buffer state;
 				init_serialize(&state);
 				genesis_serialize(gen, &state, address, slot != EVENTLOG_SLOT);
@@ -470,6 +865,14 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 					context->should_return = 1;
 				} else if (slot == EVENTLOG_SLOT) {
 					event_state(context->current_cycle, &state);
+				} else if (slot == REWIND_SLOT) {
+					rewind_capture(gen->rewind, state.data, state.size);
+				} else if (slot == NETPLAY_SLOT) {
+					if (netplay_active()) {
+						netplay_send_state(state.data, state.size);
+					}
+					gen->netplay_state = state.data;
+					gen->netplay_state_size = state.size;
 				} else {
 					save_to_file(&state, save_path);
 					free(state.data);
@@ -477,7 +880,7 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 			} else {
 				save_gst(gen, save_path, address);
 			}
-			if (slot != SERIALIZE_SLOT) {
+			if (slot < SERIALIZE_SLOT) {
 				debug_message("Saved state to %s\n", save_path);
 			}
 			free(save_path);
@@ -486,7 +889,7 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 		}
 	}
 #ifdef REFRESH_EMULATION
-	last_sync_cycle = context->current_cycle;
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	return context;
 }
@@ -498,16 +901,18 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 	}
 	vdp_port &= 0x1F;
 	//printf("vdp_port write: %X, value: %X, cycle: %d\n", vdp_port, value, context->current_cycle);
+	genesis_context * gen = context->system;
 #ifdef REFRESH_EMULATION
 	//do refresh check here so we can avoid adding a penalty for a refresh that happens during a VDP access
-	refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - last_sync_cycle;
-	context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-	last_sync_cycle = context->current_cycle;
+	gen->refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - gen->last_sync_cycle;
+	context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (gen->refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
+	gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	sync_components(context, 0);
-	genesis_context * gen = context->system;
 	vdp_context *v_context = gen->vdp;
+	//sync_components may have left the VDP behind
+	vdp_run_context(v_context, context->current_cycle);
 	uint32_t before_cycle = v_context->cycles;
 	if (vdp_port < 0x10) {
 		int blocked;
@@ -559,6 +964,10 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 			} else {
 				context->sync_cycle = gen->frame_end = vdp_cycles_to_frame_end(v_context);
 				//printf("Set sync cycle to: %d @ %d, vcounter: %d, hslot: %d\n", context->sync_cycle, context->current_cycle, v_context->vcounter, v_context->hslot);
+				if (gen->header.enter_debugger || gen->header.save_state) {
+					//don't lose the early sync requested by sync_components
+					context->sync_cycle = context->current_cycle + 1;
+				}
 				adjust_int_cycle(context, v_context);
 			}
 		} else {
@@ -583,16 +992,16 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 		vdp_test_port_write(gen->vdp, value);
 	}
 #ifdef REFRESH_EMULATION
-	last_sync_cycle -= 4 * MCLKS_PER_68K;
+	gen->last_sync_cycle -= 4 * MCLKS_PER_68K;
 	//refresh may have happened while we were waiting on the VDP,
 	//so advance refresh_counter but don't add any delays
 	if (vdp_port >= 4 && vdp_port < 8 && v_context->cycles != before_cycle) {
-		refresh_counter = 0;
+		gen->refresh_counter = 0;
 	} else {
-		refresh_counter += (context->current_cycle - last_sync_cycle);
-		refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+		gen->refresh_counter += (context->current_cycle - gen->last_sync_cycle);
+		gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
 	}
-	last_sync_cycle = context->current_cycle;
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	return context;
 }
@@ -637,16 +1046,18 @@ static uint16_t vdp_port_read(uint32_t vdp_port, m68k_context * context)
 	}
 	vdp_port &= 0x1F;
 	uint16_t value;
+	genesis_context *gen = context->system;
 #ifdef REFRESH_EMULATION
 	//do refresh check here so we can avoid adding a penalty for a refresh that happens during a VDP access
-	refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - last_sync_cycle;
-	context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-	last_sync_cycle = context->current_cycle;
+	gen->refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - gen->last_sync_cycle;
+	context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (gen->refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
+	gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	sync_components(context, 0);
-	genesis_context *gen = context->system;
 	vdp_context * v_context = gen->vdp;
+	//sync_components may have left the VDP behind
+	vdp_run_context(v_context, context->current_cycle);
 	uint32_t before_cycle = v_context->cycles;
 	if (vdp_port < 0x10) {
 		if (vdp_port < 4) {
@@ -666,18 +1077,17 @@ static uint16_t vdp_port_read(uint32_t vdp_port, m68k_context * context)
 		//printf("68K paused for %d (%d) cycles at cycle %d (%d) for read\n", v_context->cycles - context->current_cycle, v_context->cycles - before_cycle, context->current_cycle, before_cycle);
 		context->current_cycle = v_context->cycles;
 		//Lock the Z80 out of the bus until the VDP access is complete
-		genesis_context *gen = context->system;
 		gen->bus_busy = 1;
 		sync_z80(gen->z80, v_context->cycles);
 		gen->bus_busy = 0;
 	}
 #ifdef REFRESH_EMULATION
-	last_sync_cycle -= 4 * MCLKS_PER_68K;
+	gen->last_sync_cycle -= 4 * MCLKS_PER_68K;
 	//refresh may have happened while we were waiting on the VDP,
 	//so advance refresh_counter but don't add any delays
-	refresh_counter += (context->current_cycle - last_sync_cycle);
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-	last_sync_cycle = context->current_cycle;
+	gen->refresh_counter += (context->current_cycle - gen->last_sync_cycle);
+	gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	return value;
 }
@@ -735,10 +1145,10 @@ static m68k_context * io_write(uint32_t location, m68k_context * context, uint8_
 	genesis_context * gen = context->system;
 #ifdef REFRESH_EMULATION
 	//do refresh check here so we can avoid adding a penalty for a refresh that happens during an IO area access
-	refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - last_sync_cycle;
-	context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-	last_sync_cycle = context->current_cycle - 4*MCLKS_PER_68K;
+	gen->refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - gen->last_sync_cycle;
+	context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (gen->refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
+	gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->last_sync_cycle = context->current_cycle - 4*MCLKS_PER_68K;
 #endif
 	if (location < 0x10000) {
 		//Access to Z80 memory incurs a one 68K cycle wait state
@@ -866,8 +1276,8 @@ static m68k_context * io_write(uint32_t location, m68k_context * context, uint8_
 	}
 #ifdef REFRESH_EMULATION
 	//no refresh delays during IO access
-	refresh_counter += context->current_cycle - last_sync_cycle;
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->refresh_counter += context->current_cycle - gen->last_sync_cycle;
+	gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
 #endif
 	return context;
 }
@@ -894,10 +1304,10 @@ static uint8_t io_read(uint32_t location, m68k_context * context)
 	genesis_context *gen = context->system;
 #ifdef REFRESH_EMULATION
 	//do refresh check here so we can avoid adding a penalty for a refresh that happens during an IO area access
-	refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - last_sync_cycle;
-	context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-	last_sync_cycle = context->current_cycle - 4*MCLKS_PER_68K;
+	gen->refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - gen->last_sync_cycle;
+	context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (gen->refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
+	gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->last_sync_cycle = context->current_cycle - 4*MCLKS_PER_68K;
 #endif
 	if (location < 0x10000) {
 		//Access to Z80 memory incurs a one 68K cycle wait state
@@ -996,8 +1406,8 @@ static uint8_t io_read(uint32_t location, m68k_context * context)
 	}
 #ifdef REFRESH_EMULATION
 	//no refresh delays during IO access
-	refresh_counter += context->current_cycle - last_sync_cycle;
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->refresh_counter += context->current_cycle - gen->last_sync_cycle;
+	gen->refresh_counter = gen->refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
 #endif
 	return value;
 }
@@ -1227,6 +1637,11 @@ void set_region(genesis_context *gen, rom_info *info, uint8_t region)
 
 static uint8_t load_state(system_header *system, uint8_t slot)
 {
+	if (netplay_active()) {
+		//the other peer would keep running from the old state
+		warning("Save states are not available during netplay\n");
+		return 0;
+	}
 	genesis_context *gen = (genesis_context *)system;
 	char *statepath = get_slot_name(system, slot, "state");
 	deserialize_buffer state;
@@ -1263,9 +1678,38 @@ done:
 
 static void handle_reset_requests(genesis_context *gen)
 {
-	while (gen->reset_requested || gen->header.delayed_load_slot)
+	while (gen->reset_requested || gen->header.delayed_load_slot || gen->rewind_pending || gen->runahead_restore
+		|| gen->netplay_sync || gen->netplay_restore)
 	{
+		if (gen->netplay_sync || gen->netplay_restore) {
+			if (gen->netplay_sync) {
+				gen->netplay_sync = 0;
+				netplay_begin(gen);
+			} else {
+				gen->netplay_restore = 0;
+				genesis_load_snapshot(gen, netplay_frame_snapshot(gen));
+				netplay_apply_input(gen);
+				runahead_set_output(gen, 0, 0);
+			}
+#ifndef IS_LIB
+			//these only happen at the end of a frame, which already ended retro_run in the libretro core
+			resume_68k(gen->m68k);
+#endif
+		}
+		if (gen->runahead_restore) {
+			gen->runahead_restore = 0;
+			genesis_load_snapshot(gen, gen->runahead_snapshot);
+			gen->runahead_count = 0;
+			runahead_set_output(gen, 0, 1);
+#ifndef IS_LIB
+			//in the libretro core, presenting the last speculative frame already ended retro_run
+			resume_68k(gen->m68k);
+#endif
+		}
 		if (gen->reset_requested) {
+			if (gen->runahead_frames) {
+				runahead_cancel(gen);
+			}
 			gen->reset_requested = 0;
 			gen->m68k->should_return = 0;
 			z80_assert_reset(gen->z80, gen->m68k->current_cycle);
@@ -1275,12 +1719,27 @@ static void handle_reset_requests(genesis_context *gen)
 			m68k_reset(gen->m68k);
 		}
 		if (gen->header.delayed_load_slot) {
+			if (gen->runahead_frames) {
+				runahead_cancel(gen);
+			}
 			load_state(&gen->header, gen->header.delayed_load_slot - 1);
 			gen->header.delayed_load_slot = 0;
 			resume_68k(gen->m68k);
 		}
+		if (gen->rewind_pending) {
+			if (gen->runahead_frames) {
+				runahead_cancel(gen);
+			}
+			gen->rewind_pending = 0;
+			uint32_t size;
+			uint8_t *state = rewind_step_back(gen->rewind, &size);
+			if (state) {
+				deserialize(&gen->header, state, size);
+			}
+			resume_68k(gen->m68k);
+		}
 	}
-	if (gen->header.force_release || render_should_release_on_exit()) {
+	if (!gen->vdp->sink && (gen->header.force_release || render_should_release_on_exit())) {
 		bindings_release_capture();
 		vdp_release_framebuffer(gen->vdp);
 		render_pause_source(gen->ym->audio);
@@ -1328,7 +1787,7 @@ static void start_genesis(system_header *system, char *statefile)
 static void resume_genesis(system_header *system)
 {
 	genesis_context *gen = (genesis_context *)system;
-	if (gen->header.force_release || render_should_release_on_exit()) {
+	if (!gen->vdp->sink && (gen->header.force_release || render_should_release_on_exit())) {
 		gen->header.force_release = 0;
 		render_set_video_standard((gen->version_reg & HZ50) ? VID_PAL : VID_NTSC);
 		bindings_reacquire_capture();
@@ -1340,6 +1799,13 @@ static void resume_genesis(system_header *system)
 	handle_reset_requests(gen);
 }
 
+void genesis_set_sinks(genesis_context *gen, video_sink *video, audio_sink *audio)
+{
+	vdp_set_video_sink(gen->vdp, video);
+	render_audio_source_set_sink(gen->ym->audio, audio);
+	render_audio_source_set_sink(gen->psg->audio, audio);
+}
+
 static void inc_debug_mode(system_header *system)
 {
 	genesis_context *gen = (genesis_context *)system;
@@ -1393,6 +1859,11 @@ static void load_save(system_header *system)
 
 static void soft_reset(system_header *system)
 {
+	if (netplay_active()) {
+		//a reset that only happens on one side would desync the session
+		warning("Soft reset is not available during netplay\n");
+		return;
+	}
 	genesis_context *gen = (genesis_context *)system;
 	if (gen->reset_cycle == CYCLE_NEVER) {
 		double random = (double)rand()/(double)RAND_MAX;
@@ -1409,23 +1880,45 @@ static void free_genesis(system_header *system)
 	vdp_free(gen->vdp);
 	memmap_chunk *map = (memmap_chunk *)gen->m68k->options->gen.memmap;
 	m68k_options_free(gen->m68k->options);
-	free(gen->cart);
+	release_rom(gen->cart);
 	free(gen->m68k);
 	free(gen->work_ram);
 	z80_options_free(gen->z80->Z80_OPTS);
 	free(gen->z80);
 	free(gen->zram);
+	free(gen->z80_map);
 	ym_free(gen->ym);
 	psg_free(gen->psg);
 	free(gen->header.save_dir);
 	free_rom_info(&gen->header.info);
 	free(gen->lock_on);
+	if (gen->runahead_snapshot) {
+		genesis_free_snapshot(gen->runahead_snapshot);
+	}
+	if (gen->rewind) {
+		rewind_free(gen->rewind);
+	}
+	if (gen->netplay_snapshots) {
+		for (uint32_t i = 0; i <= gen->netplay_rollback; i++)
+		{
+			genesis_free_snapshot(gen->netplay_snapshots[i]);
+		}
+		free(gen->netplay_snapshots);
+	}
+	free(gen->netplay_state);
 	free(gen);
 }
 
 static void gamepad_down(system_header *system, uint8_t gamepad_num, uint8_t button)
 {
 	genesis_context *gen = (genesis_context *)system;
+	if (netplay_active()) {
+		//pads are driven by the netplay session, the local player is always on the first one
+		if (gamepad_num == 1) {
+			netplay_local_button(button, 1);
+		}
+		return;
+	}
 	io_gamepad_down(&gen->io, gamepad_num, button);
 	if (gen->mapper_type == MAPPER_JCART) {
 		jcart_gamepad_down(gen, gamepad_num, button);
@@ -1435,6 +1928,12 @@ static void gamepad_down(system_header *system, uint8_t gamepad_num, uint8_t but
 static void gamepad_up(system_header *system, uint8_t gamepad_num, uint8_t button)
 {
 	genesis_context *gen = (genesis_context *)system;
+	if (netplay_active()) {
+		if (gamepad_num == 1) {
+			netplay_local_button(button, 0);
+		}
+		return;
+	}
 	io_gamepad_up(&gen->io, gamepad_num, button);
 	if (gen->mapper_type == MAPPER_JCART) {
 		jcart_gamepad_up(gen, gamepad_num, button);
@@ -1587,10 +2086,12 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	
 	set_audio_config(gen);
 
-	z80_map[0].buffer = gen->zram = calloc(1, Z80_RAM_BYTES);
+	gen->z80_map = malloc(sizeof(z80_map));
+	memcpy(gen->z80_map, z80_map, sizeof(z80_map));
+	gen->z80_map[0].buffer = gen->zram = calloc(1, Z80_RAM_BYTES);
 #ifndef NO_Z80
 	z80_options *z_opts = malloc(sizeof(z80_options));
-	init_z80_opts(z_opts, z80_map, 5, NULL, 0, MCLKS_PER_Z80, 0xFFFF);
+	init_z80_opts(z_opts, gen->z80_map, 5, NULL, 0, MCLKS_PER_Z80, 0xFFFF);
 	gen->z80 = init_z80_context(z_opts);
 #ifndef NEW_CORE
 	gen->z80->next_int_pulse = z80_next_int_pulse;
@@ -1637,6 +2138,15 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	}
 	setup_io_devices(config, rom, &gen->io);
 	gen->header.has_keyboard = io_has_keyboard(&gen->io);
+	
+	//stepping back on one side of a netplay session would desync it from the other
+	if (!netplay_active() && !strcmp("on", tern_find_path_default(config, "system\0rewind\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval)) {
+		uint32_t rewind_mb = atoi(tern_find_path_default(config, "system\0rewind_buffer_size\0", (tern_val){.ptrval = "8"}, TVAL_PTR).ptrval);
+		uint32_t rewind_interval = atoi(tern_find_path_default(config, "system\0rewind_interval\0", (tern_val){.ptrval = "1"}, TVAL_PTR).ptrval);
+		if (rewind_mb) {
+			gen->rewind = rewind_alloc(rewind_mb * 1024 * 1024, rewind_interval);
+		}
+	}
 
 	gen->mapper_type = rom->mapper_type;
 	gen->save_type = rom->save_type;
@@ -1690,6 +2200,39 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 		}
 	}
 	gen->reset_cycle = CYCLE_NEVER;
+	
+	if (netplay_active()) {
+		gen->netplay_rollback = atoi(tern_find_path_default(config, "system\0netplay_rollback\0", (tern_val){.ptrval = "8"}, TVAL_PTR).ptrval);
+		if (!gen->netplay_rollback) {
+			gen->netplay_rollback = 1;
+		} else if (gen->netplay_rollback > NETPLAY_MAX_ROLLBACK) {
+			gen->netplay_rollback = NETPLAY_MAX_ROLLBACK;
+		}
+		gen->netplay_delay = atoi(tern_find_path_default(config, "system\0netplay_delay\0", (tern_val){.ptrval = "0"}, TVAL_PTR).ptrval);
+		gen->netplay_snapshots = calloc(gen->netplay_rollback + 1, sizeof(genesis_snapshot *));
+		for (uint32_t i = 0; i <= gen->netplay_rollback; i++)
+		{
+			gen->netplay_snapshots[i] = genesis_alloc_snapshot(gen);
+			if (!gen->netplay_snapshots[i]) {
+				fatal_error("Netplay is not supported by this build\n");
+			}
+		}
+	} else {
+		gen->runahead_frames = atoi(tern_find_path_default(config, "system\0runahead\0", (tern_val){.ptrval = "0"}, TVAL_PTR).ptrval);
+		if (gen->runahead_frames && event_log_active()) {
+			//speculative frames would end up in the log along with the real ones
+			warning("Run-ahead is not available while an event log is being recorded\n");
+			gen->runahead_frames = 0;
+		}
+	}
+	if (gen->runahead_frames) {
+		//needs to happen after save storage is set up
+		gen->runahead_snapshot = genesis_alloc_snapshot(gen);
+		if (!gen->runahead_snapshot) {
+			warning("Run-ahead is not supported by this build\n");
+			gen->runahead_frames = 0;
+		}
+	}
 
 	return gen;
 }
@@ -1709,7 +2252,7 @@ genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, void *lock_o
 		           (read_16_fun)unused_read,    (write_16_fun)unused_write,
 		           (read_8_fun)unused_read_b,   (write_8_fun)unused_write_b}
 	};
-	static tern_node *rom_db;
+	static rom_database *rom_db;
 	if (!rom_db) {
 		rom_db = load_rom_db();
 	}
@@ -1722,6 +2265,7 @@ genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, void *lock_o
 		byteswap_rom(lock_on_size, lock_on);
 	}
 #endif
+	rom = share_rom(&info, rom, rom_size);
 	char *m68k_divider = tern_find_path(config, "clocks\0m68k_divider\0", TVAL_PTR).ptrval;
 	if (!m68k_divider) {
 		m68k_divider = "7";
@@ -21,8 +21,10 @@
 #include "romdb.h"
 #include "arena.h"
 #include "i2c.h"
+#include "rewind.h"
 
 typedef struct genesis_context genesis_context;
+typedef struct genesis_snapshot genesis_snapshot;
 
 struct genesis_context {
 	system_header   header;
@@ -35,10 +37,19 @@ struct genesis_context {
 	uint16_t        *lock_on;
 	uint16_t        *work_ram;
 	uint8_t         *zram;
+	//copy of the Z80 memory map pointing at this system's zram
+	memmap_chunk    *z80_map;
 	void            *extra;
 	uint8_t         *save_storage;
 	void            *mapper_temp;
 	eeprom_map      *eeprom_map;
+	rewind_buffer   *rewind;
+	genesis_snapshot *snapshot;
+	genesis_snapshot *runahead_snapshot;
+	genesis_snapshot **netplay_snapshots;
+	memmap_chunk const *dma_chunk; //memory map chunk of the last DMA source read
+	uint8_t         *dma_base;     //native pointer for dma_chunk at the time it was looked up
+	uint8_t         *netplay_state;
 	uint8_t         *serialize_tmp;
 	size_t          serialize_size;
 	uint32_t        num_eeprom;
@@ -54,9 +65,17 @@ struct genesis_context {
 	uint32_t        last_frame;
 	uint32_t        last_flush_cycle;
 	uint32_t        soft_flush_cycles;
+	uint32_t        runahead_frames;
+	uint32_t        runahead_count;
+	uint32_t        netplay_rollback;
+	uint32_t        netplay_delay;
+	uint32_t        netplay_state_size;
+	uint32_t        last_sync_cycle; //used for the rough estimate of DRAM refresh delays
+	uint32_t        refresh_counter;
 	uint8_t         bank_regs[8];
 	uint16_t        z80_bank_reg;
 	uint16_t        tmss_lock[2];
+	uint16_t        netplay_buttons[2]; //buttons currently applied to pads 1 and 2 by netplay
 	uint16_t        mapper_start_index;
 	uint8_t         mapper_type;
 	uint8_t         save_type;
@@ -64,6 +83,11 @@ struct genesis_context {
 	uint8_t         version_reg;
 	uint8_t         bus_busy;
 	uint8_t         reset_requested;
+	uint8_t         rewind_pending;
+	uint8_t         runahead_wanted;
+	uint8_t         runahead_restore;
+	uint8_t         netplay_sync;
+	uint8_t         netplay_restore;
 	uint8_t         tmss;
 	eeprom_state    eeprom;
 	nor_state       nor;
@@ -76,6 +100,19 @@ m68k_context * sync_components(m68k_context *context, uint32_t address);
 genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, uint32_t system_opts, uint8_t force_region);
 void genesis_serialize(genesis_context *gen, serialize_buffer *buf, uint32_t m68k_pc, uint8_t all);
 void genesis_deserialize(deserialize_buffer *buf, genesis_context *gen);
+//Fast in-process snapshots for run-ahead and similar, these are native-endian and only valid for the context
+//they were taken from. Use the serialize functions for anything that needs to outlive the process.
+genesis_snapshot *genesis_alloc_snapshot(genesis_context *gen);
+void genesis_free_snapshot(genesis_snapshot *snap);
+//must be called at a 68K instruction boundary with the Z80 at the start of an instruction
+void genesis_save_snapshot(genesis_context *gen, genesis_snapshot *snap, uint32_t m68k_pc);
+//takes a snapshot the next time both CPUs are at an instruction boundary
+void genesis_request_snapshot(genesis_context *gen, genesis_snapshot *snap);
+//must be called while the 68K is stopped, returns 0 if no snapshot has been saved yet
+uint8_t genesis_load_snapshot(genesis_context *gen, genesis_snapshot *snap);
+//sends video and audio to the sinks instead of the render backend so several systems can share a process
+//must be called before the system is started
+void genesis_set_sinks(genesis_context *gen, struct video_sink *video, audio_sink *audio);
 
 #endif //GENESIS_H_
 
@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "host.h"
+#include "genesis.h"
+#include "render.h"
+#include "render_audio.h"
+#include "config.h"
+#include "util.h"
+#include "blastem.h"
+
+//enough for a PAL frame with full borders plus the extra lines the VDP can draw when the mode changes mid-frame
+#define FRAMEBUFFER_LINES 512
+
+#define FNV_BASIS 0x811C9DC5
+#define FNV_PRIME 0x01000193
+
+typedef struct {
+	system_header *system;
+	uint32_t      *framebuffers[2];
+	video_sink    video;
+	audio_sink    audio;
+	uint64_t      audio_frames;
+	uint32_t      audio_hash;
+	uint32_t      frames;
+	uint32_t      last_width;
+	uint8_t       last_fb;
+	uint8_t       started;
+} host_instance;
+
+typedef struct host host;
+
+typedef struct {
+	host             *owner;
+	render_thread    thread;
+	//guards head and tail, the worker takes from the tail and the others steal from the head
+	render_semaphore lock;
+	render_semaphore start;
+	uint32_t         *queue;
+	uint32_t         head;
+	uint32_t         tail;
+} host_worker;
+
+struct host {
+	host_instance    *instances;
+	host_worker      *workers;
+	render_semaphore done;
+	uint32_t         num_instances;
+	uint32_t         num_workers;
+	uint8_t          quit;
+};
+
+static uint32_t *get_framebuffer(video_sink *sink, uint8_t which, int *pitch)
+{
+	host_instance *inst = sink->data;
+	*pitch = LINEBUF_SIZE * sizeof(uint32_t);
+	return inst->framebuffers[which];
+}
+
+static void framebuffer_updated(video_sink *sink, uint8_t which, int width)
+{
+	host_instance *inst = sink->data;
+	inst->frames++;
+	inst->last_fb = which;
+	inst->last_width = width;
+	//one frame per round
+	system_request_exit(inst->system, 0);
+}
+
+static void audio_samples(audio_sink *sink, audio_source *src, int16_t *samples, uint32_t frames)
+{
+	host_instance *inst = sink->data;
+	uint32_t hash = inst->audio_hash;
+	for (uint32_t i = 0, count = frames * src->num_channels; i < count; i++)
+	{
+		hash = (hash ^ (uint16_t)samples[i]) * FNV_PRIME;
+	}
+	inst->audio_hash = hash;
+	inst->audio_frames += frames;
+}
+
+static uint32_t frame_hash(host_instance *inst)
+{
+	uint32_t hash = FNV_BASIS;
+	uint32_t *fb = inst->framebuffers[inst->last_fb];
+	for (uint32_t line = 0; line < FRAMEBUFFER_LINES; line++, fb += LINEBUF_SIZE)
+	{
+		for (uint32_t x = 0; x < inst->last_width; x++)
+		{
+			hash = (hash ^ fb[x]) * FNV_PRIME;
+		}
+	}
+	return hash;
+}
+
+static void run_instance(host_instance *inst)
+{
+	//code for each system is allocated from its own arena, see alloc_code
+	set_current_arena(inst->system->arena);
+	if (inst->started) {
+		inst->system->resume_context(inst->system);
+	} else {
+		inst->started = 1;
+		inst->system->start_context(inst->system, NULL);
+	}
+	inst->system->arena = start_new_arena();
+}
+
+static uint8_t take_instance(host_worker *worker, uint32_t *index)
+{
+	uint8_t found = 0;
+	render_semaphore_wait(worker->lock);
+		if (worker->head != worker->tail) {
+			*index = worker->queue[--worker->tail];
+			found = 1;
+		}
+	render_semaphore_post(worker->lock);
+	return found;
+}
+
+static uint8_t steal_instance(host_worker *victim, uint32_t *index)
+{
+	uint8_t found = 0;
+	render_semaphore_wait(victim->lock);
+		if (victim->head != victim->tail) {
+			*index = victim->queue[victim->head++];
+			found = 1;
+		}
+	render_semaphore_post(victim->lock);
+	return found;
+}
+
+static uint8_t next_instance(host_worker *worker, uint32_t *index)
+{
+	if (take_instance(worker, index)) {
+		return 1;
+	}
+	host *h = worker->owner;
+	uint32_t self = worker - h->workers;
+	for (uint32_t i = 1; i < h->num_workers; i++)
+	{
+		if (steal_instance(h->workers + (self + i) % h->num_workers, index)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int worker_main(void *data)
+{
+	host_worker *worker = data;
+	host *h = worker->owner;
+	for (;;)
+	{
+		render_semaphore_wait(worker->start);
+		if (h->quit) {
+			break;
+		}
+		uint32_t index;
+		while (next_instance(worker, &index))
+		{
+			run_instance(h->instances + index);
+		}
+		render_semaphore_post(h->done);
+	}
+	return 0;
+}
+
+static void run_round(host *h)
+{
+	//workers are all idle here so the queues can be refilled without taking the locks
+	for (uint32_t i = 0; i < h->num_workers; i++)
+	{
+		h->workers[i].head = h->workers[i].tail = 0;
+	}
+	for (uint32_t i = 0; i < h->num_instances; i++)
+	{
+		host_worker *worker = h->workers + i % h->num_workers;
+		worker->queue[worker->tail++] = i;
+	}
+	for (uint32_t i = 0; i < h->num_workers; i++)
+	{
+		render_semaphore_post(h->workers[i].start);
+	}
+	for (uint32_t i = 0; i < h->num_workers; i++)
+	{
+		render_semaphore_wait(h->done);
+	}
+}
+
+static uint32_t get_config_num(char *path, uint32_t def)
+{
+	char *str = tern_find_path(config, path, TVAL_PTR).ptrval;
+	uint32_t value = str ? atoi(str) : 0;
+	return value ? value : def;
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void host_run(system_type stype, system_media *media, uint32_t opts, uint8_t force_region, uint32_t instances, uint32_t frames)
+{
+	if (stype != SYSTEM_GENESIS) {
+		fatal_error("Only Genesis games can be run as multiple instances\n");
+	}
+	if (media->chain) {
+		fatal_error("Lock-on cartridges can't be run as multiple instances\n");
+	}
+	uint32_t sample_rate = get_config_num("audio\0rate\0", 48000);
+	uint32_t buffer_frames = get_config_num("audio\0buffer\0", 512);
+	host h = {
+		.instances = calloc(instances, sizeof(host_instance)),
+		.num_instances = instances
+	};
+	for (uint32_t i = 0; i < instances; i++)
+	{
+		host_instance *inst = h.instances + i;
+		inst->framebuffers[0] = calloc(LINEBUF_SIZE * FRAMEBUFFER_LINES, sizeof(uint32_t));
+		inst->framebuffers[1] = calloc(LINEBUF_SIZE * FRAMEBUFFER_LINES, sizeof(uint32_t));
+		inst->video = (video_sink){
+			.get_framebuffer = get_framebuffer,
+			.framebuffer_updated = framebuffer_updated,
+			.data = inst,
+			.format = FRAMEBUFFER_XRGB8888
+		};
+		inst->audio = (audio_sink){
+			.samples = audio_samples,
+			.data = inst,
+			.sample_rate = sample_rate,
+			.buffer_frames = buffer_frames
+		};
+		inst->audio_hash = FNV_BASIS;
+		//the ROM is byteswapped in place and owned by the system, so each one gets a copy
+		system_media copy = *media;
+		copy.buffer = malloc(media->size);
+		memcpy(copy.buffer, media->buffer, media->size);
+		start_new_arena();
+		inst->system = alloc_config_system(stype, &copy, opts, force_region);
+		if (!inst->system) {
+			fatal_error("Failed to configure emulated machine for instance %d\n", i);
+		}
+		genesis_set_sinks((genesis_context *)inst->system, &inst->video, &inst->audio);
+		inst->system->arena = start_new_arena();
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	h.num_workers = cpus > 0 ? cpus : 1;
+	if (h.num_workers > instances) {
+		h.num_workers = instances;
+	}
+	h.workers = calloc(h.num_workers, sizeof(host_worker));
+	h.done = render_create_semaphore(0);
+	for (uint32_t i = 0; i < h.num_workers; i++)
+	{
+		host_worker *worker = h.workers + i;
+		worker->owner = &h;
+		worker->lock = render_create_semaphore(1);
+		worker->start = render_create_semaphore(0);
+		worker->queue = calloc(instances, sizeof(uint32_t));
+		if (!render_create_thread(&worker->thread, "host worker", worker_main, worker)) {
+			fatal_error("Failed to start host worker thread\n");
+		}
+	}
+
+	uint64_t start = now_ms();
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		run_round(&h);
+	}
+	uint64_t elapsed = now_ms() - start;
+
+	h.quit = 1;
+	for (uint32_t i = 0; i < h.num_workers; i++)
+	{
+		render_semaphore_post(h.workers[i].start);
+		render_wait_thread(h.workers[i].thread);
+		render_destroy_semaphore(h.workers[i].lock);
+		render_destroy_semaphore(h.workers[i].start);
+		free(h.workers[i].queue);
+	}
+	render_destroy_semaphore(h.done);
+	free(h.workers);
+
+	uint64_t total_frames = 0;
+	for (uint32_t i = 0; i < instances; i++)
+	{
+		host_instance *inst = h.instances + i;
+		printf(
+			"instance %u: %u frames, frame hash %08X, %llu audio frames, audio hash %08X\n",
+			i, inst->frames, frame_hash(inst), (unsigned long long)inst->audio_frames, inst->audio_hash
+		);
+		total_frames += inst->frames;
+		set_current_arena(inst->system->arena);
+		mark_all_free();
+		inst->system->free_context(inst->system);
+		start_new_arena();
+		free(inst->framebuffers[0]);
+		free(inst->framebuffers[1]);
+	}
+	free(h.instances);
+	printf(
+		"%u instances on %u threads ran %llu frames in %llu ms (%.1f frames/s)\n", instances, h.num_workers,
+		(unsigned long long)total_frames, (unsigned long long)elapsed, elapsed ? total_frames * 1000.0 / elapsed : 0.0
+	);
+}
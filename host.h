@@ -0,0 +1,13 @@
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <stdint.h>
+#include "system.h"
+
+//Runs several independent copies of a Genesis game in this process on a pool of worker threads, one per CPU.
+//Each instance draws into its own framebuffers and hands its audio to its own sink instead of the render backend.
+//All instances are stepped one frame at a time and the ones that are ready are spread over the workers, which steal
+//from each other when their own queue runs dry. A summary of each instance's output is printed at the end.
+void host_run(system_type stype, system_media *media, uint32_t opts, uint8_t force_region, uint32_t instances, uint32_t frames);
+
+#endif //HOST_H_
@@ -427,7 +427,6 @@ void mouse_check_ready(io_port *port, uint32_t current_cycle)
 	}
 }
 
-uint32_t last_poll_cycle;
 void io_adjust_cycles(io_port * port, uint32_t current_cycle, uint32_t deduction)
 {
 	/*uint8_t control = pad->control | 0x80;
@@ -459,10 +458,10 @@ void io_adjust_cycles(io_port * port, uint32_t current_cycle, uint32_t deduction
 			}
 		}
 	}
-	if (last_poll_cycle >= deduction) {
-		last_poll_cycle -= deduction;
+	if (port->last_poll_cycle >= deduction) {
+		port->last_poll_cycle -= deduction;
 	} else {
-		last_poll_cycle = 0;
+		port->last_poll_cycle = 0;
 	}
 }
 
@@ -766,9 +765,9 @@ uint8_t io_data_read(io_port * port, uint32_t current_cycle)
 	uint8_t th = output & 0x40;
 	uint8_t input;
 	uint8_t device_driven;
-	if (current_cycle - last_poll_cycle > MIN_POLL_INTERVAL) {
+	if (current_cycle - port->last_poll_cycle > MIN_POLL_INTERVAL) {
 		process_events();
-		last_poll_cycle = current_cycle;
+		port->last_poll_cycle = current_cycle;
 	}
 	switch (port->device_type)
 	{
@@ -1120,3 +1119,44 @@ void io_deserialize(deserialize_buffer *buf, void *vport)
 		break;
 	}
 }
+
+uint8_t *io_save_snapshot(io_port *port, uint8_t *dst)
+{
+	memcpy(dst, port, sizeof(io_port));
+	return dst + sizeof(io_port);
+}
+
+uint8_t *io_load_snapshot(io_port *port, uint8_t *src)
+{
+	io_port saved;
+	memcpy(&saved, src, sizeof(io_port));
+	//button state, mouse position and keyboard events come from the host so only restore what io_serialize saves
+	port->output = saved.output;
+	port->control = saved.control;
+	port->serial_out = saved.serial_out;
+	port->serial_in = saved.serial_in;
+	port->serial_ctrl = saved.serial_ctrl;
+	memcpy(port->slow_rise_start, saved.slow_rise_start, sizeof(port->slow_rise_start));
+	switch (port->device_type)
+	{
+	case IO_GAMEPAD6:
+		port->device.pad.timeout_cycle = saved.device.pad.timeout_cycle;
+		port->device.pad.th_counter = saved.device.pad.th_counter;
+		break;
+	case IO_MOUSE:
+		port->device.mouse.ready_cycle = saved.device.mouse.ready_cycle;
+		port->device.mouse.last_read_x = saved.device.mouse.last_read_x;
+		port->device.mouse.last_read_y = saved.device.mouse.last_read_y;
+		port->device.mouse.latched_x = saved.device.mouse.latched_x;
+		port->device.mouse.latched_y = saved.device.mouse.latched_y;
+		port->device.mouse.tr_counter = saved.device.mouse.tr_counter;
+		break;
+	case IO_SATURN_KEYBOARD:
+	case IO_XBAND_KEYBOARD:
+		port->device.keyboard.tr_counter = saved.device.keyboard.tr_counter;
+		port->device.keyboard.mode = saved.device.keyboard.mode;
+		port->device.keyboard.cmd = saved.device.keyboard.cmd;
+		break;
+	}
+	return src + sizeof(io_port);
+}
@@ -62,6 +62,7 @@ typedef struct {
 	uint8_t  control;
 	uint8_t  input[3];
 	uint32_t slow_rise_start[8];
+	uint32_t last_poll_cycle; //host events are processed at most once every MIN_POLL_INTERVAL cycles
 	uint8_t  serial_out;
 	uint8_t  serial_in;
 	uint8_t  serial_ctrl;
@@ -111,6 +112,8 @@ void io_data_write(io_port * pad, uint8_t value, uint32_t current_cycle);
 uint8_t io_data_read(io_port * pad, uint32_t current_cycle);
 void io_serialize(io_port *port, serialize_buffer *buf);
 void io_deserialize(deserialize_buffer *buf, void *vport);
+uint8_t *io_save_snapshot(io_port *port, uint8_t *dst);
+uint8_t *io_load_snapshot(io_port *port, uint8_t *src);
 
 void io_port_gamepad_down(io_port *port, uint8_t button);
 void io_port_gamepad_up(io_port *port, uint8_t button);
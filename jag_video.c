@@ -54,58 +54,97 @@ static uint8_t cry_green[16][8] = {
 	{255, 255, 255, 255, 255, 255, 255, 255},
 };
 
-static uint32_t table_cry[0x10000];
-static uint32_t table_rgb[0x10000];
-static uint32_t table_variable[0x10000];
+//CRY color component for each value of the upper byte before intensity is applied
+static uint8_t cry_base_red[256];
+static uint8_t cry_base_green[256];
+static uint8_t cry_base_blue[256];
+//layout of the pixels returned by render_map_color
+static uint32_t map_alpha;
+static uint8_t map_red_shift, map_green_shift, map_blue_shift;
 
-static uint32_t cry_to_rgb(uint16_t cry)
+static uint8_t channel_shift(uint32_t mapped)
 {
-	uint32_t y = cry & 0xFF;
-	if (y) {
-		uint8_t c = cry >> 8 & 0xF;
-		uint8_t r = cry >> 12;
-		
-		uint32_t red = cry_red[c < 7 ? 0 : c - 7][r];
-		uint32_t green = cry_green[c][r < 8 ? r : 15 - r];
-		uint32_t blue = cry_red[c < 7 ? 0 : c - 7][15-r];
-		red = red * y / 255;
-		blue = blue * y / 255;
-		green = green * y / 255;
-		return render_map_color(red, green, blue);
-	} else {
-		return render_map_color(0, 0, 0);
+	uint8_t shift = 0;
+	while (shift < 24 && !(mapped >> shift & 1))
+	{
+		shift++;
 	}
+	return shift;
 }
 
-static uint32_t rgb16_to_rgb(uint16_t rgb)
+static uint8_t scale_intensity(uint16_t component, uint16_t y)
 {
-	return render_map_color(
-		rgb >> 8 & 0xF8,
-		rgb << 2 & 0xFC,
-		rgb >> 4 & 0xF8
-	);
+	//exact equivalent of component * y / 255 for 8-bit inputs
+	uint16_t product = component * y;
+	return (product + 1 + (product >> 8)) >> 8;
 }
 
 jag_video *jag_video_init(void)
 {
 	static uint8_t table_init_done = 0;
 	if (!table_init_done) {
-		for (int i = 0; i < 0x10000; i++)
+		for (int i = 0; i < 256; i++)
 		{
-			table_cry[i] = cry_to_rgb(i);
-			table_rgb[i] = rgb16_to_rgb(i);
-			table_variable[i] = i & 1 ? rgb16_to_rgb(i & 0xFFFE) : cry_to_rgb(i);
+			uint8_t c = i & 0xF;
+			uint8_t r = i >> 4;
+			cry_base_red[i] = cry_red[c < 7 ? 0 : c - 7][r];
+			cry_base_green[i] = cry_green[c][r < 8 ? r : 15 - r];
+			cry_base_blue[i] = cry_red[c < 7 ? 0 : c - 7][15-r];
 		}
+		map_alpha = render_map_color(0, 0, 0);
+		map_red_shift = channel_shift(render_map_color(0xFF, 0, 0) & ~map_alpha);
+		map_green_shift = channel_shift(render_map_color(0, 0xFF, 0) & ~map_alpha);
+		map_blue_shift = channel_shift(render_map_color(0, 0, 0xFF) & ~map_alpha);
 		table_init_done = 1;
 	}
 	return calloc(1, sizeof(jag_video));
 }
 
-static void copy_16(uint32_t *dst, uint32_t len, uint16_t *linebuffer, uint32_t *table)
+//The conversion routines below avoid per-pixel lookups into large tables
+//and are written so that the compiler can vectorize them
+
+static inline uint32_t cry_to_rgb(uint16_t cry)
+{
+	uint8_t color = cry >> 8;
+	uint8_t y = cry;
+	return map_alpha
+		| scale_intensity(cry_base_red[color], y) << map_red_shift
+		| scale_intensity(cry_base_green[color], y) << map_green_shift
+		| scale_intensity(cry_base_blue[color], y) << map_blue_shift;
+}
+
+static inline uint32_t rgb16_to_rgb(uint16_t rgb)
+{
+	return map_alpha
+		| (uint32_t)(rgb >> 8 & 0xF8) << map_red_shift
+		| (uint32_t)(rgb << 2 & 0xFC) << map_green_shift
+		| (uint32_t)(rgb >> 4 & 0xF8) << map_blue_shift;
+}
+
+static void copy_cry(uint32_t *dst, uint32_t len, uint16_t *linebuffer)
 {
-	for (; len; len--, dst++, linebuffer++)
+	for (uint32_t i = 0; i < len; i++)
 	{
-		*dst = table[*linebuffer];
+		dst[i] = cry_to_rgb(linebuffer[i]);
+	}
+}
+
+static void copy_rgb16(uint32_t *dst, uint32_t len, uint16_t *linebuffer)
+{
+	for (uint32_t i = 0; i < len; i++)
+	{
+		dst[i] = rgb16_to_rgb(linebuffer[i]);
+	}
+}
+
+static void copy_variable(uint32_t *dst, uint32_t len, uint16_t *linebuffer)
+{
+	for (uint32_t i = 0; i < len; i++)
+	{
+		uint16_t pixel = linebuffer[i];
+		uint32_t cry = cry_to_rgb(pixel);
+		uint32_t rgb = rgb16_to_rgb(pixel & 0xFFFE);
+		dst[i] = pixel & 1 ? rgb : cry;
 	}
 }
 
@@ -151,7 +190,7 @@ static void copy_linebuffer(jag_video *context, uint16_t *linebuffer)
 	switch (context->mode)
 	{
 	case VMODE_CRY:
-		copy_16(dst, len, linebuffer, table_cry);
+		copy_cry(dst, len, linebuffer);
 		break;
 	case VMODE_RGB24:
 		//TODO: Implement me
@@ -160,10 +199,10 @@ static void copy_linebuffer(jag_video *context, uint16_t *linebuffer)
 		//TODO: Implement this once I better understand what would happen on hardware with composite output
 		break;
 	case VMODE_RGB16:
-		copy_16(dst, len, linebuffer, table_rgb);
+		copy_rgb16(dst, len, linebuffer);
 		break;
 	case VMODE_VARIABLE:
-		copy_16(dst, len, linebuffer, table_variable);
+		copy_variable(dst, len, linebuffer);
 		break;
 	}
 }
@@ -516,12 +555,53 @@ void op_run(jag_video *context)
 	}
 }
 
+static uint32_t cycles_to_hcount(jag_video *context, uint16_t hcount)
+{
+	uint16_t cur = context->regs[VID_HCOUNT];
+	if ((hcount & ~0x3FF) != (cur & 0x400)) {
+		//event is in the other half-line, the half-line wrap will be reached first
+		return 0xFFFFFFFF;
+	}
+	hcount &= 0x3FF;
+	cur &= 0x3FF;
+	if (hcount <= cur || hcount > context->regs[VID_HPERIOD]) {
+		return 0xFFFFFFFF;
+	}
+	return hcount - cur;
+}
+
+static uint32_t cycles_to_next_event(jag_video *context, uint32_t target_cycle)
+{
+	uint32_t hcount = context->regs[VID_HCOUNT] & 0x3FF;
+	if (hcount > context->regs[VID_HPERIOD]) {
+		//counter is outside the programmed period, step one cycle at a time until it wraps
+		return 1;
+	}
+	//HCOUNT wraps at the end of the cycle in which it matches HPERIOD
+	uint32_t cycles = context->regs[VID_HPERIOD] - hcount + 1;
+	uint32_t event = cycles_to_hcount(context, context->regs[VID_HDISP_BEGIN1]);
+	if (event < cycles) {
+		cycles = event;
+	}
+	event = cycles_to_hcount(context, context->regs[VID_HDISP_BEGIN2]);
+	if (event < cycles) {
+		cycles = event;
+	}
+	event = cycles_to_hcount(context, context->regs[VID_HDISP_END]);
+	if (event < cycles) {
+		cycles = event;
+	}
+	if (target_cycle - context->cycles < cycles) {
+		cycles = target_cycle - context->cycles;
+	}
+	return cycles;
+}
+
 void jag_video_run(jag_video *context, uint32_t target_cycle)
 {
 	if (context->regs[VID_VMODE] & BIT_TBGEN) {
 		while (context->cycles < target_cycle)
 		{
-			//TODO: Optimize this to not actually increment one step at a time
 			if (
 				(
 					context->regs[VID_HCOUNT] == context->regs[VID_HDISP_BEGIN1]
@@ -551,8 +631,15 @@ void jag_video_run(jag_video *context, uint32_t target_cycle)
 				context->op.state = OBJ_IDLE;
 			}
 			
-			context->cycles++;
-			op_run(context);
+			//nothing below depends on the exact value of HCOUNT until the next
+			//display begin/end match or the half-line wrap so we can jump straight there
+			uint32_t step = cycles_to_next_event(context, target_cycle);
+			context->cycles += step;
+			if (context->op.state == OBJ_IDLE || context->op.state == OBJ_GPU_WAIT) {
+				context->op.cycles = context->cycles;
+			} else {
+				op_run(context);
+			}
 			
 			//advance counters
 			if (
@@ -568,6 +655,7 @@ void jag_video_run(jag_video *context, uint32_t target_cycle)
 				context->output = NULL;
 			}
 			
+			context->regs[VID_HCOUNT] += step - 1;
 			if ((context->regs[VID_HCOUNT] & 0x3FF) == context->regs[VID_HPERIOD]) {
 				//reset bottom 10 bits to zero, flip the 11th bit which represents which half of the line we're on
 				context->regs[VID_HCOUNT] = (context->regs[VID_HCOUNT] & 0x400) ^ 0x400;
@@ -40,6 +40,12 @@ RETRO_API void retro_set_environment(retro_environment_t re)
 	};
 
 	re(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, (void *)desc);
+	
+	static const struct retro_variable vars[] = {
+		{"blastem_pixel_format", "Pixel format (restart); xrgb8888|rgb565"},
+		{ NULL, NULL },
+	};
+	re(RETRO_ENVIRONMENT_SET_VARIABLES, (void *)vars);
 }
 
 static retro_video_refresh_t retro_video_refresh;
@@ -107,6 +113,7 @@ RETRO_API void retro_get_system_info(struct retro_system_info *info)
 
 static vid_std video_standard;
 static uint32_t last_width, last_height;
+static uint8_t use_rgb565;
 static uint32_t overscan_top, overscan_bot, overscan_left, overscan_right;
 static void update_overscan(void)
 {
@@ -237,10 +244,21 @@ RETRO_API bool retro_load_game(const struct retro_game_info *game)
 	memcpy(media.buffer, game->data, game->size);
 	media.size = game->size;
 	stype = detect_system_type(&media);
-	current_system = alloc_config_system(stype, &media, 0, 0);
 	
-	unsigned format = RETRO_PIXEL_FORMAT_XRGB8888;
-	retro_environment(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &format);
+	//RGB565 halves the size of every frame handed to the frontend, the VDP's 9-bit colors
+	//and shadow/highlight levels all fit in it without collapsing into each other
+	//this has to be settled before the system is created since the VDP grabs a framebuffer right away
+	struct retro_variable var = {.key = "blastem_pixel_format"};
+	use_rgb565 = 0;
+	if (retro_environment(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && !strcmp(var.value, "rgb565")) {
+		unsigned format = RETRO_PIXEL_FORMAT_RGB565;
+		use_rgb565 = retro_environment(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &format);
+	}
+	if (!use_rgb565) {
+		unsigned format = RETRO_PIXEL_FORMAT_XRGB8888;
+		retro_environment(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &format);
+	}
+	current_system = alloc_config_system(stype, &media, 0, 0);
 	
 	return current_system != NULL;
 }
@@ -346,21 +364,42 @@ void render_destroy_window(uint8_t which)
 }
 
 static uint32_t fb[LINEBUF_SIZE * 294 * 2];
+//only used when the frontend accepted RGB565, the VDP writes it directly
+static uint16_t fb16[LINEBUF_SIZE * 294 * 2];
 static uint8_t last_fb;
 uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
 {
-	*pitch = LINEBUF_SIZE * sizeof(uint32_t);
+	*pitch = LINEBUF_SIZE * (use_rgb565 ? sizeof(uint16_t) : sizeof(uint32_t));
 	if (which != last_fb) {
 		*pitch = *pitch * 2;
 	}
 
-	if (which) {
+	if (use_rgb565) {
+		return (uint32_t *)(which ? fb16 + LINEBUF_SIZE : fb16);
+	} else if (which) {
 		return fb + LINEBUF_SIZE;
 	} else {
 		return fb;
 	}
 }
 
+void render_framebuffer_dirty_lines(uint8_t which, uint32_t first_line, uint32_t last_line)
+{
+	//frontend always gets the whole frame
+}
+
+framebuffer_format render_framebuffer_format(void)
+{
+	return use_rgb565 ? FRAMEBUFFER_RGB565 : FRAMEBUFFER_XRGB8888;
+}
+
+uint32_t *render_get_palettes(uint8_t which, int *pitch)
+{
+	//FRAMEBUFFER_INDEXED8 is never reported
+	*pitch = 0;
+	return NULL;
+}
+
 void render_framebuffer_updated(uint8_t which, int width)
 {
 	unsigned height = (video_standard == VID_NTSC ? 243 : 294) - (overscan_top + overscan_bot);
@@ -380,7 +419,11 @@ void render_framebuffer_updated(uint8_t which, int width)
 		last_width = width;
 		last_height = height;
 	}
-	retro_video_refresh(fb + overscan_left + LINEBUF_SIZE * overscan_top, width, height, LINEBUF_SIZE * sizeof(uint32_t));
+	if (use_rgb565) {
+		retro_video_refresh(fb16 + overscan_left + LINEBUF_SIZE * overscan_top, width, height, LINEBUF_SIZE * sizeof(uint16_t));
+	} else {
+		retro_video_refresh(fb + overscan_left + LINEBUF_SIZE * overscan_top, width, height, LINEBUF_SIZE * sizeof(uint32_t));
+	}
 	system_request_exit(current_system, 0);
 }
 
@@ -544,3 +587,14 @@ char *read_bundled_file(char *name, uint32_t *sizeret)
 	}
 	return NULL;
 }
+
+void *map_bundled_file(char *name, uint32_t *sizeret)
+{
+	//only the text ROM DB is embedded in the library
+	return read_bundled_file(name, sizeret);
+}
+
+void unmap_bundled_file(void *data, uint32_t size)
+{
+	free(data);
+}
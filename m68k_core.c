@@ -791,31 +791,65 @@ uint16_t m68k_get_ir(m68k_context *context)
 	return 0xFFFF;
 }
 
-static m68k_debug_handler find_breakpoint(m68k_context *context, uint32_t address)
+static uint32_t bp_slot(m68k_context *context, uint32_t address)
+{
+	return (address * 0x9E3779B1) >> 8 & (context->bp_storage - 1);
+}
+
+static m68k_breakpoint *find_breakpoint_slot(m68k_context *context, uint32_t address)
 {
-	for (uint32_t i = 0; i < context->num_breakpoints; i++)
+	if (!context->num_breakpoints) {
+		return NULL;
+	}
+	uint32_t mask = context->bp_storage - 1;
+	for (uint32_t i = bp_slot(context, address); context->breakpoints[i].handler; i = (i + 1) & mask)
 	{
 		if (context->breakpoints[i].address == address) {
-			return context->breakpoints[i].handler;
+			return context->breakpoints + i;
 		}
 	}
 	return NULL;
 }
 
+static m68k_debug_handler find_breakpoint(m68k_context *context, uint32_t address)
+{
+	m68k_breakpoint *bp = find_breakpoint_slot(context, address);
+	return bp ? bp->handler : NULL;
+}
+
+static void add_breakpoint_slot(m68k_context *context, uint32_t address, m68k_debug_handler bp_handler)
+{
+	uint32_t mask = context->bp_storage - 1;
+	uint32_t i = bp_slot(context, address);
+	while (context->breakpoints[i].handler)
+	{
+		i = (i + 1) & mask;
+	}
+	context->breakpoints[i] = (m68k_breakpoint){
+		.handler = bp_handler,
+		.address = address
+	};
+}
+
 void insert_breakpoint(m68k_context * context, uint32_t address, m68k_debug_handler bp_handler)
 {
 	if (!find_breakpoint(context, address)) {
-		if (context->bp_storage == context->num_breakpoints) {
-			context->bp_storage *= 2;
-			if (context->bp_storage < 4) {
-				context->bp_storage = 4;
+		//keep the table at most 3/4 full so probe sequences stay short
+		if ((context->num_breakpoints + 1) * 4 > context->bp_storage * 3) {
+			m68k_breakpoint *old = context->breakpoints;
+			uint32_t old_storage = context->bp_storage;
+			context->bp_storage = old_storage ? old_storage * 2 : 16;
+			context->breakpoints = calloc(context->bp_storage, sizeof(m68k_breakpoint));
+			for (uint32_t i = 0; i < old_storage; i++)
+			{
+				if (old[i].handler) {
+					add_breakpoint_slot(context, old[i].address, old[i].handler);
+				}
 			}
-			context->breakpoints = realloc(context->breakpoints, context->bp_storage * sizeof(m68k_breakpoint));
+			free(old);
 		}
-		context->breakpoints[context->num_breakpoints++] = (m68k_breakpoint){
-			.handler = bp_handler,
-			.address = address
-		};
+		add_breakpoint_slot(context, address, bp_handler);
+		context->num_breakpoints++;
 		m68k_breakpoint_patch(context, address, bp_handler, NULL);
 	}
 }
@@ -1147,15 +1181,21 @@ code_ptr get_native_address_trans(m68k_context * context, uint32_t address)
 
 void remove_breakpoint(m68k_context * context, uint32_t address)
 {
-	for (uint32_t i = 0; i < context->num_breakpoints; i++)
-	{
-		if (context->breakpoints[i].address == address) {
-			if (i != (context->num_breakpoints-1)) {
-				context->breakpoints[i] = context->breakpoints[context->num_breakpoints-1];
+	m68k_breakpoint *bp = find_breakpoint_slot(context, address);
+	if (bp) {
+		//shift back any entries in the same probe sequence so lookups never hit a hole
+		uint32_t mask = context->bp_storage - 1;
+		uint32_t hole = bp - context->breakpoints;
+		for (uint32_t i = (hole + 1) & mask; context->breakpoints[i].handler; i = (i + 1) & mask)
+		{
+			uint32_t home = bp_slot(context, context->breakpoints[i].address);
+			if (((i - home) & mask) >= ((i - hole) & mask)) {
+				context->breakpoints[hole] = context->breakpoints[i];
+				hole = i;
 			}
-			context->num_breakpoints--;
-			break;
 		}
+		context->breakpoints[hole].handler = NULL;
+		context->num_breakpoints--;
 	}
 	code_ptr native = get_native_address(context->options, address);
 	if (!native) {
@@ -1168,6 +1208,62 @@ void remove_breakpoint(m68k_context * context, uint32_t address)
 	context->options->gen.code = tmp;
 }
 
+static void update_watch_pages(m68k_context *context)
+{
+	memset(context->watch_pages, 0, sizeof(context->watch_pages));
+	for (uint32_t i = 0; i < context->num_watchpoints; i++)
+	{
+		for (uint32_t page = context->watchpoints[i].start >> WATCH_PAGE_SHIFT; page <= context->watchpoints[i].end >> WATCH_PAGE_SHIFT; page++)
+		{
+			context->watch_pages[page >> 3] |= 1 << (page & 7);
+		}
+	}
+}
+
+void insert_watchpoint(m68k_context * context, uint32_t start, uint32_t end, m68k_debug_handler wp_handler)
+{
+	if (context->wp_storage == context->num_watchpoints) {
+		context->wp_storage = context->wp_storage ? context->wp_storage * 2 : 4;
+		context->watchpoints = realloc(context->watchpoints, context->wp_storage * sizeof(m68k_watchpoint));
+	}
+	context->watchpoints[context->num_watchpoints++] = (m68k_watchpoint){
+		.handler = wp_handler,
+		.start = start & 0xFFFFFF,
+		.end = end & 0xFFFFFF
+	};
+	update_watch_pages(context);
+}
+
+void remove_watchpoint(m68k_context * context, uint32_t start, uint32_t end)
+{
+	start &= 0xFFFFFF;
+	end &= 0xFFFFFF;
+	for (uint32_t i = 0; i < context->num_watchpoints; i++)
+	{
+		if (context->watchpoints[i].start == start && context->watchpoints[i].end == end) {
+			if (i != (context->num_watchpoints-1)) {
+				context->watchpoints[i] = context->watchpoints[context->num_watchpoints-1];
+			}
+			context->num_watchpoints--;
+			break;
+		}
+	}
+	update_watch_pages(context);
+}
+
+m68k_context * m68k_handle_watch_write(uint32_t address, m68k_context * context, uint16_t value)
+{
+	//generated write handlers only call this when the page bitmap matched
+	for (uint32_t i = 0; i < context->num_watchpoints; i++)
+	{
+		if (address >= (context->watchpoints[i].start & ~1) && address <= context->watchpoints[i].end) {
+			context->watchpoints[i].handler(context, address);
+			break;
+		}
+	}
+	return context;
+}
+
 void start_68k_context(m68k_context * context, uint32_t address)
 {
 	code_ptr addr = get_native_address_trans(context, address);
@@ -1281,3 +1377,34 @@ void m68k_deserialize(deserialize_buffer *buf, void *vcontext)
 	context->int_pending = load_int8(buf);
 	context->trace_pending = load_int8(buf);
 }
+
+//everything before mem_pointers is plain register and timing state
+#define M68K_SNAPSHOT_REGS offsetof(m68k_context, mem_pointers)
+
+uint32_t m68k_snapshot_size(void)
+{
+	return M68K_SNAPSHOT_REGS + sizeof(uint32_t) + 2;
+}
+
+uint8_t *m68k_save_snapshot(m68k_context *context, uint32_t pc, uint8_t *dst)
+{
+	memcpy(dst, context, M68K_SNAPSHOT_REGS);
+	dst += M68K_SNAPSHOT_REGS;
+	memcpy(dst, &pc, sizeof(pc));
+	dst += sizeof(pc);
+	*(dst++) = context->int_pending;
+	*(dst++) = context->trace_pending;
+	return dst;
+}
+
+uint8_t *m68k_load_snapshot(m68k_context *context, uint8_t *src)
+{
+	memcpy(context, src, M68K_SNAPSHOT_REGS);
+	src += M68K_SNAPSHOT_REGS;
+	//same hack as m68k_deserialize until PC and IR are represented properly
+	memcpy(&context->last_prefetch_address, src, sizeof(uint32_t));
+	src += sizeof(uint32_t);
+	context->int_pending = *(src++);
+	context->trace_pending = *(src++);
+	return src;
+}
@@ -24,6 +24,10 @@ struct m68kinst;
 
 #define M68K_STATUS_TRACE 0x80
 
+//writes are checked against watchpoints at this granularity before the exact range check
+#define WATCH_PAGE_SHIFT 8
+#define WATCH_PAGE_BYTES ((16 * 1024 * 1024 >> WATCH_PAGE_SHIFT) / 8)
+
 typedef void (*start_fun)(uint8_t * addr, void * context);
 
 typedef struct {
@@ -74,6 +78,12 @@ typedef struct {
 	uint32_t           address;
 } m68k_breakpoint;
 
+typedef struct {
+	m68k_debug_handler handler;
+	uint32_t           start;
+	uint32_t           end;
+} m68k_watchpoint;
+
 struct m68k_context {
 	uint8_t         flags[5];
 	uint8_t         status;
@@ -91,12 +101,16 @@ struct m68k_context {
 	code_ptr        reset_handler;
 	m68k_options    *options;
 	void            *system;
-	m68k_breakpoint *breakpoints;
+	m68k_breakpoint *breakpoints; //open-addressed hash table with bp_storage slots
 	uint32_t        num_breakpoints;
 	uint32_t        bp_storage;
+	m68k_watchpoint *watchpoints;
+	uint32_t        num_watchpoints;
+	uint32_t        wp_storage;
 	uint8_t         int_pending;
 	uint8_t         trace_pending;
 	uint8_t         should_return;
+	uint8_t         watch_pages[WATCH_PAGE_BYTES];
 	uint8_t         ram_code_flags[];
 };
 
@@ -112,6 +126,9 @@ void m68k_reset(m68k_context * context);
 void m68k_options_free(m68k_options *opts);
 void insert_breakpoint(m68k_context * context, uint32_t address, m68k_debug_handler bp_handler);
 void remove_breakpoint(m68k_context * context, uint32_t address);
+void insert_watchpoint(m68k_context * context, uint32_t start, uint32_t end, m68k_debug_handler wp_handler);
+void remove_watchpoint(m68k_context * context, uint32_t start, uint32_t end);
+m68k_context * m68k_handle_watch_write(uint32_t address, m68k_context * context, uint16_t value);
 m68k_context * m68k_handle_code_write(uint32_t address, m68k_context * context);
 uint32_t get_instruction_start(m68k_options *opts, uint32_t address);
 uint16_t m68k_get_ir(m68k_context *context);
@@ -119,6 +136,10 @@ void m68k_print_regs(m68k_context * context);
 void m68k_invalidate_code_range(m68k_context *context, uint32_t start, uint32_t end);
 void m68k_serialize(m68k_context *context, uint32_t pc, serialize_buffer *buf);
 void m68k_deserialize(deserialize_buffer *buf, void *vcontext);
+//native-endian copies of the CPU state for in-process snapshots, see genesis_save_snapshot
+uint32_t m68k_snapshot_size(void);
+uint8_t *m68k_save_snapshot(m68k_context *context, uint32_t pc, uint8_t *dst);
+uint8_t *m68k_load_snapshot(m68k_context *context, uint8_t *src);
 
 #endif //M68K_CORE_H_
 
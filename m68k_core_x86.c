@@ -2722,6 +2722,10 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	retn(code);
 
 	opts->gen.handle_code_write = (code_ptr)m68k_handle_code_write;
+	opts->gen.handle_watch_write = (code_ptr)m68k_handle_watch_write;
+	opts->gen.watch_flags_off = offsetof(m68k_context, watch_pages);
+	opts->gen.watch_count_off = offsetof(m68k_context, num_watchpoints);
+	opts->gen.watch_flags_shift = WATCH_PAGE_SHIFT;
 	
 	check_alloc_code(code, 256);
 	opts->gen.handle_align_error_write = code->cur;
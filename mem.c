@@ -33,13 +33,29 @@ void * alloc_code(size_t *size)
 	if (*size & (PAGE_SIZE -1)) {
 		*size += PAGE_SIZE - (*size & (PAGE_SIZE - 1));
 	}
-	ret = mmap(next, *size, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	//next is only a hint, but systems on different threads can get here at the same time
+	ret = mmap(__atomic_load_n(&next, __ATOMIC_RELAXED), *size, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
 	if (ret == MAP_FAILED) {
 		perror("alloc_code");
 		return NULL;
 	}
 	track_block(ret);
-	next = ret + *size;
+	__atomic_store_n(&next, ret + *size, __ATOMIC_RELAXED);
 	return ret;
 }
 
+void *alloc_pages(size_t size)
+{
+	void *ret = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return ret == MAP_FAILED ? NULL : ret;
+}
+
+void free_pages(void *ptr, size_t size)
+{
+	munmap(ptr, size);
+}
+
+void protect_pages(void *ptr, size_t size, uint8_t writeable)
+{
+	mprotect(ptr, size, writeable ? PROT_READ | PROT_WRITE : PROT_READ);
+}
@@ -7,10 +7,15 @@
 #define MEM_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define PAGE_SIZE 4096
 
 void * alloc_code(size_t *size);
+//page granular memory outside the heap whose protection can be changed with protect_pages
+void *alloc_pages(size_t size);
+void free_pages(void *ptr, size_t size);
+void protect_pages(void *ptr, size_t size, uint8_t writeable);
 
 #endif //MEM_H_
 
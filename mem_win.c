@@ -13,3 +13,19 @@ void * alloc_code(size_t *size)
 
 	return VirtualAlloc(NULL, *size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
 }
+
+void *alloc_pages(size_t size)
+{
+	return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+void free_pages(void *ptr, size_t size)
+{
+	VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+void protect_pages(void *ptr, size_t size, uint8_t writeable)
+{
+	DWORD old;
+	VirtualProtect(ptr, size, writeable ? PAGE_READWRITE : PAGE_READONLY, &old);
+}
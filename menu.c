@@ -11,6 +11,7 @@
 #include "paths.h"
 #include "saves.h"
 #include "config.h"
+#include "netplay.h"
 
 static menu_context *get_menu(genesis_context *gen)
 {
@@ -230,6 +231,10 @@ void * menu_write_w(uint32_t address, void * context, uint16_t value)
 		}
 		case 5:
 			//save state
+			if (netplay_active()) {
+				warning("Save states are not available during netplay\n");
+				break;
+			}
 			if (gen->header.next_context) {
 				gen->header.next_context->save_state = dst + 1;
 			}
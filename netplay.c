@@ -0,0 +1,353 @@
+#ifdef _WIN32
+#define WINVER 0x501
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "netplay.h"
+#include "util.h"
+
+//Both peers run the same emulation and exchange the local player's buttons for each frame over TCP.
+//Input from the peer for frames it hasn't reached yet is predicted by repeating the last input received.
+//Once the real input arrives and differs from the prediction, the caller rolls back to that frame.
+
+enum {
+	CMD_INPUT
+};
+
+//command, 32-bit frame number, 16-bit button mask
+#define INPUT_MSG_SIZE 7
+//must cover the rollback window plus the input delay of both peers
+#define INPUT_RING 256
+#define INPUT_MASK (INPUT_RING - 1)
+
+static const char np_ident[] = "BLSTNP\x01\x00";
+
+static int sock = -1;
+static uint8_t active, is_host, started, resimulating;
+static uint16_t local_buttons;
+static uint16_t local_input[INPUT_RING];
+static uint16_t remote_input[INPUT_RING];
+static uint16_t used_remote[INPUT_RING];
+static uint32_t frame, live_frame, remote_count, rollback_to, max_rollback, delay;
+static uint8_t recv_buffer[1024];
+static uint32_t recv_fill;
+
+static void end_session(char *reason)
+{
+	warning("%s, continuing without netplay\n", reason);
+	socket_close(sock);
+	sock = -1;
+	active = 0;
+	resimulating = 0;
+}
+
+static void connected(void)
+{
+	int flag = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&flag, sizeof(flag));
+	active = 1;
+}
+
+void netplay_host(char *address, char *port)
+{
+	struct addrinfo request, *result;
+	socket_init();
+	memset(&request, 0, sizeof(request));
+	request.ai_family = AF_INET;
+	request.ai_socktype = SOCK_STREAM;
+	request.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(address, port, &request, &result)) {
+		warning("Failed to resolve netplay address %s:%s\n", address ? address : "*", port);
+		return;
+	}
+	int listen_sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (listen_sock < 0) {
+		warning("Failed to open netplay listen socket on port %s\n", port);
+		goto cleanup_address;
+	}
+	int param = 1;
+	setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&param, sizeof(param));
+	if (bind(listen_sock, result->ai_addr, result->ai_addrlen) < 0 || listen(listen_sock, 1) < 0) {
+		warning("Failed to listen for a netplay peer on port %s\n", port);
+		socket_close(listen_sock);
+		goto cleanup_address;
+	}
+	info_message("Waiting for netplay peer on port %s\n", port);
+	sock = accept(listen_sock, NULL, NULL);
+	socket_close(listen_sock);
+	if (sock < 0) {
+		warning("Failed to accept netplay peer\n");
+		goto cleanup_address;
+	}
+	is_host = 1;
+	connected();
+cleanup_address:
+	freeaddrinfo(result);
+}
+
+void netplay_join(char *address, char *port)
+{
+	struct addrinfo request, *result;
+	socket_init();
+	memset(&request, 0, sizeof(request));
+	request.ai_family = AF_INET;
+	request.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(address, port, &request, &result)) {
+		warning("Failed to resolve netplay address %s:%s\n", address, port);
+		return;
+	}
+	sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (sock < 0) {
+		warning("Failed to create socket for netplay connection to %s:%s\n", address, port);
+	} else if (connect(sock, result->ai_addr, result->ai_addrlen) < 0) {
+		warning("Failed to connect to netplay host %s:%s\n", address, port);
+		socket_close(sock);
+		sock = -1;
+	} else {
+		is_host = 0;
+		connected();
+	}
+	freeaddrinfo(result);
+}
+
+uint8_t netplay_active(void)
+{
+	return active;
+}
+
+uint8_t netplay_is_host(void)
+{
+	return is_host;
+}
+
+uint8_t netplay_started(void)
+{
+	return started;
+}
+
+void netplay_local_button(uint8_t button, uint8_t down)
+{
+	if (down) {
+		local_buttons |= 1 << button;
+	} else {
+		local_buttons &= ~(1 << button);
+	}
+}
+
+static uint8_t send_all(uint8_t *data, uint32_t size)
+{
+	while (size)
+	{
+		int sent = send(sock, data, size, 0);
+		if (sent > 0) {
+			data += sent;
+			size -= sent;
+		} else if (sent == 0 || !socket_error_is_wouldblock()) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static uint8_t recv_all(uint8_t *data, uint32_t size)
+{
+	while (size)
+	{
+		int bytes = recv(sock, data, size, 0);
+		if (bytes > 0) {
+			data += bytes;
+			size -= bytes;
+		} else if (bytes == 0 || !socket_error_is_wouldblock()) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void put_u32(uint8_t *dst, uint32_t val)
+{
+	dst[0] = val;
+	dst[1] = val >> 8;
+	dst[2] = val >> 16;
+	dst[3] = val >> 24;
+}
+
+static uint32_t get_u32(uint8_t *src)
+{
+	return src[0] | src[1] << 8 | src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+void netplay_send_state(uint8_t *data, uint32_t size)
+{
+	uint8_t header[sizeof(np_ident) - 1 + 4];
+	memcpy(header, np_ident, sizeof(np_ident) - 1);
+	put_u32(header + sizeof(np_ident) - 1, size);
+	socket_blocking(sock, 1);
+	if (!send_all(header, sizeof(header)) || !send_all(data, size)) {
+		end_session("Failed to send starting state to netplay peer");
+	}
+}
+
+uint8_t *netplay_recv_state(uint32_t *size_out)
+{
+	uint8_t header[sizeof(np_ident) - 1 + 4];
+	socket_blocking(sock, 1);
+	if (!recv_all(header, sizeof(header))) {
+		end_session("Failed to receive starting state from netplay host");
+		return NULL;
+	}
+	if (memcmp(header, np_ident, sizeof(np_ident) - 1)) {
+		end_session("Netplay host is running an incompatible version");
+		return NULL;
+	}
+	uint32_t size = get_u32(header + sizeof(np_ident) - 1);
+	uint8_t *data = malloc(size);
+	if (!recv_all(data, size)) {
+		free(data);
+		end_session("Failed to receive starting state from netplay host");
+		return NULL;
+	}
+	*size_out = size;
+	return data;
+}
+
+static void send_input(uint32_t for_frame, uint16_t buttons)
+{
+	local_input[for_frame & INPUT_MASK] = buttons;
+	uint8_t msg[INPUT_MSG_SIZE] = {CMD_INPUT};
+	put_u32(msg + 1, for_frame);
+	msg[5] = buttons;
+	msg[6] = buttons >> 8;
+	socket_blocking(sock, 1);
+	if (!send_all(msg, sizeof(msg))) {
+		end_session("Lost connection to netplay peer");
+	}
+}
+
+static void handle_messages(void)
+{
+	uint8_t *cur = recv_buffer, *end = recv_buffer + recv_fill;
+	while (end - cur >= INPUT_MSG_SIZE)
+	{
+		if (*cur != CMD_INPUT) {
+			warning("Unrecognized netplay command %X\n", *cur);
+			end_session("Netplay peer sent invalid data");
+			return;
+		}
+		uint32_t msg_frame = get_u32(cur + 1);
+		uint16_t buttons = cur[5] | cur[6] << 8;
+		cur += INPUT_MSG_SIZE;
+		if (msg_frame != remote_count) {
+			end_session("Netplay peer sent input out of order");
+			return;
+		}
+		remote_input[msg_frame & INPUT_MASK] = buttons;
+		remote_count++;
+		if (msg_frame <= live_frame && used_remote[msg_frame & INPUT_MASK] != buttons && msg_frame < rollback_to) {
+			rollback_to = msg_frame;
+		}
+	}
+	recv_fill = end - cur;
+	memmove(recv_buffer, cur, recv_fill);
+}
+
+static void read_input(uint8_t block)
+{
+	socket_blocking(sock, block);
+	while (active)
+	{
+		int bytes = recv(sock, recv_buffer + recv_fill, sizeof(recv_buffer) - recv_fill, 0);
+		if (bytes <= 0) {
+			if (bytes == 0 || !socket_error_is_wouldblock()) {
+				end_session("Netplay peer disconnected");
+			}
+			break;
+		}
+		recv_fill += bytes;
+		handle_messages();
+		if (block) {
+			break;
+		}
+	}
+}
+
+void netplay_start(uint32_t rollback, uint32_t input_delay)
+{
+	max_rollback = rollback < 1 ? 1 : rollback > NETPLAY_MAX_ROLLBACK ? NETPLAY_MAX_ROLLBACK : rollback;
+	delay = input_delay > NETPLAY_MAX_DELAY ? NETPLAY_MAX_DELAY : input_delay;
+	frame = live_frame = remote_count = 0;
+	rollback_to = NETPLAY_NO_ROLLBACK;
+	memset(used_remote, 0, sizeof(used_remote));
+	started = 1;
+	//frames inside the input delay window have no local input
+	for (uint32_t i = 0; active && i <= delay; i++)
+	{
+		send_input(i, i < delay ? 0 : local_buttons);
+	}
+}
+
+uint32_t netplay_frame_end(void)
+{
+	if (frame < live_frame) {
+		frame++;
+		return NETPLAY_NO_ROLLBACK;
+	}
+	read_input(0);
+	while (active && remote_count + max_rollback < frame + 1)
+	{
+		//a misprediction further back than this couldn't be corrected, so wait for the peer to catch up
+		read_input(1);
+	}
+	if (!active) {
+		return NETPLAY_NO_ROLLBACK;
+	}
+	if (rollback_to != NETPLAY_NO_ROLLBACK) {
+		frame = rollback_to;
+		rollback_to = NETPLAY_NO_ROLLBACK;
+		resimulating = 1;
+		return frame;
+	}
+	resimulating = 0;
+	live_frame = ++frame;
+	send_input(frame + delay, local_buttons);
+	return NETPLAY_NO_ROLLBACK;
+}
+
+uint32_t netplay_frame(void)
+{
+	return frame;
+}
+
+uint8_t netplay_resimulating(void)
+{
+	return resimulating;
+}
+
+void netplay_frame_input(uint16_t *pad1, uint16_t *pad2)
+{
+	uint16_t remote;
+	if (frame < remote_count) {
+		remote = remote_input[frame & INPUT_MASK];
+	} else {
+		remote = remote_count ? remote_input[(remote_count - 1) & INPUT_MASK] : 0;
+	}
+	used_remote[frame & INPUT_MASK] = remote;
+	uint16_t local = local_input[frame & INPUT_MASK];
+	if (is_host) {
+		*pad1 = local;
+		*pad2 = remote;
+	} else {
+		*pad1 = remote;
+		*pad2 = local;
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef NETPLAY_H_
+#define NETPLAY_H_
+
+#include <stdint.h>
+
+#define NETPLAY_NO_ROLLBACK 0xFFFFFFFF
+#define NETPLAY_MAX_ROLLBACK 30
+#define NETPLAY_MAX_DELAY 10
+
+//waits for a peer to connect, the host plays as player 1
+void netplay_host(char *address, char *port);
+//connects to a host, the joining peer plays as player 2
+void netplay_join(char *address, char *port);
+uint8_t netplay_active(void);
+uint8_t netplay_is_host(void);
+uint8_t netplay_started(void);
+//records a button press or release by the local player, buttons are the io.h gamepad button values
+void netplay_local_button(uint8_t button, uint8_t down);
+//sends the state both peers start from, only called on the host
+void netplay_send_state(uint8_t *data, uint32_t size);
+//waits for the state sent by the host, the returned buffer must be freed by the caller
+uint8_t *netplay_recv_state(uint32_t *size_out);
+//starts frame numbering at 0, both peers must call this with identical emulator state
+void netplay_start(uint32_t rollback, uint32_t delay);
+//called when an emulated frame ends, returns the frame that must be restored and emulated again
+//or NETPLAY_NO_ROLLBACK if emulation can continue with the next one
+uint32_t netplay_frame_end(void);
+//frame number of the frame currently being emulated
+uint32_t netplay_frame(void);
+//returns 1 while frames that were already shown are being emulated again after a misprediction
+uint8_t netplay_resimulating(void);
+//button masks for both pads in the current frame, remote input that hasn't arrived yet is predicted
+void netplay_frame_input(uint16_t *pad1, uint16_t *pad2);
+
+#endif //NETPLAY_H_
@@ -20,6 +20,8 @@
 #include "../png.h"
 #include "../controller_info.h"
 #include "../bindings.h"
+#include "../telemetry.h"
+#include "../netplay.h"
 
 static struct nk_context *context;
 static struct rawfb_context *fb_context;
@@ -271,7 +273,11 @@ void view_choose_state(struct nk_context *context, uint8_t is_load)
 			}
 		} else {
 			if (nk_button_label(context, "Save")) {
-				current_system->save_state = selected_slot + 1;
+				if (netplay_active()) {
+					warning("Save states are not available during netplay\n");
+				} else {
+					current_system->save_state = selected_slot + 1;
+				}
 				show_play_view();
 			}
 		}
@@ -452,11 +458,11 @@ void view_key_bindings(struct nk_context *context)
 		"gamepads.2.start", "gamepads.2.mode"
 	};
 	const char *general_binds[] = {
-		"ui.exit", "ui.save_state", "ui.toggle_fullscreen", "ui.soft_reset", "ui.reload",
+		"ui.exit", "ui.save_state", "ui.rewind", "ui.toggle_fullscreen", "ui.soft_reset", "ui.reload",
 		"ui.screenshot", "ui.vgm_log", "ui.sms_pause", "ui.toggle_keyboard_cpatured", "ui.release_mouse"
 	};
 	const char *general_names[] = {
-		"Show Menu", "Quick Save", "Toggle Fullscreen", "Soft Reset", "Reload Media",
+		"Show Menu", "Quick Save", "Rewind", "Toggle Fullscreen", "Soft Reset", "Reload Media",
 		"Internal Screenshot", "Toggle VGM Log", "SMS Pause", "Capture Keyboard", "Release Mouse"
 	};
 	const char *speed_binds[] = {
@@ -605,8 +611,10 @@ const char *translate_binding_option(const char *option)
 		conf_names = tern_insert_ptr(conf_names, "ui.enter_debugger", "Enter CPU Debugger");
 		conf_names = tern_insert_ptr(conf_names, "ui.screenshot", "Take Screenshot");
 		conf_names = tern_insert_ptr(conf_names, "ui.vgm_log", "Toggle VGM Log");
+		conf_names = tern_insert_ptr(conf_names, "ui.video_record", "Toggle Video Recording");
 		conf_names = tern_insert_ptr(conf_names, "ui.exit", "Show Menu");
 		conf_names = tern_insert_ptr(conf_names, "ui.save_state", "Quick Save");
+		conf_names = tern_insert_ptr(conf_names, "ui.rewind", "Rewind");
 		conf_names = tern_insert_ptr(conf_names, "ui.set_speed.0", "Set Speed 0");
 		conf_names = tern_insert_ptr(conf_names, "ui.set_speed.1", "Set Speed 1");
 		conf_names = tern_insert_ptr(conf_names, "ui.set_speed.2", "Set Speed 2");
@@ -670,6 +678,7 @@ static void view_button_binding(struct nk_context *context)
 	};
 	static const char *emu_control[] = {
 		"ui.save_state",
+		"ui.rewind",
 		"ui.exit",
 		"ui.toggle_fullscreen",
 		"ui.screenshot",
@@ -2114,6 +2123,67 @@ void view_menu(struct nk_context *context)
 	}
 }
 
+#ifndef DISABLE_OPENGL
+#define TELEMETRY_GRAPH_FRAMES 240
+static void view_telemetry(struct nk_context *context)
+{
+	uint32_t count = telemetry_count();
+	uint32_t first = count > TELEMETRY_GRAPH_FRAMES ? count - TELEMETRY_GRAPH_FRAMES : 0;
+	float emulation = 0.0f, present = 0.0f;
+	int32_t max_buffered = 1;
+	uint32_t underflows = 0, dropped = 0, repeated = 0;
+	for (uint32_t i = first; i < count; i++)
+	{
+		telemetry_frame *frame = telemetry_get(i);
+		emulation += frame->emulation_us;
+		present += frame->present_us;
+		if (frame->audio_buffered > max_buffered) {
+			max_buffered = frame->audio_buffered;
+		}
+		underflows += frame->underflow != 0;
+		dropped += frame->dropped;
+		repeated += frame->repeated;
+	}
+	if (count > first) {
+		emulation /= (count - first) * 1000.0f;
+		present /= (count - first) * 1000.0f;
+	}
+	
+	uint32_t width = render_width() / 2;
+	uint32_t height = render_height() / 2;
+	nk_style_push_style_item(context, &context->style.window.fixed_background, nk_style_item_color(nk_rgba(0, 0, 0, 160)));
+	if (nk_begin(context, "Telemetry", nk_rect(0, 0, width, height), NK_WINDOW_NO_INPUT | NK_WINDOW_NO_SCROLLBAR)) {
+		float text_height = context->style.font->height;
+		float graph_height = (height - text_height * 3) / 3;
+		//frame times are scaled so that two 60Hz frames fill the graph
+		nk_layout_row_dynamic(context, graph_height * 2, 1);
+		if (nk_chart_begin_colored(context, NK_CHART_LINES, nk_rgb(255, 128, 0), nk_rgb(255, 128, 0), count - first, 0.0f, 33.3f)) {
+			nk_chart_add_slot_colored(context, NK_CHART_LINES, nk_rgb(0, 192, 255), nk_rgb(0, 192, 255), count - first, 0.0f, 33.3f);
+			for (uint32_t i = first; i < count; i++)
+			{
+				telemetry_frame *frame = telemetry_get(i);
+				nk_chart_push_slot(context, frame->emulation_us / 1000.0f, 0);
+				nk_chart_push_slot(context, frame->present_us / 1000.0f, 1);
+			}
+			nk_chart_end(context);
+		}
+		nk_layout_row_dynamic(context, graph_height, 1);
+		if (nk_chart_begin_colored(context, NK_CHART_LINES, nk_rgb(0, 255, 64), nk_rgb(0, 255, 64), count - first, 0.0f, max_buffered)) {
+			for (uint32_t i = first; i < count; i++)
+			{
+				nk_chart_push(context, telemetry_get(i)->audio_buffered);
+			}
+			nk_chart_end(context);
+		}
+		nk_layout_row_dynamic(context, text_height, 1);
+		nk_labelf(context, NK_TEXT_LEFT, "Emulate %.1fms, present %.1fms", emulation, present);
+		nk_labelf(context, NK_TEXT_LEFT, "Underflows %u, dropped %u, repeated %u", underflows, dropped, repeated);
+	}
+	nk_end(context);
+	nk_style_pop_style_item(context);
+}
+#endif
+
 void blastem_nuklear_render(void)
 {
 	if (current_view != view_play) {
@@ -2129,6 +2199,14 @@ void blastem_nuklear_render(void)
 #endif
 		}
 		nk_input_begin(context);
+#ifndef DISABLE_OPENGL
+	} else if (telemetry_overlay_visible() && !fb_context) {
+		//the rawfb backend draws over the whole window, so the overlay is only available with GL
+		nk_input_end(context);
+		view_telemetry(context);
+		nk_sdl_render(NK_ANTI_ALIASING_ON, 512 * 1024, 128 * 1024);
+		nk_input_begin(context);
+#endif
 	}
 }
 
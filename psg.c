@@ -183,3 +183,19 @@ void psg_deserialize(deserialize_buffer *buf, void *vcontext)
 	context->latch = load_int8(buf);
 	context->cycles = load_int32(buf);
 }
+
+uint8_t *psg_save_snapshot(psg_context *context, uint8_t *dst)
+{
+	memcpy(dst, context, sizeof(psg_context));
+	return dst + sizeof(psg_context);
+}
+
+uint8_t *psg_load_snapshot(psg_context *context, uint8_t *src)
+{
+	audio_source *audio = context->audio;
+	vgm_writer *vgm = context->vgm;
+	memcpy(context, src, sizeof(psg_context));
+	context->audio = audio;
+	context->vgm = vgm;
+	return src + sizeof(psg_context);
+}
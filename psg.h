@@ -36,6 +36,8 @@ void psg_run(psg_context * context, uint32_t cycles);
 void psg_vgm_log(psg_context *context, uint32_t master_clock, vgm_writer *vgm);
 void psg_serialize(psg_context *context, serialize_buffer *buf);
 void psg_deserialize(deserialize_buffer *buf, void *vcontext);
+uint8_t *psg_save_snapshot(psg_context *context, uint8_t *dst);
+uint8_t *psg_load_snapshot(psg_context *context, uint8_t *src);
 
 #endif //PSG_CONTEXT_H_
 
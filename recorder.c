@@ -0,0 +1,577 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "zlib/zlib.h"
+#include "recorder.h"
+#include "render_audio.h"
+#include "util.h"
+
+//Video is stored as ZMBV, the lossless codec DOSBox uses for its captures. Each frame is XORed with the
+//previous one in 16x16 blocks and the changed blocks go through a single deflate stream that restarts at
+//every keyframe. Audio is stored as 16-bit stereo PCM, one chunk per video frame, and an idx1 index at the
+//end of the file lets players seek. Capture only copies data into a queue, a separate thread does the rest.
+//Audio is mixed for the recorder as it is emulated and goes through a preallocated ring, each video packet
+//carries the ring position audio had reached when the frame was captured.
+
+#define ZMBV_KEYFRAME 1
+#define ZMBV_FORMAT_32BPP 8
+#define BLOCK_SIZE 16
+#define KEYFRAME_INTERVAL 300
+//number of captured frames that can wait to be written before capture has to wait
+#define QUEUE_SIZE 32
+//stereo frames of audio that can wait to be written, audio that doesn't fit is dropped rather than waiting
+#define AUDIO_RING_FRAMES 65536
+//offsets in an AVI 1.0 file are 32-bit and some readers treat them as signed
+#define MAX_FILE_SIZE 0x7F000000
+#define HEADER_SIZE 324
+#define AVIF_HASINDEX 0x10
+#define AVIF_ISINTERLEAVED 0x100
+#define AVIIF_KEYFRAME 0x10
+
+enum {
+	PACKET_VIDEO,
+	PACKET_STOP
+};
+
+typedef struct {
+	void     *data;
+	uint32_t width;
+	uint32_t height;
+	uint32_t audio_end;
+	uint32_t rate;
+	vid_std  std;
+	uint8_t  type;
+} packet;
+
+typedef struct {
+	char     id[4];
+	uint32_t flags;
+	uint32_t offset;
+	uint32_t size;
+} index_entry;
+
+typedef struct {
+	FILE        *f;
+	z_stream    z;
+	uint32_t    *prev;
+	uint8_t     *raw;
+	uint8_t     *compressed;
+	uint32_t    compressed_size;
+	index_entry *index;
+	uint32_t    index_count;
+	uint32_t    index_storage;
+	int16_t     *audio;
+	uint32_t    audio_count;
+	uint32_t    audio_storage;
+	uint32_t    pos;
+	uint32_t    movi_end;
+	uint32_t    width;
+	uint32_t    height;
+	uint32_t    fps_rate;
+	uint32_t    fps_scale;
+	uint32_t    sample_rate;
+	uint32_t    frames;
+	uint32_t    audio_frames;
+	uint32_t    max_video_chunk;
+	uint32_t    max_audio_chunk;
+	uint8_t     full;
+} writer;
+
+static writer out;
+static packet queue[QUEUE_SIZE];
+static uint32_t queue_read, queue_write;
+static render_semaphore free_slots, filled, capture_lock;
+static render_thread thread;
+static uint8_t recording, running;
+static uint32_t capture_width, capture_height;
+static int16_t audio_ring[AUDIO_RING_FRAMES * 2];
+static uint32_t audio_read, audio_write, audio_rate, dropped_audio;
+
+static uint8_t *put32(uint8_t *dst, uint32_t value)
+{
+	*(dst++) = value;
+	*(dst++) = value >> 8;
+	*(dst++) = value >> 16;
+	*(dst++) = value >> 24;
+	return dst;
+}
+
+static uint8_t *put16(uint8_t *dst, uint16_t value)
+{
+	*(dst++) = value;
+	*(dst++) = value >> 8;
+	return dst;
+}
+
+static uint8_t *put_id(uint8_t *dst, const char *id)
+{
+	memcpy(dst, id, 4);
+	return dst + 4;
+}
+
+static void write_bytes(void *data, uint32_t size)
+{
+	if (size && fwrite(data, 1, size, out.f) != size) {
+		warning("Failed to write to video recording\n");
+	}
+	out.pos += size;
+}
+
+static void write_header(void)
+{
+	uint8_t header[HEADER_SIZE];
+	uint8_t *cur = header;
+	uint32_t micro_per_frame = out.fps_rate ? (uint64_t)out.fps_scale * 1000000 / out.fps_rate : 0;
+	uint16_t block_align = 2 * sizeof(int16_t);
+	cur = put_id(cur, "RIFF");
+	cur = put32(cur, out.pos - 8);
+	cur = put_id(cur, "AVI ");
+	cur = put_id(cur, "LIST");
+	cur = put32(cur, 292);
+	cur = put_id(cur, "hdrl");
+
+	cur = put_id(cur, "avih");
+	cur = put32(cur, 56);
+	cur = put32(cur, micro_per_frame);
+	cur = put32(cur, 0);
+	cur = put32(cur, 0);
+	cur = put32(cur, AVIF_HASINDEX | AVIF_ISINTERLEAVED);
+	cur = put32(cur, out.frames);
+	cur = put32(cur, 0);
+	cur = put32(cur, 2);
+	cur = put32(cur, out.max_video_chunk);
+	cur = put32(cur, out.width);
+	cur = put32(cur, out.height);
+	memset(cur, 0, 16);
+	cur += 16;
+
+	cur = put_id(cur, "LIST");
+	cur = put32(cur, 116);
+	cur = put_id(cur, "strl");
+	cur = put_id(cur, "strh");
+	cur = put32(cur, 56);
+	cur = put_id(cur, "vids");
+	cur = put_id(cur, "ZMBV");
+	cur = put32(cur, 0);
+	cur = put16(cur, 0);
+	cur = put16(cur, 0);
+	cur = put32(cur, 0);
+	cur = put32(cur, out.fps_scale);
+	cur = put32(cur, out.fps_rate);
+	cur = put32(cur, 0);
+	cur = put32(cur, out.frames);
+	cur = put32(cur, out.max_video_chunk);
+	cur = put32(cur, 0xFFFFFFFF);
+	cur = put32(cur, 0);
+	cur = put16(cur, 0);
+	cur = put16(cur, 0);
+	cur = put16(cur, out.width);
+	cur = put16(cur, out.height);
+	cur = put_id(cur, "strf");
+	cur = put32(cur, 40);
+	cur = put32(cur, 40);
+	cur = put32(cur, out.width);
+	cur = put32(cur, out.height);
+	cur = put16(cur, 1);
+	cur = put16(cur, 32);
+	cur = put_id(cur, "ZMBV");
+	cur = put32(cur, out.width * out.height * 4);
+	memset(cur, 0, 16);
+	cur += 16;
+
+	cur = put_id(cur, "LIST");
+	cur = put32(cur, 92);
+	cur = put_id(cur, "strl");
+	cur = put_id(cur, "strh");
+	cur = put32(cur, 56);
+	cur = put_id(cur, "auds");
+	cur = put32(cur, 0);
+	cur = put32(cur, 0);
+	cur = put16(cur, 0);
+	cur = put16(cur, 0);
+	cur = put32(cur, 0);
+	cur = put32(cur, 1);
+	cur = put32(cur, out.sample_rate);
+	cur = put32(cur, 0);
+	cur = put32(cur, out.audio_frames);
+	cur = put32(cur, out.max_audio_chunk);
+	cur = put32(cur, 0xFFFFFFFF);
+	cur = put32(cur, block_align);
+	memset(cur, 0, 8);
+	cur += 8;
+	cur = put_id(cur, "strf");
+	cur = put32(cur, 16);
+	cur = put16(cur, 1);
+	cur = put16(cur, 2);
+	cur = put32(cur, out.sample_rate);
+	cur = put32(cur, out.sample_rate * block_align);
+	cur = put16(cur, block_align);
+	cur = put16(cur, 16);
+
+	cur = put_id(cur, "LIST");
+	cur = put32(cur, out.movi_end - (HEADER_SIZE - 4));
+	cur = put_id(cur, "movi");
+	fseek(out.f, 0, SEEK_SET);
+	if (fwrite(header, 1, sizeof(header), out.f) != sizeof(header)) {
+		warning("Failed to write video recording header\n");
+	}
+	fseek(out.f, 0, SEEK_END);
+}
+
+static void write_chunk(const char *id, void *data, uint32_t size, uint32_t flags)
+{
+	if (out.index_count == out.index_storage) {
+		out.index_storage = out.index_storage ? out.index_storage * 2 : 1024;
+		out.index = realloc(out.index, out.index_storage * sizeof(index_entry));
+	}
+	index_entry *entry = out.index + out.index_count++;
+	memcpy(entry->id, id, 4);
+	entry->flags = flags;
+	//idx1 offsets are relative to the movi list type
+	entry->offset = out.pos - (HEADER_SIZE - 4);
+	entry->size = size;
+	uint8_t chunk_header[8];
+	put32(put_id(chunk_header, id), size);
+	write_bytes(chunk_header, sizeof(chunk_header));
+	write_bytes(data, size);
+	if (size & 1) {
+		uint8_t pad = 0;
+		write_bytes(&pad, 1);
+	}
+}
+
+static void flush_audio(void)
+{
+	if (!out.audio_count) {
+		return;
+	}
+	uint32_t size = out.audio_count * 2 * sizeof(int16_t);
+	write_chunk("01wb", out.audio, size, AVIIF_KEYFRAME);
+	out.audio_frames += out.audio_count;
+	if (size > out.max_audio_chunk) {
+		out.max_audio_chunk = size;
+	}
+	out.audio_count = 0;
+}
+
+static void encode_frame(uint32_t *pixels)
+{
+	uint8_t keyframe = !(out.frames % KEYFRAME_INTERVAL);
+	uint32_t header_size;
+	uint8_t *raw;
+	uint32_t raw_size;
+	if (keyframe) {
+		uint8_t *cur = out.compressed;
+		*(cur++) = ZMBV_KEYFRAME;
+		*(cur++) = 0; //major version
+		*(cur++) = 1; //minor version
+		*(cur++) = 1; //zlib compression
+		*(cur++) = ZMBV_FORMAT_32BPP;
+		*(cur++) = BLOCK_SIZE;
+		*(cur++) = BLOCK_SIZE;
+		header_size = cur - out.compressed;
+		deflateReset(&out.z);
+		raw = (uint8_t *)pixels;
+		raw_size = out.width * out.height * sizeof(uint32_t);
+	} else {
+		out.compressed[0] = 0;
+		header_size = 1;
+		//one motion vector per block, all of them zero, with the low bit flagging blocks that have XOR data
+		uint32_t blocks_x = (out.width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		uint32_t blocks_y = (out.height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		uint8_t *vectors = out.raw;
+		uint32_t vector_size = (blocks_x * blocks_y * 2 + 3) & ~3;
+		uint32_t *cur = (uint32_t *)(out.raw + vector_size);
+		memset(vectors, 0, vector_size);
+		for (uint32_t by = 0; by < out.height; by += BLOCK_SIZE)
+		{
+			uint32_t block_height = out.height - by < BLOCK_SIZE ? out.height - by : BLOCK_SIZE;
+			for (uint32_t bx = 0; bx < out.width; bx += BLOCK_SIZE, vectors += 2)
+			{
+				uint32_t block_width = out.width - bx < BLOCK_SIZE ? out.width - bx : BLOCK_SIZE;
+				uint32_t offset = by * out.width + bx;
+				uint32_t y;
+				for (y = 0; y < block_height; y++)
+				{
+					if (memcmp(pixels + offset + y * out.width, out.prev + offset + y * out.width, block_width * sizeof(uint32_t))) {
+						break;
+					}
+				}
+				if (y == block_height) {
+					continue;
+				}
+				*vectors = 1;
+				for (y = 0; y < block_height; y++)
+				{
+					uint32_t *src = pixels + offset + y * out.width;
+					uint32_t *old = out.prev + offset + y * out.width;
+					for (uint32_t x = 0; x < block_width; x++)
+					{
+						*(cur++) = src[x] ^ old[x];
+					}
+				}
+			}
+		}
+		raw = out.raw;
+		raw_size = (uint8_t *)cur - out.raw;
+	}
+	out.z.next_in = raw;
+	out.z.avail_in = raw_size;
+	out.z.next_out = out.compressed + header_size;
+	out.z.avail_out = out.compressed_size - header_size;
+	deflate(&out.z, Z_SYNC_FLUSH);
+	uint32_t size = out.compressed_size - out.z.avail_out;
+	write_chunk("00dc", out.compressed, size, keyframe ? AVIIF_KEYFRAME : 0);
+	if (size > out.max_video_chunk) {
+		out.max_video_chunk = size;
+	}
+	memcpy(out.prev, pixels, out.width * out.height * sizeof(uint32_t));
+	out.frames++;
+}
+
+//moves the audio captured before p->audio_end out of the ring
+static void take_audio(packet *p)
+{
+	if (!out.sample_rate) {
+		out.sample_rate = p->rate;
+	}
+	uint32_t read = audio_read;
+	uint32_t frames = p->audio_end - read;
+	if (out.audio_count + frames > out.audio_storage) {
+		out.audio_storage = (out.audio_count + frames) * 2;
+		out.audio = realloc(out.audio, out.audio_storage * 2 * sizeof(int16_t));
+	}
+	for (; read != p->audio_end; read++, out.audio_count++)
+	{
+		memcpy(out.audio + out.audio_count * 2, audio_ring + (read % AUDIO_RING_FRAMES) * 2, 2 * sizeof(int16_t));
+	}
+	//lets recorder_audio reuse the space
+	__atomic_store_n(&audio_read, read, __ATOMIC_RELEASE);
+}
+
+static void handle_video(packet *p)
+{
+	if (!out.width) {
+		out.width = p->width;
+		out.height = p->height;
+		if (p->std == VID_PAL) {
+			out.fps_rate = 53203424;
+			out.fps_scale = 3420 * 313;
+		} else {
+			out.fps_rate = 53693175;
+			out.fps_scale = 3420 * 262;
+		}
+		uint32_t frame_size = out.width * out.height * sizeof(uint32_t);
+		uint32_t blocks = ((out.width + BLOCK_SIZE - 1) / BLOCK_SIZE) * ((out.height + BLOCK_SIZE - 1) / BLOCK_SIZE);
+		uint32_t raw_size = frame_size + blocks * 2 + 4;
+		out.prev = malloc(frame_size);
+		out.raw = malloc(raw_size);
+		//room for the ZMBV header and the empty block deflate adds for each sync flush
+		out.compressed_size = deflateBound(&out.z, raw_size) + 16;
+		out.compressed = malloc(out.compressed_size);
+	}
+	encode_frame(p->data);
+	//audio captured since the last frame follows it so the two streams stay interleaved
+	take_audio(p);
+	flush_audio();
+}
+
+static void finish_file(void)
+{
+	flush_audio();
+	out.movi_end = out.pos;
+	uint8_t chunk_header[8];
+	put32(put_id(chunk_header, "idx1"), out.index_count * sizeof(index_entry));
+	write_bytes(chunk_header, sizeof(chunk_header));
+	for (uint32_t i = 0; i < out.index_count; i++)
+	{
+		uint8_t entry[sizeof(index_entry)];
+		uint8_t *cur = put_id(entry, out.index[i].id);
+		cur = put32(cur, out.index[i].flags);
+		cur = put32(cur, out.index[i].offset);
+		put32(cur, out.index[i].size);
+		write_bytes(entry, sizeof(entry));
+	}
+	write_header();
+	fclose(out.f);
+	out.f = NULL;
+}
+
+static int writer_thread(void *data)
+{
+	for (;;)
+	{
+		render_semaphore_wait(filled);
+		packet p = queue[queue_read];
+		queue_read = (queue_read + 1) % QUEUE_SIZE;
+		render_semaphore_post(free_slots);
+		if (p.type == PACKET_STOP) {
+			if (!out.full) {
+				take_audio(&p);
+			}
+			break;
+		}
+		if (!out.full) {
+			handle_video(&p);
+			if (out.pos > MAX_FILE_SIZE) {
+				warning("Video recording reached the maximum AVI file size, stopping\n");
+				finish_file();
+				out.full = 1;
+				__atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+			}
+		}
+		free(p.data);
+	}
+	if (!out.full) {
+		finish_file();
+	}
+	deflateEnd(&out.z);
+	free(out.prev);
+	free(out.raw);
+	free(out.compressed);
+	free(out.index);
+	free(out.audio);
+	return 0;
+}
+
+//capture_lock is held while a packet is queued so recorder_stop can't slip its stop packet in between
+static void push_packet(packet p)
+{
+	render_semaphore_wait(capture_lock);
+	if (p.type != PACKET_STOP && !recording) {
+		render_semaphore_post(capture_lock);
+		free(p.data);
+		return;
+	}
+	render_semaphore_wait(free_slots);
+	queue[queue_write] = p;
+	queue_write = (queue_write + 1) % QUEUE_SIZE;
+	render_semaphore_post(filled);
+	if (p.type == PACKET_STOP) {
+		__atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+	}
+	render_semaphore_post(capture_lock);
+}
+
+uint8_t recorder_start(char *path)
+{
+	if (running) {
+		return 1;
+	}
+	if (!capture_lock) {
+		capture_lock = render_create_semaphore(1);
+		free_slots = render_create_semaphore(QUEUE_SIZE);
+		filled = render_create_semaphore(0);
+		atexit(recorder_stop);
+	}
+	memset(&out, 0, sizeof(out));
+	out.f = fopen(path, "wb");
+	if (!out.f) {
+		return 0;
+	}
+	if (deflateInit(&out.z, 1) != Z_OK) {
+		fclose(out.f);
+		return 0;
+	}
+	//header gets filled in once the final sizes are known
+	uint8_t header[HEADER_SIZE] = {0};
+	write_bytes(header, sizeof(header));
+	queue_read = queue_write = 0;
+	capture_width = capture_height = 0;
+	audio_read = audio_write = audio_rate = dropped_audio = 0;
+	render_audio_start_recording();
+	if (!render_create_thread(&thread, "recorder", writer_thread, NULL)) {
+		deflateEnd(&out.z);
+		fclose(out.f);
+		return 0;
+	}
+	running = 1;
+	__atomic_store_n(&recording, 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+void recorder_stop(void)
+{
+	if (!running) {
+		return;
+	}
+	render_audio_flush_recording();
+	push_packet((packet){.type = PACKET_STOP, .audio_end = audio_write, .rate = audio_rate});
+	render_wait_thread(thread);
+	running = 0;
+	if (dropped_audio) {
+		warning("%u audio samples were dropped because the video recording fell behind\n", dropped_audio);
+	}
+}
+
+uint8_t recorder_running(void)
+{
+	return running;
+}
+
+void recorder_video_frame(uint32_t *buffer, uint32_t width, uint32_t height, uint32_t pitch, vid_std std)
+{
+	if (!__atomic_load_n(&recording, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	render_audio_flush_recording();
+	if (!capture_width) {
+		capture_width = width;
+		capture_height = height;
+	}
+	uint32_t *frame = malloc(capture_width * capture_height * sizeof(uint32_t));
+	uint32_t *dst = frame;
+	for (uint32_t y = 0; y < capture_height; y++)
+	{
+		uint32_t *src = buffer + (y * height / capture_height) * pitch / sizeof(uint32_t);
+		if (width == capture_width) {
+			memcpy(dst, src, width * sizeof(uint32_t));
+			dst += width;
+		} else {
+			//mode changes keep the size of the recording, a TV stretches H32 to the same width as H40 too
+			for (uint32_t x = 0; x < capture_width; x++)
+			{
+				*(dst++) = src[x * width / capture_width];
+			}
+		}
+	}
+	push_packet((packet){
+		.type = PACKET_VIDEO,
+		.data = frame,
+		.width = capture_width,
+		.height = capture_height,
+		.audio_end = audio_write,
+		.rate = audio_rate,
+		.std = std
+	});
+}
+
+void recorder_audio(float *samples, uint32_t frames, uint32_t rate)
+{
+	if (!__atomic_load_n(&recording, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	audio_rate = rate;
+	//this runs on the emulation thread, so it must never wait on the writer thread
+	uint32_t available = AUDIO_RING_FRAMES - (audio_write - __atomic_load_n(&audio_read, __ATOMIC_ACQUIRE));
+	if (frames > available) {
+		dropped_audio += frames - available;
+		frames = available;
+	}
+	//the writer only reads up to the audio_end of a packet, which is queued after this
+	for (uint32_t i = 0; i < frames; i++, audio_write++)
+	{
+		int16_t *dst = audio_ring + (audio_write % AUDIO_RING_FRAMES) * 2;
+		for (int channel = 0; channel < 2; channel++)
+		{
+			float sample = *(samples++);
+			if (sample >= 1.0f) {
+				dst[channel] = 0x7FFF;
+			} else if (sample <= -1.0f) {
+				dst[channel] = -0x8000;
+			} else {
+				dst[channel] = sample * 0x7FFF;
+			}
+		}
+	}
+}
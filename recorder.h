@@ -0,0 +1,20 @@
+#ifndef RECORDER_H_
+#define RECORDER_H_
+
+#include <stdint.h>
+#include "render.h"
+
+//starts recording video and audio to an AVI file at path, returns 0 if the file could not be opened
+uint8_t recorder_start(char *path);
+//finishes the file, waits for everything captured so far to be written
+void recorder_stop(void);
+//returns 1 between recorder_start and recorder_stop
+uint8_t recorder_running(void);
+//captures a frame, must be called from the thread that produces frames
+//frames with a different size than the first one are scaled to match it
+void recorder_video_frame(uint32_t *buffer, uint32_t width, uint32_t height, uint32_t pitch, vid_std std);
+//captures mixed stereo audio, samples are interleaved and in the range -1.0 to 1.0
+//called from render_audio on the thread that produces frames, audio is dropped if the writer falls behind
+void recorder_audio(float *samples, uint32_t frames, uint32_t rate);
+
+#endif //RECORDER_H_
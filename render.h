@@ -9,9 +9,13 @@
 #include <stdint.h>
 
 #ifndef IS_LIB
-#ifdef USE_FBDEV
+#if defined(USE_FBDEV) || defined(USE_NULL_RENDER)
+#include <pthread.h>
+#include <semaphore.h>
 #include "special_keys_evdev.h"
 #define render_relative_mouse(V)
+typedef pthread_t render_thread;
+typedef sem_t* render_semaphore;
 #else
 #include <SDL.h>
 #define RENDERKEY_UP       SDLK_UP
@@ -68,6 +72,7 @@
 #define RENDER_DPAD_RIGHT  SDL_HAT_RIGHT
 #define render_relative_mouse SDL_SetRelativeMouseMode
 typedef SDL_Thread* render_thread;
+typedef SDL_sem* render_semaphore;
 #endif
 #endif
 
@@ -86,6 +91,25 @@ typedef enum {
 	NUM_VID_STD
 } vid_std;
 
+typedef enum {
+	FRAMEBUFFER_XRGB8888,
+	FRAMEBUFFER_RGB565,
+	//one byte per pixel indexing a palette of up to 256 XRGB8888 colors that belongs to that line
+	FRAMEBUFFER_INDEXED8
+} framebuffer_format;
+
+//takes the place of the render backend for the main framebuffers of one system
+//so several systems can run in the same process, see vdp_set_video_sink
+typedef struct video_sink video_sink;
+struct video_sink {
+	uint32_t           *(*get_framebuffer)(video_sink *sink, uint8_t which, int *pitch);
+	//only called for FRAMEBUFFER_INDEXED8
+	uint32_t           *(*get_palettes)(video_sink *sink, uint8_t which, int *pitch);
+	void               (*framebuffer_updated)(video_sink *sink, uint8_t which, int width);
+	void               *data;
+	framebuffer_format format;
+};
+
 #define RENDER_DPAD_BIT 0x40000000
 #define RENDER_AXIS_BIT 0x20000000
 #define RENDER_AXIS_POS 0x10000000
@@ -104,6 +128,14 @@ uint8_t render_create_window(char *caption, uint32_t width, uint32_t height, win
 void render_destroy_window(uint8_t which);
 uint32_t *render_get_framebuffer(uint8_t which, int *pitch);
 void render_framebuffer_updated(uint8_t which, int width);
+//reports which lines changed since the last frame of the same field, must be called before render_framebuffer_updated
+//first_line > last_line means nothing changed, frames that aren't reported are assumed to have changed entirely
+void render_framebuffer_dirty_lines(uint8_t which, uint32_t first_line, uint32_t last_line);
+//pixel format of FRAMEBUFFER_ODD and FRAMEBUFFER_EVEN, other framebuffers are always XRGB8888
+//render_map_color still returns XRGB8888 colors when this is FRAMEBUFFER_RGB565 or FRAMEBUFFER_INDEXED8
+framebuffer_format render_framebuffer_format(void);
+//only called for FRAMEBUFFER_INDEXED8, the palette for framebuffer row N starts pitch * N bytes in
+uint32_t *render_get_palettes(uint8_t which, int *pitch);
 //returns the framebuffer index associated with the Window that has focus
 uint8_t render_get_active_framebuffer(void);
 void render_init(int width, int height, char * title, uint8_t fullscreen);
@@ -138,11 +170,20 @@ void render_set_gl_context_handlers(ui_render_fun destroy, ui_render_fun create)
 void render_set_ui_render_fun(ui_render_fun);
 void render_set_ui_fb_resize_handler(ui_render_fun resize);
 void render_video_loop(void);
+//number of frames that were dropped or shown again by the threaded video loop since startup
+void render_video_stats(uint32_t *dropped, uint32_t *repeated);
 uint8_t render_should_release_on_exit(void);
 void render_set_external_sync(uint8_t ext_sync_on);
 void render_reset_mappings(void);
 #ifndef IS_LIB
 uint8_t render_create_thread(render_thread *thread, const char *name, render_thread_fun fun, void *data);
+void render_wait_thread(render_thread thread);
+render_semaphore render_create_semaphore(uint32_t initial_value);
+void render_destroy_semaphore(render_semaphore sem);
+void render_semaphore_wait(render_semaphore sem);
+//returns 1 if the semaphore was decremented, 0 if it would have blocked
+uint8_t render_semaphore_try_wait(render_semaphore sem);
+void render_semaphore_post(render_semaphore sem);
 #endif
 
 #endif //RENDER_H_
@@ -6,6 +6,10 @@
 #include "util.h"
 #include "config.h"
 #include "blastem.h"
+#include "telemetry.h"
+#if !defined(IS_LIB) && !defined(DISABLE_ZLIB)
+#include "recorder.h"
+#endif
 
 static uint8_t output_channels;
 static uint32_t buffer_samples, sample_rate;
@@ -14,6 +18,8 @@ static audio_source *audio_sources[8];
 static audio_source *inactive_audio_sources[8];
 static uint8_t num_audio_sources;
 static uint8_t num_inactive_audio_sources;
+//position of the next frame the recorder gets, see record_sample
+static uint32_t record_read;
 
 static float overall_gain_mult, *mix_buf;
 static int sample_size;
@@ -90,6 +96,7 @@ static int32_t mix_f32(audio_source *audio, float *stream, int samples)
 	}
 	if (cur != end) {
 		debug_message("Underflow of %d samples, read_start: %d, read_end: %d, mask: %X\n", (int)(end-cur)/2, audio->read_start, audio->read_end, audio->mask);
+		telemetry_underflow((end-cur)/2);
 		return (cur-end)/2;
 	} else {
 		return ((i_end - i) & audio->mask) / audio->num_channels;
@@ -116,6 +123,7 @@ int mix_and_convert(unsigned char *byte_stream, int len, int *min_remaining_out)
 		render_buffer_consumed(audio_sources[i]);
 	}
 	convert(mix_dest, byte_stream, samples);
+	telemetry_audio_buffered(min_buffered);
 	if (min_remaining_out) {
 		*min_remaining_out = min_remaining_buffer;
 	}
@@ -139,11 +147,13 @@ uint8_t all_sources_ready(void)
 
 void render_audio_adjust_clock(audio_source *src, uint64_t master_clock, uint64_t sample_divider)
 {
-	src->buffer_inc = ((BUFFER_INC_RES * (uint64_t)sample_rate) / master_clock) * sample_divider;
+	uint32_t rate = src->sink ? src->sink->sample_rate : sample_rate;
+	src->buffer_inc = ((BUFFER_INC_RES * (uint64_t)rate) / master_clock) * sample_divider;
 }
 
 void render_audio_adjust_speed(float adjust_ratio)
 {
+	telemetry_speed_adjust(adjust_ratio);
 	for (uint8_t i = 0; i < num_audio_sources; i++)
 	{
 		audio_sources[i]->buffer_inc = ((double)audio_sources[i]->buffer_inc) + ((double)audio_sources[i]->buffer_inc) * adjust_ratio + 0.5;
@@ -169,6 +179,8 @@ audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider
 		fatal_error("Too many audio sources!");
 	} else {
 		render_audio_adjust_clock(ret, master_clock, sample_divider);
+		ret->record_inc = ret->buffer_inc;
+		ret->record_fraction = 0;
 		double lowpass_cutoff = get_lowpass_cutoff(config);
 		double rc = (1.0 / lowpass_cutoff) / (2.0 * M_PI);
 		ret->dt = 1.0 / ((double)master_clock / (double)(sample_divider));
@@ -179,6 +191,7 @@ audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider
 		ret->last_left = ret->last_right = 0;
 		ret->read_start = 0;
 		ret->read_end = render_is_audio_sync() ? buffer_samples * channels : 0;
+		ret->record_pos = record_read;
 		ret->mask = render_is_audio_sync() ? 0xFFFFFFFF : alloc_size-1;
 		ret->gain_mult = 1.0f;
 	}
@@ -200,6 +213,9 @@ void render_audio_source_gaindb(audio_source *src, float gain)
 
 void render_pause_source(audio_source *src)
 {
+	if (src->sink) {
+		return;
+	}
 	uint8_t found = 0, remaining_sources;
 	render_lock_audio();
 		for (uint8_t i = 0; i < num_audio_sources; i++)
@@ -221,6 +237,9 @@ void render_pause_source(audio_source *src)
 
 void render_resume_source(audio_source *src)
 {
+	if (src->sink) {
+		return;
+	}
 	render_lock_audio();
 		if (num_audio_sources < 8) {
 			audio_sources[num_audio_sources++] = src;
@@ -232,10 +251,12 @@ void render_resume_source(audio_source *src)
 			inactive_audio_sources[i] = inactive_audio_sources[--num_inactive_audio_sources];
 		}
 	}
+	//a paused source didn't add anything to the recording, so it continues from where the others are
+	src->record_pos = record_read;
 	render_source_resumed(src);
 }
 
-void render_free_source(audio_source *src)
+static void remove_source(audio_source *src)
 {
 	uint8_t found = 0;
 	for (uint8_t i = 0; i < num_inactive_audio_sources; i++)
@@ -250,7 +271,16 @@ void render_free_source(audio_source *src)
 		render_pause_source(src);
 		num_inactive_audio_sources--;
 	}
-	
+}
+
+void render_free_source(audio_source *src)
+{
+	if (src->sink) {
+		free(src->back);
+		free(src);
+		return;
+	}
+	remove_source(src);
 	free(src->front);
 	if (render_is_audio_sync()) {
 		free(src->back);
@@ -259,6 +289,28 @@ void render_free_source(audio_source *src)
 	free(src);
 }
 
+void render_audio_source_set_sink(audio_source *src, audio_sink *sink)
+{
+	remove_source(src);
+	if (render_is_audio_sync()) {
+		free(src->front);
+		render_free_audio_opaque(src->opaque);
+	}
+	src->opaque = NULL;
+	src->sink = sink;
+	src->back = src->front = realloc(src->back, sink->buffer_frames * src->num_channels * sizeof(int16_t));
+	src->mask = 0xFFFFFFFF;
+	src->buffer_pos = src->read_start = src->read_end = 0;
+	src->buffer_fraction = 0;
+	src->buffer_inc = BUFFER_INC_RES * (double)sink->sample_rate * src->dt;
+}
+
+static void sink_samples(audio_source *src)
+{
+	src->sink->samples(src->sink, src, src->back, src->buffer_pos / src->num_channels);
+	src->buffer_pos = 0;
+}
+
 static int16_t lowpass_sample(audio_source *src, int16_t last, int16_t current)
 {
 	int32_t tmp = current * src->lowpass_alpha + last * (0x10000 - src->lowpass_alpha);
@@ -273,9 +325,85 @@ static void interp_sample(audio_source *src, int16_t last, int16_t current)
 	src->back[src->buffer_pos++] = tmp >> 16;
 }
 
+#if !defined(IS_LIB) && !defined(DISABLE_ZLIB)
+//The recorder gets its own mix of all sources, built here on the emulation thread as samples are produced rather
+//than in the audio callback. Each source is resampled against the clock it was created with instead of the one
+//the host currently runs it at, so the recording matches the emulated video at any speed setting.
+#define RECORD_FRAMES 16384
+static float record_mix[RECORD_FRAMES * 2];
+
+void render_audio_start_recording(void)
+{
+	memset(record_mix, 0, sizeof(record_mix));
+	record_read = 0;
+	for (uint8_t i = 0; i < num_audio_sources; i++)
+	{
+		audio_sources[i]->record_pos = 0;
+		audio_sources[i]->record_fraction = 0;
+	}
+	for (uint8_t i = 0; i < num_inactive_audio_sources; i++)
+	{
+		inactive_audio_sources[i]->record_pos = 0;
+		inactive_audio_sources[i]->record_fraction = 0;
+	}
+}
+
+static void record_sample(audio_source *src, int16_t last_left, int16_t left, int16_t last_right, int16_t right)
+{
+	if (src->sink || !recorder_running()) {
+		return;
+	}
+	float gain_mult = src->gain_mult * overall_gain_mult / 0x7FFF;
+	src->record_fraction += src->record_inc;
+	while (src->record_fraction > BUFFER_INC_RES)
+	{
+		src->record_fraction -= BUFFER_INC_RES;
+		//a source that gets too far ahead of the others drops samples instead of overwriting unmixed ones
+		if (src->record_pos - record_read < RECORD_FRAMES) {
+			int64_t weight = (src->record_fraction << 16) / src->record_inc;
+			float *dst = record_mix + (src->record_pos % RECORD_FRAMES) * 2;
+			dst[0] += gain_mult * (int16_t)((last_left * weight + left * (0x10000 - weight)) >> 16);
+			dst[1] += gain_mult * (int16_t)((last_right * weight + right * (0x10000 - weight)) >> 16);
+		}
+		src->record_pos++;
+	}
+}
+
+void render_audio_flush_recording(void)
+{
+	if (!num_audio_sources) {
+		return;
+	}
+	//only frames every active source has reached are complete
+	uint32_t end = audio_sources[0]->record_pos;
+	for (uint8_t i = 1; i < num_audio_sources; i++)
+	{
+		if ((int32_t)(audio_sources[i]->record_pos - end) < 0) {
+			end = audio_sources[i]->record_pos;
+		}
+	}
+	while ((int32_t)(end - record_read) > 0)
+	{
+		uint32_t start = record_read % RECORD_FRAMES;
+		uint32_t frames = end - record_read;
+		if (frames > RECORD_FRAMES - start) {
+			frames = RECORD_FRAMES - start;
+		}
+		recorder_audio(record_mix + start * 2, frames, sample_rate);
+		memset(record_mix + start * 2, 0, frames * 2 * sizeof(float));
+		record_read += frames;
+	}
+}
+#else
+#define record_sample(src, last_left, left, last_right, right)
+#endif
+
 static uint32_t sync_samples;
 void render_put_mono_sample(audio_source *src, int16_t value)
 {
+	if (src->suppressed) {
+		return;
+	}
 	value = lowpass_sample(src, src->last_left, value);
 	src->buffer_fraction += src->buffer_inc;
 	uint32_t base = render_is_audio_sync() ? 0 : src->read_end;
@@ -284,16 +412,24 @@ void render_put_mono_sample(audio_source *src, int16_t value)
 		src->buffer_fraction -= BUFFER_INC_RES;
 		interp_sample(src, src->last_left, value);
 		
-		if (((src->buffer_pos - base) & src->mask) >= sync_samples) {
+		if (src->sink) {
+			if (src->buffer_pos >= src->sink->buffer_frames) {
+				sink_samples(src);
+			}
+		} else if (((src->buffer_pos - base) & src->mask) >= sync_samples) {
 			render_do_audio_ready(src);
 		}
 		src->buffer_pos &= src->mask;
 	}
+	record_sample(src, src->last_left, value, src->last_left, value);
 	src->last_left = value;
 }
 
 void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right)
 {
+	if (src->suppressed) {
+		return;
+	}
 	left = lowpass_sample(src, src->last_left, left);
 	right = lowpass_sample(src, src->last_right, right);
 	src->buffer_fraction += src->buffer_inc;
@@ -305,17 +441,25 @@ void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right)
 		interp_sample(src, src->last_left, left);
 		interp_sample(src, src->last_right, right);
 		
-		if (((src->buffer_pos - base) & src->mask)/2 >= sync_samples) {
+		if (src->sink) {
+			if (src->buffer_pos/2 >= src->sink->buffer_frames) {
+				sink_samples(src);
+			}
+		} else if (((src->buffer_pos - base) & src->mask)/2 >= sync_samples) {
 			render_do_audio_ready(src);
 		}
 		src->buffer_pos &= src->mask;
 	}
+	record_sample(src, src->last_left, left, src->last_right, right);
 	src->last_left = left;
 	src->last_right = right;
 }
 
-static void update_source(audio_source *src, double rc, uint8_t sync_changed)
+static void update_source(audio_source *src, double rc, uint8_t sync_changed, uint32_t old_rate)
 {
+	if (old_rate && old_rate != sample_rate) {
+		src->record_inc = src->record_inc * sample_rate / old_rate;
+	}
 	double alpha = src->dt / (src->dt + rc);
 	int32_t lowpass_alpha = (int32_t)(((double)0x10000) * alpha);
 	src->lowpass_alpha = lowpass_alpha;
@@ -338,6 +482,7 @@ static void update_source(audio_source *src, double rc, uint8_t sync_changed)
 uint8_t old_audio_sync;
 void render_audio_initialized(render_audio_format format, uint32_t rate, uint8_t channels, uint32_t buffer_size, int sample_size_in)
 {
+	uint32_t old_rate = sample_rate;
 	sample_rate = rate;
 	output_channels = channels;
 	buffer_samples = buffer_size;
@@ -375,11 +520,11 @@ void render_audio_initialized(render_audio_format format, uint32_t rate, uint8_t
 	render_lock_audio();
 		for (uint8_t i = 0; i < num_audio_sources; i++)
 		{
-			update_source(audio_sources[i], rc, sync_changed);
+			update_source(audio_sources[i], rc, sync_changed, old_rate);
 		}
 	render_unlock_audio();
 	for (uint8_t i = 0; i < num_inactive_audio_sources; i++)
 	{
-		update_source(inactive_audio_sources[i], rc, sync_changed);
+		update_source(inactive_audio_sources[i], rc, sync_changed, old_rate);
 	}
 }
\ No newline at end of file
@@ -8,6 +8,8 @@ typedef enum {
 	RENDER_AUDIO_UNKNOWN
 } render_audio_format;
 
+typedef struct audio_sink audio_sink;
+
 typedef struct {
 	void     *opaque;
 	int16_t  *front;
@@ -15,18 +17,32 @@ typedef struct {
 	double   dt;
 	uint64_t buffer_fraction;
 	uint64_t buffer_inc;
+	uint64_t record_fraction;
+	uint64_t record_inc; //like buffer_inc but for the clock the source was created with, speed changes don't affect it
 	float    gain_mult;
 	uint32_t buffer_pos;
 	uint32_t read_start;
 	uint32_t read_end;
+	uint32_t record_pos;
 	uint32_t lowpass_alpha;
 	uint32_t mask;
 	int16_t  last_left;
 	int16_t  last_right;
 	uint8_t  num_channels;
 	uint8_t  front_populated;
+	uint8_t  suppressed; //samples are dropped while set, used for run-ahead
+	audio_sink *sink;
 } audio_source;
 
+//takes a source away from the global mixer so several systems can run in the same process
+struct audio_sink {
+	//called from whichever thread is running the source's system each time buffer_frames frames are ready
+	void     (*samples)(audio_sink *sink, audio_source *src, int16_t *samples, uint32_t frames);
+	void     *data;
+	uint32_t sample_rate;
+	uint32_t buffer_frames;
+};
+
 //public interface
 audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider, uint8_t channels);
 void render_audio_source_gaindb(audio_source *src, float gain);
@@ -36,6 +52,11 @@ void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right);
 void render_pause_source(audio_source *src);
 void render_resume_source(audio_source *src);
 void render_free_source(audio_source *src);
+void render_audio_source_set_sink(audio_source *src, audio_sink *sink);
+//used by the recorder, start clears the audio mixed for it so far and flush hands it what was mixed since
+//the last flush, which the recorder does before each video frame
+void render_audio_start_recording(void);
+void render_audio_flush_recording(void);
 //interface for render backends
 void render_audio_initialized(render_audio_format format, uint32_t rate, uint8_t channels, uint32_t buffer_size, int sample_size);
 int mix_and_convert(unsigned char *byte_stream, int len, int *min_remaining_out);
@@ -27,6 +27,9 @@
 #include "paths.h"
 #include "ppm.h"
 #include "png.h"
+#ifndef DISABLE_ZLIB
+#include "recorder.h"
+#endif
 #include "config.h"
 #include "controller_info.h"
 
@@ -1313,22 +1316,32 @@ void render_destroy_window(uint8_t which)
 
 static uint8_t last_fb;
 static uint32_t texture_off;
+//buffer and pitch last handed out for each field so the recorder can read back what was drawn
+static uint32_t *field_buffer[2];
+static int field_pitch[2];
 uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
 {
+	uint32_t *buffer;
 	if (max_multiple == 1 && !render_gl) {
 		if (last_fb != which) {
 			*pitch = fb_stride * 2;
-			return framebuffer + (which == FRAMEBUFFER_EVEN ? fb_stride / sizeof(uint32_t) : 0);
+			buffer = framebuffer + (which == FRAMEBUFFER_EVEN ? fb_stride / sizeof(uint32_t) : 0);
+		} else {
+			*pitch = fb_stride;
+			buffer = framebuffer;
 		}
-		*pitch = fb_stride;
-		return framebuffer;
-	}
-	if (!render_gl && last_fb != which) {
+	} else if (!render_gl && last_fb != which) {
 		*pitch = LINEBUF_SIZE * sizeof(uint32_t) * 2;
-		return texture_buf + texture_off + (which == FRAMEBUFFER_EVEN ? LINEBUF_SIZE : 0);
+		buffer = texture_buf + texture_off + (which == FRAMEBUFFER_EVEN ? LINEBUF_SIZE : 0);
+	} else {
+		*pitch = LINEBUF_SIZE * sizeof(uint32_t);
+		buffer = texture_buf + texture_off;
 	}
-	*pitch = LINEBUF_SIZE * sizeof(uint32_t);
-	return texture_buf + texture_off;
+	if (which <= FRAMEBUFFER_EVEN) {
+		field_buffer[which] = buffer;
+		field_pitch[which] = *pitch;
+	}
+	return buffer;
 }
 
 uint8_t events_processed;
@@ -1340,12 +1353,35 @@ uint8_t events_processed;
 
 static uint8_t interlaced;
 void render_update_display();
+void render_framebuffer_dirty_lines(uint8_t which, uint32_t first_line, uint32_t last_line)
+{
+	//the whole frame is always copied to the display
+}
+
+framebuffer_format render_framebuffer_format(void)
+{
+	return FRAMEBUFFER_XRGB8888;
+}
+
+uint32_t *render_get_palettes(uint8_t which, int *pitch)
+{
+	//FRAMEBUFFER_INDEXED8 is never reported
+	*pitch = 0;
+	return NULL;
+}
+
 void render_framebuffer_updated(uint8_t which, int width)
 {
 	uint32_t height = which <= FRAMEBUFFER_EVEN 
 		? (video_standard == VID_NTSC ? 243 : 294) - (overscan_top[video_standard] + overscan_bot[video_standard])
 		: 240;
 	width -= overscan_left[video_standard] + overscan_right[video_standard];
+#ifndef DISABLE_ZLIB
+	if (which <= FRAMEBUFFER_EVEN && recorder_running() && field_buffer[which]) {
+		uint32_t *src = field_buffer[which] + overscan_left[video_standard] + overscan_top[video_standard] * field_pitch[which] / sizeof(uint32_t);
+		recorder_video_frame(src, width, height, field_pitch[which], video_standard);
+	}
+#endif
 #ifndef DISABLE_OPENGL
 	if (render_gl && which <= FRAMEBUFFER_EVEN) {
 		last_width = width;
@@ -0,0 +1,512 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "render.h"
+#include "render_audio.h"
+#include "blastem.h"
+#include "util.h"
+#include "paths.h"
+#include "ppm.h"
+#ifndef DISABLE_ZLIB
+#include "png.h"
+#include "recorder.h"
+#endif
+#include "config.h"
+#include "wave.h"
+#include "vdp.h"
+
+//Render backend that never touches a display or sound device. Frames are drawn into memory and audio is
+//mixed on the emulation thread and either discarded or written to a file, which makes it suitable for
+//running many instances on a server. The null_render section of the config controls its behavior.
+
+//enough for a PAL frame with full borders plus the extra lines the VDP can draw when the mode changes mid-frame
+#define FRAMEBUFFER_LINES 512
+
+static uint32_t framebuffers[2][LINEBUF_SIZE * FRAMEBUFFER_LINES];
+static uint32_t last_width = LINEBUF_SIZE;
+static vid_std video_standard;
+
+static uint32_t overscan_top[NUM_VID_STD] = {2, 21};
+static uint32_t overscan_bot[NUM_VID_STD] = {1, 17};
+static uint32_t overscan_left[NUM_VID_STD] = {13, 13};
+static uint32_t overscan_right[NUM_VID_STD] = {14, 14};
+static char *vid_std_names[NUM_VID_STD] = {"ntsc", "pal"};
+
+static uint8_t throttle;
+static uint32_t max_frames, frames_shown;
+static uint64_t next_frame_ns;
+
+enum {
+	AUDIO_OUT_NONE,
+	AUDIO_OUT_WAV,
+	AUDIO_OUT_RAW
+};
+
+static uint8_t audio_out;
+static FILE *audio_file;
+static uint32_t sample_rate, buffer_samples;
+static int16_t *mix_buffer;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t start_ns;
+uint32_t render_elapsed_ms(void)
+{
+	return (now_ns() - start_ns) / 1000000;
+}
+
+void render_sleep_ms(uint32_t delay)
+{
+	struct timespec ts = {
+		.tv_sec = delay / 1000,
+		.tv_nsec = (delay % 1000) * 1000000
+	};
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+	{
+	}
+}
+
+uint8_t render_is_audio_sync(void)
+{
+	//audio is mixed as soon as every source has filled a buffer, so it never needs to wait for a device
+	return 1;
+}
+
+uint8_t render_should_release_on_exit(void)
+{
+	return 1;
+}
+
+uint32_t render_min_buffered(void)
+{
+	return buffer_samples;
+}
+
+uint32_t render_audio_syncs_per_sec(void)
+{
+	return 0;
+}
+
+void render_buffer_consumed(audio_source *src)
+{
+}
+
+void *render_new_audio_opaque(void)
+{
+	return NULL;
+}
+
+void render_free_audio_opaque(void *opaque)
+{
+}
+
+void render_lock_audio(void)
+{
+}
+
+void render_unlock_audio(void)
+{
+}
+
+void render_audio_created(audio_source *src)
+{
+}
+
+void render_source_paused(audio_source *src, uint8_t remaining_sources)
+{
+}
+
+void render_source_resumed(audio_source *src)
+{
+}
+
+void render_do_audio_ready(audio_source *src)
+{
+	int16_t *tmp = src->front;
+	src->front = src->back;
+	src->back = tmp;
+	src->front_populated = 1;
+	src->buffer_pos = 0;
+	if (all_sources_ready()) {
+		mix_and_convert((unsigned char *)mix_buffer, buffer_samples * 2 * sizeof(int16_t), NULL);
+		if (audio_file) {
+			fwrite(mix_buffer, sizeof(int16_t), buffer_samples * 2, audio_file);
+		}
+	}
+}
+
+static void close_audio(void)
+{
+	if (!audio_file) {
+		return;
+	}
+	if (audio_out == AUDIO_OUT_WAV) {
+		wave_finalize(audio_file);
+	} else {
+		fclose(audio_file);
+	}
+	audio_file = NULL;
+}
+
+static void init_audio(void)
+{
+	char *rate_str = tern_find_path(config, "audio\0rate\0", TVAL_PTR).ptrval;
+	sample_rate = rate_str ? atoi(rate_str) : 0;
+	if (!sample_rate) {
+		sample_rate = 48000;
+	}
+	char *samples_str = tern_find_path(config, "audio\0buffer\0", TVAL_PTR).ptrval;
+	buffer_samples = samples_str ? atoi(samples_str) : 0;
+	if (!buffer_samples) {
+		buffer_samples = 512;
+	}
+	mix_buffer = realloc(mix_buffer, buffer_samples * 2 * sizeof(int16_t));
+
+	char *output = tern_find_path_default(config, "null_render\0audio\0", (tern_val){.ptrval = "none"}, TVAL_PTR).ptrval;
+	if (!strcmp(output, "wav")) {
+		audio_out = AUDIO_OUT_WAV;
+	} else if (!strcmp(output, "raw")) {
+		audio_out = AUDIO_OUT_RAW;
+	} else {
+		if (strcmp(output, "none")) {
+			warning("%s is not a valid value for null_render.audio, valid values are none, wav and raw\n", output);
+		}
+		audio_out = AUDIO_OUT_NONE;
+	}
+	if (audio_out != AUDIO_OUT_NONE) {
+		char *path = tern_find_path_default(config, "null_render\0audio_path\0", (tern_val){.ptrval = "blastem_audio.wav"}, TVAL_PTR).ptrval;
+		audio_file = fopen(path, "wb");
+		if (!audio_file) {
+			warning("Failed to open %s for writing audio\n", path);
+			audio_out = AUDIO_OUT_NONE;
+		} else if (audio_out == AUDIO_OUT_WAV && !wave_init(audio_file, sample_rate, 16, 2)) {
+			warning("Failed to write WAVE header to %s\n", path);
+			fclose(audio_file);
+			audio_file = NULL;
+			audio_out = AUDIO_OUT_NONE;
+		}
+	}
+	render_audio_initialized(RENDER_AUDIO_S16, sample_rate, 2, buffer_samples, sizeof(int16_t));
+}
+
+static void read_config(void)
+{
+	tern_node *video = tern_find_node(config, "video");
+	if (video)
+	{
+		for (int i = 0; i < NUM_VID_STD; i++)
+		{
+			tern_node *std_settings = tern_find_node(video, vid_std_names[i]);
+			if (std_settings) {
+				char *val = tern_find_path_default(std_settings, "overscan\0top\0", (tern_val){.ptrval = NULL}, TVAL_PTR).ptrval;
+				if (val) {
+					overscan_top[i] = atoi(val);
+				}
+				val = tern_find_path_default(std_settings, "overscan\0bottom\0", (tern_val){.ptrval = NULL}, TVAL_PTR).ptrval;
+				if (val) {
+					overscan_bot[i] = atoi(val);
+				}
+				val = tern_find_path_default(std_settings, "overscan\0left\0", (tern_val){.ptrval = NULL}, TVAL_PTR).ptrval;
+				if (val) {
+					overscan_left[i] = atoi(val);
+				}
+				val = tern_find_path_default(std_settings, "overscan\0right\0", (tern_val){.ptrval = NULL}, TVAL_PTR).ptrval;
+				if (val) {
+					overscan_right[i] = atoi(val);
+				}
+			}
+		}
+	}
+	char *sync = tern_find_path_default(config, "null_render\0sync\0", (tern_val){.ptrval = "unthrottled"}, TVAL_PTR).ptrval;
+	if (!strcmp(sync, "realtime")) {
+		throttle = 1;
+	} else {
+		if (strcmp(sync, "unthrottled")) {
+			warning("%s is not a valid value for null_render.sync, valid values are realtime and unthrottled\n", sync);
+		}
+		throttle = 0;
+	}
+	char *frames = tern_find_path(config, "null_render\0frames\0", TVAL_PTR).ptrval;
+	max_frames = frames ? atoi(frames) : 0;
+}
+
+void render_init(int width, int height, char * title, uint8_t fullscreen)
+{
+	start_ns = now_ns();
+	read_config();
+	init_audio();
+	render_set_video_standard(VID_NTSC);
+	atexit(close_audio);
+#ifndef DISABLE_ZLIB
+	char *video_path = tern_find_path(config, "null_render\0video_path\0", TVAL_PTR).ptrval;
+	if (video_path && !recorder_start(video_path)) {
+		warning("Failed to open %s for writing video\n", video_path);
+	}
+#endif
+}
+
+void render_config_updated(void)
+{
+	close_audio();
+	read_config();
+	init_audio();
+}
+
+void render_set_video_standard(vid_std std)
+{
+	video_standard = std;
+	next_frame_ns = 0;
+}
+
+uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b)
+{
+	return 255 << 24 | r << 16 | g << 8 | b;
+}
+
+static char *screenshot_path;
+void render_save_screenshot(char *path)
+{
+	if (screenshot_path) {
+		free(screenshot_path);
+	}
+	screenshot_path = path;
+}
+
+uint8_t render_create_window(char *caption, uint32_t width, uint32_t height, window_close_handler close_handler)
+{
+	//there's nowhere to show debug windows
+	return 0;
+}
+
+void render_destroy_window(uint8_t which)
+{
+}
+
+uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
+{
+	*pitch = LINEBUF_SIZE * sizeof(uint32_t);
+	return framebuffers[which == FRAMEBUFFER_EVEN];
+}
+
+void render_framebuffer_dirty_lines(uint8_t which, uint32_t first_line, uint32_t last_line)
+{
+}
+
+framebuffer_format render_framebuffer_format(void)
+{
+	return FRAMEBUFFER_XRGB8888;
+}
+
+uint32_t *render_get_palettes(uint8_t which, int *pitch)
+{
+	//FRAMEBUFFER_INDEXED8 is never reported
+	*pitch = 0;
+	return NULL;
+}
+
+static void save_screenshot(uint32_t *buffer, int width)
+{
+	FILE *f = fopen(screenshot_path, "wb");
+	if (!f) {
+		warning("Failed to open screenshot file %s for writing\n", screenshot_path);
+	} else {
+		debug_message("Saving screenshot to %s\n", screenshot_path);
+		uint32_t height = video_standard == VID_NTSC ? 243 : 294;
+#ifndef DISABLE_ZLIB
+		char *ext = path_extension(screenshot_path);
+		if (ext && !strcasecmp(ext, "png")) {
+			save_png(f, buffer, width, height, LINEBUF_SIZE*sizeof(uint32_t));
+		} else {
+#endif
+			save_ppm(f, buffer, width, height, LINEBUF_SIZE*sizeof(uint32_t));
+#ifndef DISABLE_ZLIB
+		}
+		free(ext);
+#endif
+		fclose(f);
+	}
+	free(screenshot_path);
+	screenshot_path = NULL;
+}
+
+void render_framebuffer_updated(uint8_t which, int width)
+{
+	if (which > FRAMEBUFFER_EVEN) {
+		return;
+	}
+	last_width = width;
+#ifndef DISABLE_ZLIB
+	if (recorder_running()) {
+		uint32_t height = (video_standard == VID_NTSC ? 243 : 294) - overscan_top[video_standard] - overscan_bot[video_standard];
+		uint32_t *src = framebuffers[which] + overscan_left[video_standard] + overscan_top[video_standard] * LINEBUF_SIZE;
+		recorder_video_frame(src, width - overscan_left[video_standard] - overscan_right[video_standard], height, LINEBUF_SIZE * sizeof(uint32_t), video_standard);
+	}
+#endif
+	if (screenshot_path && which == FRAMEBUFFER_ODD) {
+		save_screenshot(framebuffers[0], width);
+	}
+	if (throttle) {
+		uint64_t frame_ns = 1000000000ULL / (video_standard == VID_PAL ? 50 : 60);
+		uint64_t now = now_ns();
+		if (!next_frame_ns || now > next_frame_ns + frame_ns) {
+			//first frame or we've fallen too far behind to catch up
+			next_frame_ns = now;
+		} else if (now < next_frame_ns) {
+			struct timespec ts = {
+				.tv_sec = (next_frame_ns - now) / 1000000000ULL,
+				.tv_nsec = (next_frame_ns - now) % 1000000000ULL
+			};
+			while (nanosleep(&ts, &ts) && errno == EINTR)
+			{
+			}
+		}
+		next_frame_ns += frame_ns;
+	}
+	frames_shown++;
+	if (max_frames && frames_shown >= max_frames) {
+		exit(0);
+	}
+}
+
+void render_video_loop(void)
+{
+}
+
+void render_video_stats(uint32_t *dropped, uint32_t *repeated)
+{
+	*dropped = *repeated = 0;
+}
+
+uint8_t render_get_active_framebuffer(void)
+{
+	return FRAMEBUFFER_ODD;
+}
+
+uint32_t render_emulated_width()
+{
+	return last_width - overscan_left[video_standard] - overscan_right[video_standard];
+}
+
+uint32_t render_emulated_height()
+{
+	return (video_standard == VID_NTSC ? 243 : 294) - overscan_top[video_standard] - overscan_bot[video_standard];
+}
+
+uint32_t render_overscan_left()
+{
+	return overscan_left[video_standard];
+}
+
+uint32_t render_overscan_top()
+{
+	return overscan_top[video_standard];
+}
+
+uint32_t render_overscan_bot()
+{
+	return overscan_bot[video_standard];
+}
+
+int render_width()
+{
+	return render_emulated_width();
+}
+
+int render_height()
+{
+	return render_emulated_height();
+}
+
+int render_fullscreen()
+{
+	return 0;
+}
+
+void render_toggle_fullscreen()
+{
+}
+
+void render_update_caption(char *title)
+{
+}
+
+void render_wait_quit(void)
+{
+}
+
+void process_events()
+{
+}
+
+void render_set_drag_drop_handler(drop_handler handler)
+{
+}
+
+void render_set_external_sync(uint8_t ext_sync_on)
+{
+}
+
+void render_reset_mappings(void)
+{
+}
+
+void render_set_gl_context_handlers(ui_render_fun destroy, ui_render_fun create)
+{
+}
+
+void render_set_ui_render_fun(ui_render_fun fun)
+{
+}
+
+void render_set_ui_fb_resize_handler(ui_render_fun resize)
+{
+}
+
+uint8_t render_has_gl(void)
+{
+	return 0;
+}
+
+int32_t render_translate_input_name(int32_t controller, char *name, uint8_t is_axis)
+{
+	return RENDER_NOT_PLUGGED_IN;
+}
+
+int32_t render_dpad_part(int32_t input)
+{
+	return input >> 4 & 0xFFFFFF;
+}
+
+uint8_t render_direction_part(int32_t input)
+{
+	return input & 0xF;
+}
+
+int32_t render_axis_part(int32_t input)
+{
+	return input & 0xFFFFFFF;
+}
+
+char* render_joystick_type_id(int index)
+{
+	return strdup("");
+}
+
+void render_errorbox(char *title, char *message)
+{
+}
+
+void render_warnbox(char *title, char *message)
+{
+}
+
+void render_infobox(char *title, char *message)
+{
+}
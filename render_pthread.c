@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "render.h"
+
+//thread and semaphore functions from render.h for the backends that don't use SDL
+
+typedef struct {
+	render_thread_fun fun;
+	void              *data;
+} thread_start;
+
+static void *thread_trampoline(void *vstart)
+{
+	thread_start start = *(thread_start *)vstart;
+	free(vstart);
+	start.fun(start.data);
+	return NULL;
+}
+
+uint8_t render_create_thread(render_thread *thread, const char *name, render_thread_fun fun, void *data)
+{
+	thread_start *start = malloc(sizeof(thread_start));
+	start->fun = fun;
+	start->data = data;
+	if (pthread_create(thread, NULL, thread_trampoline, start)) {
+		free(start);
+		return 0;
+	}
+	return 1;
+}
+
+void render_wait_thread(render_thread thread)
+{
+	pthread_join(thread, NULL);
+}
+
+render_semaphore render_create_semaphore(uint32_t initial_value)
+{
+	sem_t *sem = malloc(sizeof(sem_t));
+	if (sem_init(sem, 0, initial_value)) {
+		free(sem);
+		return NULL;
+	}
+	return sem;
+}
+
+void render_destroy_semaphore(render_semaphore sem)
+{
+	sem_destroy(sem);
+	free(sem);
+}
+
+void render_semaphore_wait(render_semaphore sem)
+{
+	while (sem_wait(sem) && errno == EINTR)
+	{
+	}
+}
+
+uint8_t render_semaphore_try_wait(render_semaphore sem)
+{
+	return !sem_trywait(sem);
+}
+
+void render_semaphore_post(render_semaphore sem)
+{
+	sem_post(sem);
+}
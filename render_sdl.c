@@ -18,6 +18,10 @@
 #include "png.h"
 #include "config.h"
 #include "controller_info.h"
+#include "telemetry.h"
+#ifndef DISABLE_ZLIB
+#include "recorder.h"
+#endif
 
 #ifndef DISABLE_OPENGL
 #ifdef USE_GLES
@@ -46,8 +50,9 @@ static uint8_t scanlines = 0;
 
 static uint32_t last_frame = 0;
 
-static SDL_mutex *audio_mutex, *frame_mutex, *free_buffer_mutex;
-static SDL_cond *audio_ready, *frame_ready;
+static SDL_mutex *audio_mutex;
+static SDL_cond *audio_ready;
+static SDL_sem *frame_ready;
 static uint8_t quitting = 0;
 
 enum {
@@ -60,9 +65,43 @@ enum {
 static uint8_t sync_src;
 static uint32_t min_buffered;
 
-uint32_t **frame_buffers;
-uint32_t num_buffers;
-uint32_t buffer_storage;
+//When the emulator runs on its own thread, frames are handed to the video thread through one mailbox per
+//framebuffer. Each mailbox has three buffers: one the emulator draws into, one the video thread shows and one
+//in between. Publishing a frame or taking the newest one is a single atomic exchange of the one in between,
+//so neither thread ever waits for the other. A frame replaced before the video thread gets to it is dropped.
+#define MAILBOX_FRESH 0x80
+#define MAILBOX_INDEX 0x03
+typedef struct {
+	uint32_t *buffers[3];
+	uint32_t sequence[3]; //publish order, keeps odd and even fields in order
+	uint32_t dirty[3];    //lines changed since the last frame the video thread could have shown
+	int      width[3];
+	uint8_t  which;
+	uint8_t  draw;        //only touched by the emulation thread
+	uint8_t  show;        //only touched by the video thread
+	uint8_t  middle;      //exchanged atomically, MAILBOX_FRESH is set while it holds an unshown frame
+} frame_mailbox;
+
+//ranges of changed lines are packed as first << 16 | last
+#define DIRTY_NONE 0xFFFF0000
+#define DIRTY_ALL  0x0000FFFF
+static uint32_t dirty_union(uint32_t a, uint32_t b)
+{
+	uint32_t first = (a >> 16) < (b >> 16) ? a >> 16 : b >> 16;
+	uint32_t last = (a & 0xFFFF) > (b & 0xFFFF) ? a & 0xFFFF : b & 0xFFFF;
+	return first << 16 | last;
+}
+
+static frame_mailbox *mailboxes[256];
+static uint32_t publish_sequence;
+static uint32_t frames_dropped, frames_repeated;
+static uint8_t repeat_frames;
+
+void render_video_stats(uint32_t *dropped, uint32_t *repeated)
+{
+	*dropped = __atomic_load_n(&frames_dropped, __ATOMIC_RELAXED);
+	*repeated = __atomic_load_n(&frames_repeated, __ATOMIC_RELAXED);
+}
 
 uint32_t render_min_buffered(void)
 {
@@ -193,7 +232,7 @@ void render_source_paused(audio_source *src, uint8_t remaining_sources)
 	if (!remaining_sources && render_is_audio_sync()) {
 		SDL_PauseAudio(1);
 		if (sync_src == SYNC_AUDIO_THREAD) {
-			SDL_CondSignal(frame_ready);
+			SDL_SemPost(frame_ready);
 		}
 	}
 }
@@ -380,6 +419,8 @@ static GLuint load_shader(char * fname, GLenum shader_type)
 #endif
 
 static uint32_t texture_buf[512 * 513];
+//cleared whenever the field textures are recreated so the next frame is uploaded in full
+static uint8_t textures_valid[2];
 #ifdef DISABLE_OPENGL
 #define RENDER_FORMAT SDL_PIXELFORMAT_ARGB8888
 #else
@@ -407,6 +448,7 @@ static void gl_setup()
 		tex_width = tex_height = 512;
 	}
 	printf("Using %dx%d textures\n", tex_width, tex_height);
+	textures_valid[FRAMEBUFFER_ODD] = textures_valid[FRAMEBUFFER_EVEN] = 0;
 	for (int i = 0; i < 3; i++)
 	{
 		glBindTexture(GL_TEXTURE_2D, textures[i]);
@@ -1014,14 +1056,9 @@ void window_setup(void)
 		}
 	}
 	
-	if (!num_buffers && (sync_src == SYNC_AUDIO_THREAD || sync_src == SYNC_EXTERNAL)) {
-		frame_mutex = SDL_CreateMutex();
-		free_buffer_mutex = SDL_CreateMutex();
-		frame_ready = SDL_CreateCond();
-		buffer_storage = 4;
-		frame_buffers = calloc(buffer_storage, sizeof(uint32_t*));
-		frame_buffers[0] = texture_buf;
-		num_buffers = 1;
+	if (!frame_ready && (sync_src == SYNC_AUDIO_THREAD || sync_src == SYNC_EXTERNAL)) {
+		frame_ready = SDL_CreateSemaphore(0);
+		repeat_frames = !strcmp("repeat", tern_find_path_default(config, "video\0frame_policy\0", (tern_val){.ptrval = "latest"}, TVAL_PTR).ptrval);
 	}
 	
 	const char *vsync;
@@ -1409,22 +1446,35 @@ void render_destroy_window(uint8_t which)
 	extra_windows[win_idx] = NULL;
 }
 
+static frame_mailbox *get_mailbox(uint8_t which)
+{
+	frame_mailbox *mb = mailboxes[which];
+	if (!mb) {
+		mb = calloc(1, sizeof(frame_mailbox));
+		for (int i = 0; i < 3; i++)
+		{
+			mb->buffers[i] = calloc(tex_width*(tex_height + 1), sizeof(uint32_t));
+		}
+		mb->which = which;
+		mb->draw = 0;
+		mb->middle = 1;
+		mb->show = 2;
+		__atomic_store_n(mailboxes + which, mb, __ATOMIC_RELEASE);
+	}
+	return mb;
+}
+
 uint32_t *locked_pixels;
 uint32_t locked_pitch;
-uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
+//buffer and pitch last handed out for each field so the recorder can read back what was drawn
+static uint32_t *field_buffer[2];
+static int field_pitch[2];
+static uint32_t *get_framebuffer(uint8_t which, int *pitch)
 {
 	if (sync_src == SYNC_AUDIO_THREAD || sync_src == SYNC_EXTERNAL) {
 		*pitch = LINEBUF_SIZE * sizeof(uint32_t);
-		uint32_t *buffer;
-		SDL_LockMutex(free_buffer_mutex);
-			if (num_buffers) {
-				buffer = frame_buffers[--num_buffers];
-			} else {
-				buffer = calloc(tex_width*(tex_height + 1), sizeof(uint32_t));
-			}
-		SDL_UnlockMutex(free_buffer_mutex);
-		locked_pixels = buffer;
-		return buffer;
+		frame_mailbox *mb = get_mailbox(which);
+		return mb->buffers[mb->draw];
 	}
 #ifndef DISABLE_OPENGL
 	if (render_gl && which <= FRAMEBUFFER_EVEN) {
@@ -1462,15 +1512,14 @@ uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
 #endif
 }
 
-static void release_buffer(uint32_t *buffer)
+uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
 {
-	SDL_LockMutex(free_buffer_mutex);
-		if (num_buffers == buffer_storage) {
-			buffer_storage *= 2;
-			frame_buffers = realloc(frame_buffers, sizeof(uint32_t*)*buffer_storage);
-		}
-		frame_buffers[num_buffers++] = buffer;
-	SDL_UnlockMutex(free_buffer_mutex);
+	uint32_t *buffer = get_framebuffer(which, pitch);
+	if (which <= FRAMEBUFFER_EVEN) {
+		field_buffer[which] = buffer;
+		field_pitch[which] = *pitch;
+	}
+	return buffer;
 }
 
 uint8_t events_processed;
@@ -1482,19 +1531,43 @@ uint8_t events_processed;
 
 static uint32_t last_width, last_height;
 static uint8_t interlaced;
-static void process_framebuffer(uint32_t *buffer, uint8_t which, int width)
+static uint32_t elapsed_us(uint64_t start, uint64_t end)
+{
+	return (end - start) * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+static void record_telemetry(uint64_t present_start)
+{
+	static uint32_t last_dropped, last_repeated;
+	uint32_t dropped, repeated;
+	render_video_stats(&dropped, &repeated);
+	telemetry_frame_presented(SDL_GetTicks(), elapsed_us(present_start, SDL_GetPerformanceCounter()), dropped - last_dropped, repeated - last_repeated);
+	last_dropped = dropped;
+	last_repeated = repeated;
+}
+
+static void process_framebuffer(uint32_t *buffer, uint8_t which, int width, uint32_t dirty)
 {
 	static uint8_t last;
+	//lines changed in frames that were skipped still need to be uploaded with the next one
+	static uint32_t skipped_dirty[2] = {DIRTY_NONE, DIRTY_NONE};
+	if (which <= FRAMEBUFFER_EVEN) {
+		dirty = dirty_union(dirty, skipped_dirty[which]);
+		skipped_dirty[which] = DIRTY_NONE;
+	}
 	if (sync_src == SYNC_VIDEO && which <= FRAMEBUFFER_EVEN && source_frame_count < 0) {
+		skipped_dirty[which] = dirty;
 		source_frame++;
 		if (source_frame >= source_hz) {
 			source_frame = 0;
 		}
 		source_frame_count = frame_repeat[source_frame];
+		__atomic_add_fetch(&frames_dropped, 1, __ATOMIC_RELAXED);
 		//TODO: Figure out what to do about SDL Render API texture locking
 		return;
 	}
 	
+	uint64_t present_start = SDL_GetPerformanceCounter();
 	last_width = width;
 	uint32_t height = which <= FRAMEBUFFER_EVEN 
 		? (video_standard == VID_NTSC ? 243 : 294) - (overscan_top[video_standard] + overscan_bot[video_standard])
@@ -1523,7 +1596,27 @@ static void process_framebuffer(uint32_t *buffer, uint8_t which, int width)
 	if (render_gl && which <= FRAMEBUFFER_EVEN) {
 		SDL_GL_MakeCurrent(main_window, main_context);
 		glBindTexture(GL_TEXTURE_2D, textures[which]);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LINEBUF_SIZE, height, SRC_FORMAT, GL_UNSIGNED_BYTE, buffer + overscan_left[video_standard] + LINEBUF_SIZE * overscan_top[video_standard]);
+		static uint32_t uploaded_width[2], uploaded_height[2];
+		static vid_std uploaded_std[2];
+		if (!textures_valid[which] || uploaded_width[which] != width || uploaded_height[which] != height || uploaded_std[which] != video_standard) {
+			dirty = DIRTY_ALL;
+			textures_valid[which] = 1;
+			uploaded_width[which] = width;
+			uploaded_height[which] = height;
+			uploaded_std[which] = video_standard;
+		}
+		//only upload the texture rows that changed since this field was last uploaded
+		int32_t first = (int32_t)(dirty >> 16) - overscan_top[video_standard];
+		int32_t last_line = (int32_t)(dirty & 0xFFFF) - overscan_top[video_standard];
+		if (first < 0) {
+			first = 0;
+		}
+		if (last_line >= (int32_t)height) {
+			last_line = height - 1;
+		}
+		if (first <= last_line) {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, LINEBUF_SIZE, last_line - first + 1, SRC_FORMAT, GL_UNSIGNED_BYTE, buffer + overscan_left[video_standard] + LINEBUF_SIZE * (overscan_top[video_standard] + first));
+		}
 		
 		if (screenshot_file) {
 			//properly supporting interlaced modes here is non-trivial, so only save the odd field for now
@@ -1678,52 +1771,110 @@ static void process_framebuffer(uint32_t *buffer, uint8_t which, int width)
 		}
 		source_frame_count = frame_repeat[source_frame];
 	}
+	if (which <= FRAMEBUFFER_EVEN) {
+		record_telemetry(present_start);
+	}
 }
 
-typedef struct {
-	uint32_t *buffer;
-	int      width;
-	uint8_t  which;
-} frame;
-frame frame_queue[4];
-int frame_queue_len, frame_queue_read, frame_queue_write;
+static uint32_t reported_dirty[2];
+static uint8_t dirty_reported[2];
+void render_framebuffer_dirty_lines(uint8_t which, uint32_t first_line, uint32_t last_line)
+{
+	if (which > FRAMEBUFFER_EVEN) {
+		return;
+	}
+	if (first_line > last_line) {
+		reported_dirty[which] = DIRTY_NONE;
+	} else {
+		reported_dirty[which] = (first_line > 0xFFFF ? 0xFFFF : first_line) << 16 | (last_line > 0xFFFF ? 0xFFFF : last_line);
+	}
+	dirty_reported[which] = 1;
+}
 
+framebuffer_format render_framebuffer_format(void)
+{
+	return FRAMEBUFFER_XRGB8888;
+}
+
+uint32_t *render_get_palettes(uint8_t which, int *pitch)
+{
+	//FRAMEBUFFER_INDEXED8 is never reported
+	*pitch = 0;
+	return NULL;
+}
+
+static uint64_t emulation_start;
 void render_framebuffer_updated(uint8_t which, int width)
 {
+	uint32_t dirty = DIRTY_ALL;
+	if (which <= FRAMEBUFFER_EVEN && dirty_reported[which]) {
+		dirty = reported_dirty[which];
+		dirty_reported[which] = 0;
+	}
+#ifndef DISABLE_ZLIB
+	if (which <= FRAMEBUFFER_EVEN && recorder_running() && field_buffer[which]) {
+		uint32_t height = (video_standard == VID_NTSC ? 243 : 294) - overscan_top[video_standard] - overscan_bot[video_standard];
+		uint32_t *src = field_buffer[which] + overscan_left[video_standard] + overscan_top[video_standard] * field_pitch[which] / sizeof(uint32_t);
+		recorder_video_frame(src, width - overscan_left[video_standard] - overscan_right[video_standard], height, field_pitch[which], video_standard);
+	}
+#endif
+	if (which <= FRAMEBUFFER_EVEN) {
+		uint64_t now = SDL_GetPerformanceCounter();
+		if (emulation_start) {
+			telemetry_emulation_time(elapsed_us(emulation_start, now));
+		}
+		emulation_start = now;
+	}
 	if (sync_src == SYNC_AUDIO_THREAD || sync_src == SYNC_EXTERNAL) {
-		SDL_LockMutex(frame_mutex);
-			while (frame_queue_len == 4) {
-				SDL_CondSignal(frame_ready);
-				SDL_UnlockMutex(frame_mutex);
-				SDL_Delay(1);
-				SDL_LockMutex(frame_mutex);
-			}
-			for (int cur = frame_queue_read, i = 0; i < frame_queue_len; i++) {
-				if (frame_queue[cur].which == which) {
-					int last = (frame_queue_write - 1) & 3;
-					frame_queue_len--;
-					release_buffer(frame_queue[cur].buffer);
-					if (last != cur) {
-						frame_queue[cur] = frame_queue[last];
-					}
-					frame_queue_write = last;
-					break;
-				}
-				cur = (cur + 1) & 3;
-			}
-			frame_queue[frame_queue_write++] = (frame){
-				.buffer = locked_pixels,
-				.width = width,
-				.which = which
-			};
-			frame_queue_write &= 0x3;
-			frame_queue_len++;
-			SDL_CondSignal(frame_ready);
-		SDL_UnlockMutex(frame_mutex);
+		frame_mailbox *mb = get_mailbox(which);
+		mb->width[mb->draw] = width;
+		mb->sequence[mb->draw] = ++publish_sequence;
+		uint8_t old = __atomic_load_n(&mb->middle, __ATOMIC_ACQUIRE);
+		do {
+			//if the frame being replaced never gets shown, the lines it changed have to be carried over to this one
+			//only the video thread can take it in the meantime, so this retries at most once
+			mb->dirty[mb->draw] = (old & MAILBOX_FRESH) ? dirty_union(dirty, mb->dirty[old & MAILBOX_INDEX]) : dirty;
+		} while (!__atomic_compare_exchange_n(&mb->middle, &old, mb->draw | MAILBOX_FRESH, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+		if (old & MAILBOX_FRESH) {
+			__atomic_add_fetch(&frames_dropped, 1, __ATOMIC_RELAXED);
+		}
+		mb->draw = old & MAILBOX_INDEX;
+		SDL_SemPost(frame_ready);
 		return;
 	}
 	//TODO: Maybe fixme for render API
-	process_framebuffer(texture_buf, which, width);
+	process_framebuffer(texture_buf, which, width, dirty);
+	if (which <= FRAMEBUFFER_EVEN) {
+		//presenting happens on this thread, so don't count it as emulation time
+		emulation_start = SDL_GetPerformanceCounter();
+	}
+}
+
+//takes the newest frame from each mailbox that has one and shows them in the order they were published
+static uint8_t show_fresh_frames(void)
+{
+	frame_mailbox *fresh[256];
+	int num_fresh = 0;
+	for (int i = 0; i < 256; i++)
+	{
+		frame_mailbox *mb = __atomic_load_n(mailboxes + i, __ATOMIC_ACQUIRE);
+		if (!mb || !(__atomic_load_n(&mb->middle, __ATOMIC_RELAXED) & MAILBOX_FRESH)) {
+			continue;
+		}
+		mb->show = __atomic_exchange_n(&mb->middle, mb->show, __ATOMIC_ACQ_REL) & MAILBOX_INDEX;
+		int pos = num_fresh++;
+		for (; pos && fresh[pos-1]->sequence[fresh[pos-1]->show] > mb->sequence[mb->show]; pos--)
+		{
+			fresh[pos] = fresh[pos-1];
+		}
+		fresh[pos] = mb;
+	}
+	for (int i = 0; i < num_fresh; i++)
+	{
+		frame_mailbox *mb = fresh[i];
+		process_framebuffer(mb->buffers[mb->show], mb->which, mb->width[mb->show], mb->dirty[mb->show]);
+	}
+	return num_fresh;
 }
 
 void render_video_loop(void)
@@ -1732,29 +1883,23 @@ void render_video_loop(void)
 		return;
 	}
 	SDL_PauseAudio(0);
-	SDL_LockMutex(frame_mutex);
-		for(;;)
-		{
-			while (!frame_queue_len && SDL_GetAudioStatus() == SDL_AUDIO_PLAYING)
-			{
-				SDL_CondWait(frame_ready, frame_mutex);
-			}
-			while (frame_queue_len)
-			{
-				frame f = frame_queue[frame_queue_read++];
-				frame_queue_read &= 0x3;
-				frame_queue_len--;
-				SDL_UnlockMutex(frame_mutex);
-				process_framebuffer(f.buffer, f.which, f.width);
-				release_buffer(f.buffer);
-				SDL_LockMutex(frame_mutex);
-			}
-			if (SDL_GetAudioStatus() != SDL_AUDIO_PLAYING) {
-				break;
+	uint8_t shown_any = 0;
+	while (SDL_GetAudioStatus() == SDL_AUDIO_PLAYING)
+	{
+		if (repeat_frames && shown_any) {
+			//show the last frame again if a new one doesn't arrive in time for the next refresh
+			if (SDL_SemWaitTimeout(frame_ready, 1000 / (display_hz ? display_hz : 60)) == SDL_MUTEX_TIMEDOUT) {
+				__atomic_add_fetch(&frames_repeated, 1, __ATOMIC_RELAXED);
+				render_update_display();
+				continue;
 			}
+		} else {
+			SDL_SemWait(frame_ready);
 		}
-	
-	SDL_UnlockMutex(frame_mutex);
+		shown_any |= show_fresh_frames();
+	}
+	//anything published after the last wakeup
+	show_fresh_frames();
 }
 
 static ui_render_fun render_ui;
@@ -2063,3 +2208,33 @@ uint8_t render_create_thread(render_thread *thread, const char *name, render_thr
 	*thread = SDL_CreateThread(fun, name, data);
 	return *thread != 0;
 }
+
+void render_wait_thread(render_thread thread)
+{
+	SDL_WaitThread(thread, NULL);
+}
+
+render_semaphore render_create_semaphore(uint32_t initial_value)
+{
+	return SDL_CreateSemaphore(initial_value);
+}
+
+void render_destroy_semaphore(render_semaphore sem)
+{
+	SDL_DestroySemaphore(sem);
+}
+
+void render_semaphore_wait(render_semaphore sem)
+{
+	SDL_SemWait(sem);
+}
+
+uint8_t render_semaphore_try_wait(render_semaphore sem)
+{
+	return !SDL_SemTryWait(sem);
+}
+
+void render_semaphore_post(render_semaphore sem)
+{
+	SDL_SemPost(sem);
+}
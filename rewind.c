@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+#include "render.h"
+#include "util.h"
+
+//Snapshots are stored newest to oldest as deltas: each entry holds the XOR of its state with the
+//state of the entry before it, with runs of zero bytes encoded as counts. Stepping back XORs the
+//newest delta into the most recent full state to get the one before it, so only one full state is
+//kept in memory. The oldest entries are dropped as the ring fills up.
+
+//zero runs shorter than this are cheaper to store as part of a literal run
+#define MIN_ZERO_RUN 4
+
+typedef struct {
+	uint32_t offset;
+	uint32_t length;
+	uint32_t prev_size; //size of the state this delta takes latest back to
+} rewind_entry;
+
+struct rewind_buffer {
+	uint8_t          *storage;
+	uint8_t          *latest;   //full copy of the state of the newest entry
+	uint8_t          *scratch;  //delta being compressed
+	uint8_t          *pending;  //raw state waiting for the compressor
+	rewind_entry     *entries;
+	uint32_t         capacity;
+	uint32_t         num_slots;
+	uint32_t         first;
+	uint32_t         count;
+	uint32_t         head;
+	uint32_t         latest_size;
+	uint32_t         latest_capacity;
+	uint32_t         scratch_capacity;
+	uint32_t         pending_size;
+	uint32_t         interval;
+	uint32_t         frames;
+	uint8_t          capture_pending;
+	uint8_t          loaded_latest;
+	uint8_t          exit;
+#ifndef IS_LIB
+	uint8_t          threaded;
+	render_thread    thread;
+	render_semaphore idle;      //held by whichever thread owns everything except pending
+	render_semaphore work_ready;
+#endif
+};
+
+static uint8_t *put_count(uint8_t *dst, uint32_t count)
+{
+	while (count >= 0x80)
+	{
+		*(dst++) = count | 0x80;
+		count >>= 7;
+	}
+	*(dst++) = count;
+	return dst;
+}
+
+static uint8_t *get_count(uint8_t *src, uint8_t *end, uint32_t *count)
+{
+	uint32_t val = 0;
+	for (int shift = 0; src < end && shift < 32; shift += 7)
+	{
+		uint8_t byte = *(src++);
+		val |= (byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			break;
+		}
+	}
+	*count = val;
+	return src;
+}
+
+//encodes cur XOR prev as alternating zero run and literal counts followed by the literal bytes
+static uint32_t compress_delta(uint8_t *dst, uint8_t *cur, uint8_t *prev, uint32_t size)
+{
+	uint8_t *out = dst;
+	uint32_t pos = 0;
+	while (pos < size)
+	{
+		uint32_t zero_start = pos;
+		while (pos < size && cur[pos] == prev[pos])
+		{
+			pos++;
+		}
+		uint32_t lit_start = pos;
+		uint32_t zeros = 0;
+		while (pos < size)
+		{
+			if (cur[pos] == prev[pos]) {
+				if (++zeros == MIN_ZERO_RUN) {
+					pos -= MIN_ZERO_RUN - 1;
+					break;
+				}
+			} else {
+				zeros = 0;
+			}
+			pos++;
+		}
+		if (pos == size) {
+			//don't bother storing trailing zeros as literals
+			while (pos > lit_start && cur[pos-1] == prev[pos-1])
+			{
+				pos--;
+			}
+		}
+		out = put_count(out, lit_start - zero_start);
+		out = put_count(out, pos - lit_start);
+		for (uint32_t i = lit_start; i < pos; i++)
+		{
+			*(out++) = cur[i] ^ prev[i];
+		}
+		if (pos == lit_start) {
+			//only zeros were left
+			break;
+		}
+	}
+	return out - dst;
+}
+
+static void apply_delta(uint8_t *dst, uint32_t dst_size, uint8_t *src, uint32_t length)
+{
+	uint8_t *end = src + length;
+	uint32_t pos = 0;
+	while (src < end)
+	{
+		uint32_t zeros, literals;
+		src = get_count(src, end, &zeros);
+		src = get_count(src, end, &literals);
+		pos += zeros;
+		if (literals > end - src || pos > dst_size || literals > dst_size - pos) {
+			fatal_error("Corrupt rewind delta\n");
+		}
+		for (uint8_t *lit_end = src + literals; src < lit_end; src++, pos++)
+		{
+			dst[pos] ^= *src;
+		}
+	}
+}
+
+static void drop_oldest(rewind_buffer *rw)
+{
+	rw->first = (rw->first + 1) % rw->num_slots;
+	rw->count--;
+}
+
+static uint8_t overlaps_oldest(rewind_buffer *rw, uint32_t offset, uint32_t length)
+{
+	rewind_entry *oldest = rw->entries + rw->first;
+	return oldest->offset < offset + length && offset < oldest->offset + oldest->length;
+}
+
+static void store_delta(rewind_buffer *rw, uint32_t length, uint32_t prev_size)
+{
+	if (length > rw->capacity) {
+		//snapshot is larger than the whole buffer, history can't continue past this point
+		rw->count = 0;
+		return;
+	}
+	if (rw->head + length > rw->capacity) {
+		//anything between head and the end of the buffer is older than what's at the start
+		while (rw->count && rw->entries[rw->first].offset >= rw->head)
+		{
+			drop_oldest(rw);
+		}
+		rw->head = 0;
+	}
+	while (rw->count && (rw->count == rw->num_slots || overlaps_oldest(rw, rw->head, length)))
+	{
+		drop_oldest(rw);
+	}
+	rewind_entry *entry = rw->entries + (rw->first + rw->count) % rw->num_slots;
+	entry->offset = rw->head;
+	entry->length = length;
+	entry->prev_size = prev_size;
+	memcpy(rw->storage + rw->head, rw->scratch, length);
+	rw->head += length;
+	rw->count++;
+}
+
+static void ensure_latest(rewind_buffer *rw, uint32_t size)
+{
+	if (size > rw->latest_capacity) {
+		rw->latest = realloc(rw->latest, size);
+		memset(rw->latest + rw->latest_capacity, 0, size - rw->latest_capacity);
+		rw->latest_capacity = size;
+	}
+	//worst case is a literal run broken up by short zero runs
+	uint32_t worst = size + size / MIN_ZERO_RUN * 2 + 16;
+	if (worst > rw->scratch_capacity) {
+		rw->scratch = realloc(rw->scratch, worst);
+		rw->scratch_capacity = worst;
+	}
+}
+
+static void compress_pending(rewind_buffer *rw)
+{
+	uint32_t size = rw->pending_size;
+	ensure_latest(rw, size);
+	//latest is zero past latest_size so comparing over the larger of the two sizes restores both
+	uint32_t delta_size = size > rw->latest_size ? size : rw->latest_size;
+	if (size < delta_size) {
+		rw->pending = realloc(rw->pending, delta_size);
+		memset(rw->pending + size, 0, delta_size - size);
+	}
+	uint32_t length = compress_delta(rw->scratch, rw->pending, rw->latest, delta_size);
+	store_delta(rw, length, rw->latest_size);
+	memcpy(rw->latest, rw->pending, delta_size);
+	rw->latest_size = size;
+	free(rw->pending);
+	rw->pending = NULL;
+}
+
+#ifndef IS_LIB
+static int rewind_thread(void *vrw)
+{
+	rewind_buffer *rw = vrw;
+	for (;;)
+	{
+		render_semaphore_wait(rw->work_ready);
+		if (rw->exit) {
+			break;
+		}
+		compress_pending(rw);
+		render_semaphore_post(rw->idle);
+	}
+	return 0;
+}
+#endif
+
+rewind_buffer *rewind_alloc(uint32_t capacity, uint32_t interval)
+{
+	rewind_buffer *rw = calloc(1, sizeof(rewind_buffer));
+	rw->capacity = capacity;
+	rw->storage = malloc(capacity);
+	//entries are rarely smaller than this, it just bounds the size of the entry ring
+	rw->num_slots = capacity / 256 + 1;
+	rw->entries = malloc(sizeof(rewind_entry) * rw->num_slots);
+	rw->interval = interval ? interval : 1;
+#ifndef IS_LIB
+	rw->idle = render_create_semaphore(1);
+	rw->work_ready = render_create_semaphore(0);
+	if (rw->idle && rw->work_ready) {
+		rw->threaded = render_create_thread(&rw->thread, "rewind", rewind_thread, rw);
+	}
+	if (!rw->threaded) {
+		warning("Failed to start rewind compression thread, snapshots will be compressed inline\n");
+	}
+#endif
+	return rw;
+}
+
+//waits for the compressor to finish, after this the caller owns the history
+static void acquire(rewind_buffer *rw)
+{
+	if (rw->capture_pending) {
+		//already holding it for a capture that didn't happen
+		rw->capture_pending = 0;
+		return;
+	}
+#ifndef IS_LIB
+	if (rw->threaded) {
+		render_semaphore_wait(rw->idle);
+	}
+#endif
+}
+
+static void release(rewind_buffer *rw)
+{
+#ifndef IS_LIB
+	if (rw->threaded) {
+		render_semaphore_post(rw->idle);
+	}
+#endif
+}
+
+void rewind_free(rewind_buffer *rw)
+{
+	acquire(rw);
+#ifndef IS_LIB
+	if (rw->threaded) {
+		rw->exit = 1;
+		render_semaphore_post(rw->work_ready);
+		render_wait_thread(rw->thread);
+	}
+	if (rw->idle) {
+		render_destroy_semaphore(rw->idle);
+	}
+	if (rw->work_ready) {
+		render_destroy_semaphore(rw->work_ready);
+	}
+#endif
+	free(rw->storage);
+	free(rw->entries);
+	free(rw->latest);
+	free(rw->scratch);
+	free(rw->pending);
+	free(rw);
+}
+
+uint8_t rewind_frame(rewind_buffer *rw)
+{
+	if (rw->capture_pending) {
+		return 1;
+	}
+	if (++rw->frames < rw->interval) {
+		return 0;
+	}
+#ifndef IS_LIB
+	if (rw->threaded && !render_semaphore_try_wait(rw->idle)) {
+		//compressor is still busy with the last one, try again next frame rather than stall
+		return 0;
+	}
+#endif
+	rw->frames = 0;
+	rw->capture_pending = 1;
+	return 1;
+}
+
+void rewind_capture(rewind_buffer *rw, uint8_t *state, uint32_t size)
+{
+	if (!rw->capture_pending) {
+		//history was stepped back since this was requested
+		free(state);
+		return;
+	}
+	rw->capture_pending = 0;
+	rw->loaded_latest = 0;
+	rw->pending = state;
+	rw->pending_size = size;
+#ifndef IS_LIB
+	if (rw->threaded) {
+		render_semaphore_post(rw->work_ready);
+		return;
+	}
+#endif
+	compress_pending(rw);
+}
+
+uint8_t *rewind_step_back(rewind_buffer *rw, uint32_t *size_out)
+{
+	acquire(rw);
+	if (!rw->count) {
+		release(rw);
+		return NULL;
+	}
+	if (rw->loaded_latest && rw->count > 1) {
+		rewind_entry *newest = rw->entries + (rw->first + rw->count - 1) % rw->num_slots;
+		apply_delta(rw->latest, rw->latest_capacity, rw->storage + newest->offset, newest->length);
+		rw->latest_size = newest->prev_size;
+		rw->head = newest->offset;
+		rw->count--;
+	}
+	rw->loaded_latest = 1;
+	rw->frames = 0;
+	*size_out = rw->latest_size;
+	release(rw);
+	//the compressor only touches latest when handed a capture, which can't happen until the caller is done with it
+	return rw->latest;
+}
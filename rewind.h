@@ -0,0 +1,19 @@
+#ifndef REWIND_H_
+#define REWIND_H_
+
+#include <stdint.h>
+
+typedef struct rewind_buffer rewind_buffer;
+
+//capacity is the size of the snapshot history in bytes, interval is the number of frames between snapshots
+rewind_buffer *rewind_alloc(uint32_t capacity, uint32_t interval);
+void rewind_free(rewind_buffer *rw);
+//should be called once per emulated frame, returns 1 if a snapshot should be passed to rewind_capture
+uint8_t rewind_frame(rewind_buffer *rw);
+//takes ownership of state, which must have been allocated with malloc
+void rewind_capture(rewind_buffer *rw, uint8_t *state, uint32_t size);
+//returns the next older state or NULL if history is empty, returned buffer is owned by the rewind buffer
+//and is only valid until the next call to a rewind function
+uint8_t *rewind_step_back(rewind_buffer *rw, uint32_t *size_out);
+
+#endif //REWIND_H_
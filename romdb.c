@@ -14,6 +14,8 @@
 #include "megawifi.h"
 #include "jcart.h"
 #include "blastem.h"
+#include "paths.h"
+#include "mem.h"
 
 #define DOM_TITLE_START 0x120
 #define DOM_TITLE_END 0x150
@@ -36,15 +38,216 @@ char const *save_type_name(uint8_t save_type)
 	return "SRAM";
 }
 
-tern_node *load_rom_db()
+#define ROMDB_MAGIC "BEDB"
+#define ROMDB_VERSION 1
+#define ROMDB_HEADER_SIZE 24
+#define ROMDB_NODE_FLAG 0x80000000
+
+static uint32_t romdb_read32(rom_database *db, uint32_t offset)
+{
+	uint32_t ret;
+	memcpy(&ret, db->image + offset, sizeof(ret));
+	return ret;
+}
+
+static uint8_t romdb_check_image(rom_database *db)
+{
+	if (db->image_size < ROMDB_HEADER_SIZE || memcmp(db->image, ROMDB_MAGIC, 4)) {
+		return 0;
+	}
+	if (romdb_read32(db, 4) != ROMDB_VERSION) {
+		return 0;
+	}
+	//image is generated little endian, this will fail on big endian hosts which will use the text version instead
+	if (romdb_read32(db, 8) != 1 || romdb_read32(db, 20) != db->image_size) {
+		return 0;
+	}
+	db->num_entries = romdb_read32(db, 12);
+	uint32_t index_off = romdb_read32(db, 16);
+	if (index_off != ROMDB_HEADER_SIZE || db->num_entries > (db->image_size - index_off) / 8) {
+		return 0;
+	}
+	//all strings must be terminated inside the image
+	return db->image[db->image_size - 1] == 0;
+}
+
+static tern_node *romdb_expand_node(rom_database *db, uint32_t offset)
+{
+	if (offset > db->image_size - 4) {
+		fatal_error("Corrupt ROM DB image, node offset %X is out of range\n", offset);
+	}
+	uint32_t count = romdb_read32(db, offset);
+	offset += 4;
+	if (count > (db->image_size - offset) / 8) {
+		fatal_error("Corrupt ROM DB image, node at %X has too many children\n", offset - 4);
+	}
+	tern_node *head = NULL;
+	for (uint32_t i = 0; i < count; i++, offset += 8)
+	{
+		uint32_t key = romdb_read32(db, offset);
+		uint32_t val = romdb_read32(db, offset + 4);
+		if (key >= db->image_size) {
+			fatal_error("Corrupt ROM DB image, key offset %X is out of range\n", key);
+		}
+		if (val & ROMDB_NODE_FLAG) {
+			head = tern_insert_node(head, (char *)db->image + key, romdb_expand_node(db, val & ~ROMDB_NODE_FLAG));
+		} else if (val < db->image_size) {
+			//strings are used in place, nothing that consumes a ROM DB entry modifies them
+			head = tern_insert_ptr(head, (char *)db->image + key, db->image + val);
+		} else {
+			fatal_error("Corrupt ROM DB image, value offset %X is out of range\n", val);
+		}
+	}
+	return head;
+}
+
+rom_database *load_rom_db()
 {
-	tern_node *db = parse_bundled_config("rom.db");
-	if (!db) {
+	rom_database *db = calloc(1, sizeof(rom_database));
+	//a text rom.db in the config directory overrides the bundled database
+	char const *confdir = get_config_dir();
+	if (confdir) {
+		char *confpath = path_append(confdir, "rom.db");
+		db->text = parse_config_file(confpath);
+		free(confpath);
+		if (db->text) {
+			return db;
+		}
+	}
+	db->image = map_bundled_file("rom.dbc", &db->image_size);
+	if (db->image && db->image_size != (uint32_t)-1) {
+		if (romdb_check_image(db)) {
+			return db;
+		}
+		unmap_bundled_file(db->image, db->image_size);
+	}
+	db->image = NULL;
+	db->text = parse_bundled_config("rom.db");
+	if (!db->text) {
 		fatal_error("Failed to load ROM DB\n");
 	}
 	return db;
 }
 
+tern_node *rom_db_find(rom_database *rom_db, char const *key)
+{
+	if (!rom_db->image) {
+		return tern_find_node(rom_db->text, key);
+	}
+	tern_node *entry = tern_find_node(rom_db->entries, key);
+	if (entry) {
+		return entry;
+	}
+	uint32_t low = 0, high = rom_db->num_entries;
+	while (low < high)
+	{
+		uint32_t mid = low + (high - low) / 2;
+		uint32_t index_entry = ROMDB_HEADER_SIZE + mid * 8;
+		uint32_t key_off = romdb_read32(rom_db, index_entry);
+		if (key_off >= rom_db->image_size) {
+			fatal_error("Corrupt ROM DB image, key offset %X is out of range\n", key_off);
+		}
+		int diff = strcmp(key, (char *)rom_db->image + key_off);
+		if (!diff) {
+			entry = romdb_expand_node(rom_db, romdb_read32(rom_db, index_entry + 4));
+			rom_db->entries = tern_insert_node(rom_db->entries, key, entry);
+			return entry;
+		} else if (diff < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+	return NULL;
+}
+
+typedef struct shared_rom shared_rom;
+struct shared_rom {
+	shared_rom *next;
+	uint8_t    *data;
+	uint32_t   size;
+	uint32_t   refcount;
+	uint8_t    hash[20];
+};
+
+static shared_rom *shared_roms;
+
+static void rebase_rom(rom_info *info, uint8_t *old, uint32_t rom_size, uint8_t *new)
+{
+	for (uint32_t i = 0; i < info->map_chunks; i++)
+	{
+		uint8_t *buffer = info->map[i].buffer;
+		if (buffer >= old && buffer < old + rom_size) {
+			info->map[i].buffer = new + (buffer - old);
+		}
+	}
+	info->rom = new;
+}
+
+void *share_rom(rom_info *info, void *vrom, uint32_t rom_size)
+{
+	uint8_t *rom = vrom;
+	for (uint32_t i = 0; i < info->map_chunks; i++)
+	{
+		uint8_t *buffer = info->map[i].buffer;
+		if ((info->map[i].flags & MMAP_WRITE) && buffer >= rom && buffer < rom + rom_size) {
+			//cart has writeable ROM so it needs its own copy
+			return rom;
+		}
+	}
+	uint8_t hash[20];
+	sha1(rom, rom_size, hash);
+	shared_rom *cur;
+	for (cur = shared_roms; cur; cur = cur->next)
+	{
+		if (cur->size == rom_size && !memcmp(cur->hash, hash, sizeof(hash))) {
+			break;
+		}
+	}
+	if (!cur) {
+		//the image lives in its own pages so it can be made read-only once a second system uses it
+		uint8_t *data = alloc_pages(rom_size);
+		if (!data) {
+			return rom;
+		}
+		memcpy(data, rom, rom_size);
+		cur = calloc(1, sizeof(shared_rom));
+		cur->data = data;
+		cur->size = rom_size;
+		memcpy(cur->hash, hash, sizeof(hash));
+		cur->next = shared_roms;
+		shared_roms = cur;
+	} else {
+		debug_message("Sharing ROM image with an existing system\n");
+	}
+	if (++cur->refcount == 2) {
+		protect_pages(cur->data, cur->size, 0);
+	}
+	rebase_rom(info, rom, rom_size, cur->data);
+	free(rom);
+	return cur->data;
+}
+
+void release_rom(void *rom)
+{
+	for (shared_rom **cur = &shared_roms; *cur; cur = &(*cur)->next)
+	{
+		if ((*cur)->data == rom) {
+			shared_rom *tmp = *cur;
+			if (!--tmp->refcount) {
+				*cur = tmp->next;
+				free_pages(tmp->data, tmp->size);
+				free(tmp);
+			} else if (tmp->refcount == 1) {
+				//the last system using it can patch it again, e.g. from the debugger
+				protect_pages(tmp->data, tmp->size, 1);
+			}
+			return;
+		}
+	}
+	free(rom);
+}
+
 void free_rom_info(rom_info *info)
 {
 	free(info->name);
@@ -433,7 +636,7 @@ typedef struct {
 	uint8_t      *rom;
 	uint8_t      *lock_on;
 	tern_node    *root;
-	tern_node    *rom_db;
+	rom_database *rom_db;
 	uint32_t     rom_size;
 	uint32_t     lock_on_size;
 	int          index;
@@ -887,7 +1090,7 @@ void map_iter_fun(char *key, tern_val val, uint8_t valtype, void *data)
 	state->index++;
 }
 
-rom_info configure_rom(tern_node *rom_db, void *vrom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks)
+rom_info configure_rom(rom_database *rom_db, void *vrom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks)
 {
 	uint8_t product_id[GAME_ID_LEN+1];
 	uint8_t *rom = vrom;
@@ -907,9 +1110,9 @@ rom_info configure_rom(tern_node *rom_db, void *vrom, uint32_t rom_size, void *l
 	uint8_t hex_hash[41];
 	bin_to_hex(hex_hash, raw_hash, 20);
 	debug_message("SHA1: %s\n", hex_hash);
-	tern_node * entry = tern_find_node(rom_db, hex_hash);
+	tern_node * entry = rom_db_find(rom_db, (char *)hex_hash);
 	if (!entry) {
-		entry = tern_find_node(rom_db, product_id);
+		entry = rom_db_find(rom_db, (char *)product_id);
 	}
 	if (!entry) {
 		debug_message("Not found in ROM DB, examining header\n\n");
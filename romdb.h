@@ -82,14 +82,28 @@ struct rom_info {
 #define GAME_ID_OFF 0x183
 #define GAME_ID_LEN 8
 
-tern_node *load_rom_db();
-rom_info configure_rom(tern_node *rom_db, void *vrom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks);
+typedef struct {
+	tern_node *text;     //parsed text database, NULL when the compiled image is in use
+	tern_node *entries;  //entries already expanded from the compiled image
+	uint8_t   *image;
+	uint32_t  image_size;
+	uint32_t  num_entries;
+} rom_database;
+
+rom_database *load_rom_db();
+tern_node *rom_db_find(rom_database *rom_db, char const *key);
+rom_info configure_rom(rom_database *rom_db, void *vrom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks);
 rom_info configure_rom_heuristics(uint8_t *rom, uint32_t rom_size, memmap_chunk const *base_map, uint32_t base_chunks);
 uint8_t translate_region_char(uint8_t c);
 char const *save_type_name(uint8_t save_type);
 //Note: free_rom_info only frees things pointed to by a rom_info struct, not the struct itself
 //this is because rom_info structs are typically stack allocated
 void free_rom_info(rom_info *info);
+//Moves rom into an image shared by every system using a ROM with the same contents and updates info to point at it
+//The shared image is read-only while more than one system uses it. ROMs with writeable areas are never shared.
+//Images returned by share_rom must be freed with release_rom. Neither is thread-safe.
+void *share_rom(rom_info *info, void *rom, uint32_t rom_size);
+void release_rom(void *rom);
 typedef struct system_header system_header;
 void cart_serialize(system_header *sys, serialize_buffer *buf);
 void cart_deserialize(deserialize_buffer *buf, void *vcontext);
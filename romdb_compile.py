@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+#Compiles the text ROM database (rom.db) into the binary image loaded by romdb.c
+#
+#Layout (all integers are 32-bit little endian, offsets are from the start of the image):
+#	header: magic "BEDB", version, byte order marker (1), entry count, index offset, image size
+#	index: entry count pairs of (key string offset, node offset) sorted by key using strcmp ordering
+#	node: child count followed by that many pairs of (key string offset, value)
+#	      value has bit 31 set if it's the offset of a child node, otherwise it's a string offset
+#	strings: NUL-terminated, each distinct string is only stored once
+import struct
+import sys
+
+MAGIC = b'BEDB'
+VERSION = 1
+NODE_FLAG = 0x80000000
+
+def strip_ws(text):
+	#matches strip_ws in util.c which removes blanks and unprintable characters
+	start = 0
+	while start < len(text) and (text[start] <= 0x20 or text[start] > 0x7E):
+		start += 1
+	end = len(text)
+	while end > start and (text[end-1] <= 0x20 or text[end-1] > 0x7E):
+		end -= 1
+	return text[start:end]
+
+def split_keyval(text):
+	for i in range(0, len(text)):
+		if text[i] == 0x20 or text[i] == 0x09:
+			return text[:i], text[i+1:]
+	return text, b''
+
+def parse_config(lines, pos, started, fname):
+	#mirrors parse_config_int in config.c, later duplicates replace earlier ones
+	head = {}
+	while pos < len(lines):
+		line = strip_ws(lines[pos])
+		pos += 1
+		if not line or line.startswith(b'#'):
+			continue
+		if line.startswith(b'}'):
+			if started:
+				return head, pos
+			raise Exception('unexpected } on line {0} of {1}'.format(pos, fname))
+		if line.endswith(b'{'):
+			key = strip_ws(line[:-1])
+			head[key], pos = parse_config(lines, pos, True, fname)
+		else:
+			key, val = split_keyval(line)
+			val = strip_ws(val)
+			if val:
+				head[key] = val
+			else:
+				sys.stderr.write('Key {0} is missing a value on line {1}\n'.format(key.decode('latin-1'), pos))
+	return head, pos
+
+class Image:
+	def __init__(self):
+		self.nodes = bytearray()
+		self.strings = bytearray()
+		self.string_offsets = {}
+		self.string_values = set()
+
+	def intern(self, s):
+		if not s in self.string_offsets:
+			self.string_offsets[s] = len(self.strings)
+			self.strings += s + b'\0'
+		return self.string_offsets[s]
+
+	def addNode(self, node):
+		keys = sorted(node.keys())
+		children = {}
+		for key in keys:
+			if type(node[key]) is dict:
+				children[key] = self.addNode(node[key])
+		offset = len(self.nodes)
+		self.nodes += struct.pack('<I', len(keys))
+		for key in keys:
+			if key in children:
+				self.nodes += struct.pack('<II', self.intern(key), children[key])
+			else:
+				self.string_values.add(len(self.nodes) + 4)
+				self.nodes += struct.pack('<II', self.intern(key), self.intern(node[key]))
+		return offset
+
+	def build(self, db):
+		entries = []
+		for key in sorted(db.keys()):
+			if type(db[key]) is dict:
+				entries.append((self.intern(key), self.addNode(db[key])))
+			else:
+				sys.stderr.write('Ignoring top level key {0} without a block\n'.format(key.decode('latin-1')))
+		header_size = 24
+		index_size = 8 * len(entries)
+		nodes_base = header_size + index_size
+		strings_base = nodes_base + len(self.nodes)
+		#string offsets were recorded relative to the string table, node offsets relative
+		#to the node area; rebase them now that the final layout is known
+		nodes = self.nodes
+		pos = 0
+		while pos < len(nodes):
+			count, = struct.unpack_from('<I', nodes, pos)
+			pos += 4
+			for i in range(0, count):
+				key, val = struct.unpack_from('<II', nodes, pos)
+				if pos + 4 in self.string_values:
+					val += strings_base
+				else:
+					val = (val + nodes_base) | NODE_FLAG
+				struct.pack_into('<II', nodes, pos, key + strings_base, val)
+				pos += 8
+		out = bytearray()
+		total = strings_base + len(self.strings)
+		out += MAGIC + struct.pack('<IIIII', VERSION, 1, len(entries), header_size, total)
+		for key, node in entries:
+			out += struct.pack('<II', key + strings_base, node + nodes_base)
+		out += nodes
+		out += self.strings
+		return out
+
+def main(argv):
+	if len(argv) < 3:
+		print('Usage: romdb_compile.py INPUT OUTPUT')
+		return 1
+	with open(argv[1], 'rb') as f:
+		lines = f.read().split(b'\n')
+	db, _ = parse_config(lines, 0, False, argv[1])
+	out = Image().build(db)
+	with open(argv[2], 'wb') as f:
+		f.write(out)
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main(sys.argv))
@@ -8,6 +8,9 @@
 #define QUICK_SAVE_SLOT 10
 #define SERIALIZE_SLOT 11
 #define EVENTLOG_SLOT 12
+#define REWIND_SLOT 13
+#define SNAPSHOT_SLOT 14
+#define NETPLAY_SLOT 15
 
 typedef struct {
 	char   *desc;
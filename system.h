@@ -74,6 +74,7 @@ struct system_header {
 	uint8_t                 has_keyboard;
 	uint8_t                 vgm_logging;
 	uint8_t                 force_release;
+	uint8_t                 rewinding;
 	debugger_type           debugger_type;
 	system_type             type;
 };
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <limits.h>
+#include "telemetry.h"
+
+//Values reported by the emulation and audio threads are collected in pending_* until the presenting thread
+//adds a frame to the history. Only the presenting thread touches the history itself.
+
+#define NO_AUDIO_CALLBACK INT32_MAX
+
+static telemetry_frame history[TELEMETRY_FRAMES];
+static uint32_t next, count;
+static uint32_t pending_emulation_us, pending_underflow;
+static int32_t pending_buffered = NO_AUDIO_CALLBACK;
+static int32_t last_buffered;
+static float pending_adjust;
+static uint8_t overlay;
+
+void telemetry_emulation_time(uint32_t us)
+{
+	__atomic_store_n(&pending_emulation_us, us, __ATOMIC_RELAXED);
+}
+
+void telemetry_audio_buffered(int32_t samples)
+{
+	int32_t cur = __atomic_load_n(&pending_buffered, __ATOMIC_RELAXED);
+	while (samples < cur && !__atomic_compare_exchange_n(&pending_buffered, &cur, samples, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+	}
+}
+
+void telemetry_speed_adjust(float ratio)
+{
+	__atomic_store(&pending_adjust, &ratio, __ATOMIC_RELAXED);
+}
+
+void telemetry_underflow(uint32_t samples)
+{
+	__atomic_add_fetch(&pending_underflow, samples, __ATOMIC_RELAXED);
+}
+
+void telemetry_frame_presented(uint32_t timestamp, uint32_t present_us, uint32_t dropped, uint32_t repeated)
+{
+	telemetry_frame *frame = history + next;
+	frame->timestamp = timestamp;
+	frame->emulation_us = __atomic_load_n(&pending_emulation_us, __ATOMIC_RELAXED);
+	frame->present_us = present_us;
+	int32_t buffered = __atomic_exchange_n(&pending_buffered, NO_AUDIO_CALLBACK, __ATOMIC_RELAXED);
+	if (buffered != NO_AUDIO_CALLBACK) {
+		last_buffered = buffered;
+	}
+	frame->audio_buffered = last_buffered;
+	float no_adjust = 0.0f;
+	__atomic_exchange(&pending_adjust, &no_adjust, &frame->adjust_ratio, __ATOMIC_RELAXED);
+	frame->underflow = __atomic_exchange_n(&pending_underflow, 0, __ATOMIC_RELAXED);
+	frame->dropped = dropped;
+	frame->repeated = repeated;
+	next = (next + 1) % TELEMETRY_FRAMES;
+	if (count < TELEMETRY_FRAMES) {
+		count++;
+	}
+}
+
+uint32_t telemetry_count(void)
+{
+	return count;
+}
+
+telemetry_frame *telemetry_get(uint32_t index)
+{
+	return history + (next + TELEMETRY_FRAMES - count + index) % TELEMETRY_FRAMES;
+}
+
+uint8_t telemetry_save_csv(char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		return 0;
+	}
+	fputs("timestamp_ms,emulation_us,present_us,audio_buffered,adjust_ratio,underflow,dropped,repeated\n", f);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		telemetry_frame *frame = telemetry_get(i);
+		fprintf(f, "%u,%u,%u,%d,%f,%u,%u,%u\n", frame->timestamp, frame->emulation_us, frame->present_us,
+			frame->audio_buffered, frame->adjust_ratio, frame->underflow, frame->dropped, frame->repeated);
+	}
+	fclose(f);
+	return 1;
+}
+
+void telemetry_toggle_overlay(void)
+{
+	overlay = !overlay;
+}
+
+uint8_t telemetry_overlay_visible(void)
+{
+	return overlay;
+}
@@ -0,0 +1,36 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+//number of frames kept in the history
+#define TELEMETRY_FRAMES 1024
+
+typedef struct {
+	uint32_t timestamp;      //milliseconds since startup when the frame was presented
+	uint32_t emulation_us;   //time taken to produce the frame
+	uint32_t present_us;     //time taken to upload and present the frame
+	int32_t  audio_buffered; //lowest number of samples left in the audio buffers after a callback
+	float    adjust_ratio;   //resampling speed adjustment made for this frame, 0 if none
+	uint32_t underflow;      //number of samples the audio callback was short
+	uint32_t dropped;        //frames replaced before they could be presented
+	uint32_t repeated;       //frames presented again because a new one wasn't ready
+} telemetry_frame;
+
+//these can be called from any thread, values are attached to the next frame that is presented
+void telemetry_emulation_time(uint32_t us);
+void telemetry_audio_buffered(int32_t samples);
+void telemetry_speed_adjust(float ratio);
+void telemetry_underflow(uint32_t samples);
+//adds a frame to the history, must be called from the thread that presents frames
+void telemetry_frame_presented(uint32_t timestamp, uint32_t present_us, uint32_t dropped, uint32_t repeated);
+//number of frames in the history, at most TELEMETRY_FRAMES
+uint32_t telemetry_count(void);
+//returns a frame from the history, 0 is the oldest
+telemetry_frame *telemetry_get(uint32_t index);
+//writes the history as CSV, returns 0 on failure
+uint8_t telemetry_save_csv(char *path);
+void telemetry_toggle_overlay(void);
+uint8_t telemetry_overlay_visible(void);
+
+#endif //TELEMETRY_H_
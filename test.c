@@ -3,9 +3,11 @@
 #include <string.h>
 #include <stdio.h>
 #include "vdp.h"
+#include "render.h"
 
 int headless = 1;
-uint16_t read_dma_value(uint32_t address)
+system_header *current_system;
+uint16_t read_dma_value(system_header *system, uint32_t address)
 {
 	return 0;
 }
@@ -15,11 +17,66 @@ uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b)
 	return 0;
 }
 
-void render_alloc_surfaces(vdp_context * context)
+uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
+{
+	*pitch = 0;
+	return NULL;
+}
+
+void render_framebuffer_dirty_lines(uint8_t which, uint32_t first_line, uint32_t last_line)
+{
+}
+
+framebuffer_format render_framebuffer_format(void)
+{
+	return FRAMEBUFFER_XRGB8888;
+}
+
+uint32_t *render_get_palettes(uint8_t which, int *pitch)
+{
+	//FRAMEBUFFER_INDEXED8 is never reported
+	*pitch = 0;
+	return NULL;
+}
+
+void render_framebuffer_updated(uint8_t which, int width)
+{
+}
+
+uint8_t render_create_window(char *caption, uint32_t width, uint32_t height, window_close_handler close_handler)
+{
+	return 0;
+}
+
+void render_destroy_window(uint8_t which)
+{
+}
+
+uint8_t render_get_active_framebuffer(void)
+{
+	return FRAMEBUFFER_ODD;
+}
+
+uint32_t render_overscan_top()
+{
+	return 0;
+}
+
+uint32_t render_overscan_bot()
+{
+	return 0;
+}
+
+void render_errorbox(char *title, char *message)
+{
+}
+
+void render_infobox(char *title, char *message)
+{
+}
+
+void init_terminal(void)
 {
-	context->oddbuf = context->framebuf = malloc(512 * 256 * 4 * 2);
-	memset(context->oddbuf, 0, 512 * 256 * 4 * 2);
-	context->evenbuf = ((char *)context->oddbuf) + 512 * 256 * 4;
 }
 
 int check_hint_time(vdp_context * v_context)
@@ -35,42 +92,42 @@ int check_hint_time(vdp_context * v_context)
 			orig_hint_cycle = cur_hint_cycle;
 			res = 0;
 		}
-		vdp_run_context(v_context, v_context->cycles + 1);
+		//vdp_run_context stops a slot short of the target, so step by at least a full H32 slot (20 cycles)
+		vdp_run_context(v_context, v_context->cycles + 20);
 	}
 	printf("hint fired at cycle: %d, vcounter: %d, hslot: %d\n", cur_hint_cycle, v_context->vcounter, v_context->hslot);
-	vdp_int_ack(v_context, 4);
+	vdp_int_ack(v_context);
 	return res;
 }
 
 
 int main(int argc, char ** argv)
 {
-	vdp_context v_context;
-	init_vdp_context(&v_context, 0);
-	vdp_control_port_write(&v_context, 0x8144);
-	vdp_control_port_write(&v_context, 0x8C81);
-	vdp_control_port_write(&v_context, 0x8A7F);
-	vdp_control_port_write(&v_context, 0x8014);
-	v_context.hint_counter = 0x7F;
-	v_context.vcounter = 128;
-	v_context.hslot = 165;
+	vdp_context *v_context = init_vdp_context(0, 0);
+	vdp_control_port_write(v_context, 0x8144);
+	vdp_control_port_write(v_context, 0x8C81);
+	vdp_control_port_write(v_context, 0x8A7F);
+	vdp_control_port_write(v_context, 0x8014);
+	v_context->hint_counter = 0x7F;
+	v_context->vcounter = 128;
+	v_context->hslot = 165;
 	//check single shot behavior
-	int res = check_hint_time(&v_context);
+	int res = check_hint_time(v_context);
 	//check every line behavior
-	while (v_context.vcounter < 225)
+	while (v_context->vcounter < 225)
 	{
-		vdp_run_context(&v_context, v_context.cycles + 1);
+		vdp_run_context(v_context, v_context->cycles + 20);
 	}
-	vdp_control_port_write(&v_context, 0x8A00);
+	vdp_control_port_write(v_context, 0x8A00);
 	int hint_count = 0;
-	while (res && v_context.vcounter != 224)
+	while (res && v_context->vcounter != 224)
 	{
-		res = res && check_hint_time(&v_context);
+		res = res && check_hint_time(v_context);
 		hint_count++;
 	}
 	if (res && hint_count != 225) {
 		fprintf(stderr, "ERROR: hint count should be 225 but was %d instead\n", hint_count);
 		res = 0;
 	}
-	return 0;
+	return res ? 0 : 1;
 }
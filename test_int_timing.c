@@ -5,15 +5,17 @@
 */
 #include <stdio.h>
 #include "vdp.h"
+#include "render.h"
 
 int headless = 1;
+system_header *current_system;
 
 uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b)
 {
 	return 0;
 }
 
-uint16_t read_dma_value(uint32_t address)
+uint16_t read_dma_value(system_header *system, uint32_t address)
 {
 	return 0;
 }
@@ -24,74 +26,121 @@ uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
 	return NULL;
 }
 
+void render_framebuffer_dirty_lines(uint8_t which, uint32_t first_line, uint32_t last_line)
+{
+}
+
+framebuffer_format render_framebuffer_format(void)
+{
+	return FRAMEBUFFER_XRGB8888;
+}
+
+uint32_t *render_get_palettes(uint8_t which, int *pitch)
+{
+	//FRAMEBUFFER_INDEXED8 is never reported
+	*pitch = 0;
+	return NULL;
+}
+
 void render_framebuffer_updated(uint8_t which, int width)
 {
 }
 
-void warning(char *format, ...)
+uint8_t render_create_window(char *caption, uint32_t width, uint32_t height, window_close_handler close_handler)
+{
+	return 0;
+}
+
+void render_destroy_window(uint8_t which)
+{
+}
+
+uint8_t render_get_active_framebuffer(void)
+{
+	return FRAMEBUFFER_ODD;
+}
+
+uint32_t render_overscan_top()
+{
+	return 0;
+}
+
+uint32_t render_overscan_bot()
+{
+	return 0;
+}
+
+void render_errorbox(char *title, char *message)
+{
+}
+
+void render_infobox(char *title, char *message)
+{
+}
+
+void init_terminal(void)
 {
 }
 
 
 int main(int argc, char **argv)
 {
-	vdp_context context;
+	vdp_context *context = init_vdp_context(0, 0);
 	int ret = 0;
-	init_vdp_context(&context, 0);
-	vdp_control_port_write(&context, 0x8000 | BIT_PAL_SEL);
-	vdp_control_port_write(&context, 0x8100 | BIT_DISP_EN | BIT_VINT_EN | BIT_MODE_5);
+	vdp_control_port_write(context, 0x8000 | BIT_PAL_SEL);
+	vdp_control_port_write(context, 0x8100 | BIT_DISP_EN | BIT_VINT_EN | BIT_MODE_5);
 	puts("Testing H32 Mode");
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
+		vdp_run_context(context, context->cycles + 20);
 	}
-	vdp_int_ack(&context);
-	uint32_t vint_cycle = vdp_next_vint(&context);
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	vdp_int_ack(context);
+	uint32_t vint_cycle = vdp_next_vint(context);
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
-		uint32_t vint_cycle2 = vdp_next_vint(&context);
+		vdp_run_context(context, context->cycles + 20);
+		uint32_t vint_cycle2 = vdp_next_vint(context);
 		if (vint_cycle2 != vint_cycle) {
-			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context.vcounter, context.hslot);;
+			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context->vcounter, context->hslot);;
 			ret = 1;
 			vint_cycle = vint_cycle2;
 		}
 	}
-	vdp_int_ack(&context);
+	vdp_int_ack(context);
 	puts("Testing H40 Mode");
-	vdp_control_port_write(&context, 0x8C81);
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	vdp_control_port_write(context, 0x8C81);
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
+		vdp_run_context(context, context->cycles + 20);
 	}
-	vdp_int_ack(&context);
-	vint_cycle = vdp_next_vint(&context);
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	vdp_int_ack(context);
+	vint_cycle = vdp_next_vint(context);
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
-		uint32_t vint_cycle2 = vdp_next_vint(&context);
+		vdp_run_context(context, context->cycles + 20);
+		uint32_t vint_cycle2 = vdp_next_vint(context);
 		if (vint_cycle2 != vint_cycle) {
-			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context.vcounter, context.hslot);;
+			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context->vcounter, context->hslot);;
 			ret = 1;
 			vint_cycle = vint_cycle2;
 		}
 	}
-	vdp_int_ack(&context);
+	vdp_int_ack(context);
 	puts("Testing Mode 4");
-	vdp_control_port_write(&context, 0x8C00);
-	vdp_control_port_write(&context, 0x8100 | BIT_DISP_EN | BIT_VINT_EN);
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	vdp_control_port_write(context, 0x8C00);
+	vdp_control_port_write(context, 0x8100 | BIT_DISP_EN | BIT_VINT_EN);
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
+		vdp_run_context(context, context->cycles + 20);
 	}
-	context.flags2 &= ~FLAG2_VINT_PENDING;
-	vint_cycle = vdp_next_vint(&context);
-	while (!(context.flags2 & FLAG2_VINT_PENDING))
+	context->flags2 &= ~FLAG2_VINT_PENDING;
+	vint_cycle = vdp_next_vint(context);
+	while (!(context->flags2 & FLAG2_VINT_PENDING))
 	{
-		vdp_run_context(&context, context.cycles + 1);
-		uint32_t vint_cycle2 = vdp_next_vint(&context);
+		vdp_run_context(context, context->cycles + 20);
+		uint32_t vint_cycle2 = vdp_next_vint(context);
 		if (vint_cycle2 != vint_cycle) {
-			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context.vcounter, context.hslot);;
+			printf("VINT Cycle changed from %d to %d @ line %d, slot %d\n", vint_cycle, vint_cycle2, context->vcounter, context->hslot);;
 			ret = 1;
 			vint_cycle = vint_cycle2;
 		}
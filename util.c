@@ -727,6 +727,7 @@ int socket_error_is_wouldblock(void)
 #else
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/mman.h>
 
 void socket_init(void)
 {
@@ -973,6 +974,17 @@ char *read_bundled_file(char *name, uint32_t *sizeret)
 	SDL_RWclose(rw);
 	return ret;
 }
+
+void *map_bundled_file(char *name, uint32_t *sizeret)
+{
+	//bundled files live inside the APK so they can't be mapped directly
+	return read_bundled_file(name, sizeret);
+}
+
+void unmap_bundled_file(void *data, uint32_t size)
+{
+	free(data);
+}
 #endif
 
 char const *get_config_dir()
@@ -988,21 +1000,29 @@ char const *get_userdata_dir()
 #else
 
 #ifndef IS_LIB
-char *read_bundled_file(char *name, uint32_t *sizeret)
+static char *bundled_file_path(char *name)
 {
 #ifdef DATA_PATH
 	char *data_dir = DATA_PATH;
 #else
 	char *data_dir = get_exe_dir();
 	if (!data_dir) {
+		return NULL;
+	}
+#endif
+	char const *pieces[] = {data_dir, PATH_SEP, name};
+	return alloc_concat_m(3, pieces);
+}
+
+char *read_bundled_file(char *name, uint32_t *sizeret)
+{
+	char *path = bundled_file_path(name);
+	if (!path) {
 		if (sizeret) {
 			*sizeret = -1;
 		}
 		return NULL;
 	}
-#endif
-	char const *pieces[] = {data_dir, PATH_SEP, name};
-	char *path = alloc_concat_m(3, pieces);
 	FILE *f = fopen(path, "rb");
 	free(path);
 	if (!f) {
@@ -1031,6 +1051,48 @@ char *read_bundled_file(char *name, uint32_t *sizeret)
 	fclose(f);
 	return ret;
 }
+
+void *map_bundled_file(char *name, uint32_t *sizeret)
+{
+#ifdef _WIN32
+	return read_bundled_file(name, sizeret);
+#else
+	if (sizeret) {
+		*sizeret = -1;
+	}
+	char *path = bundled_file_path(name);
+	if (!path) {
+		return NULL;
+	}
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	void *ret = NULL;
+	if (!fstat(fd, &st) && st.st_size > 0 && st.st_size < UINT32_MAX) {
+		ret = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ret == MAP_FAILED) {
+			ret = NULL;
+		} else if (sizeret) {
+			*sizeret = st.st_size;
+		}
+	}
+	//mapping stays valid after the descriptor is closed
+	close(fd);
+	return ret;
+#endif
+}
+
+void unmap_bundled_file(void *data, uint32_t size)
+{
+#ifdef _WIN32
+	free(data);
+#else
+	munmap(data, size);
+#endif
+}
 #endif //ISLIB
 
 #ifdef _WIN32
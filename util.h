@@ -66,6 +66,10 @@ char const *get_config_dir();
 char const *get_userdata_dir();
 //Reads a file bundled with the executable
 char *read_bundled_file(char *name, uint32_t *sizeret);
+//Maps a file bundled with the executable read-only, falls back to read_bundled_file where that isn't possible
+void *map_bundled_file(char *name, uint32_t *sizeret);
+//Releases a file returned by map_bundled_file
+void unmap_bundled_file(void *data, uint32_t size);
 //Retunrs an array of normal files and directories residing in a directory
 dir_entry *get_dir_list(char *path, size_t *numret);
 //Frees a dir list returned by get_dir_list
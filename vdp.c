@@ -6,6 +6,7 @@
 #include "vdp.h"
 #include "blastem.h"
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include "render.h"
 #include "util.h"
@@ -77,6 +78,14 @@ static uint32_t calc_crop(uint32_t crop, uint32_t border)
 	return crop >= border ? 0 : border - crop;
 }
 
+static void output_changed(vdp_context *context)
+{
+	//0 marks lines that changed while they were being drawn, so it's never a valid generation
+	if (!++context->output_gen) {
+		context->output_gen = 1;
+	}
+}
+
 static void update_video_params(vdp_context *context)
 {
 	uint32_t top_crop = render_overscan_top();
@@ -142,6 +151,118 @@ static void update_video_params(vdp_context *context)
 	}
 	context->border_top = calc_crop(top_crop, border_top);
 	context->top_offset = border_top - context->border_top;
+	output_changed(context);
+}
+
+static void acquire_framebuffer(vdp_context *context)
+{
+	video_sink *sink = context->sink;
+	if (sink) {
+		context->fb = sink->get_framebuffer(sink, context->cur_buffer, &context->output_pitch);
+		context->fb_format = sink->format;
+	} else {
+		context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
+		context->fb_format = render_framebuffer_format();
+	}
+	if (context->fb_format != FRAMEBUFFER_XRGB8888 && !context->output_stage) {
+		context->output_stage = malloc(LINEBUF_SIZE * sizeof(uint32_t));
+	}
+	if (context->fb_format == FRAMEBUFFER_INDEXED8) {
+		if (sink) {
+			context->palettes = sink->get_palettes(sink, context->cur_buffer, &context->palette_pitch);
+		} else {
+			context->palettes = render_get_palettes(context->cur_buffer, &context->palette_pitch);
+		}
+	}
+}
+
+static void framebuffer_updated(vdp_context *context, int width)
+{
+	if (context->sink) {
+		context->sink->framebuffer_updated(context->sink, context->cur_buffer, width);
+	} else {
+		render_framebuffer_updated(context->cur_buffer, width);
+	}
+}
+
+void vdp_set_video_sink(vdp_context *context, video_sink *sink)
+{
+	if (headless && !context->sink) {
+		//init_vdp_context gave us a private buffer to draw into
+		free(context->fb);
+	}
+	context->sink = sink;
+	context->cur_buffer = FRAMEBUFFER_ODD;
+	context->output = NULL;
+	acquire_framebuffer(context);
+}
+
+static void set_output_line(vdp_context *context, uint32_t line)
+{
+	if (context->fb_format == FRAMEBUFFER_XRGB8888) {
+		context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * line);
+	} else {
+		//the render paths all write 32-bit colors, so the line is staged and converted once it's done
+		context->output_row = ((uint8_t *)context->fb) + context->output_pitch * line;
+		if (context->fb_format == FRAMEBUFFER_INDEXED8) {
+			context->output_palette = (uint32_t *)(((char *)context->palettes) + context->palette_pitch * line);
+		}
+		context->output = context->output_stage;
+	}
+}
+
+#define PALETTE_HASH_SIZE 512
+static void flush_indexed(vdp_context *context)
+{
+	//colors get palette entries in the order they first appear on the line
+	//more than 256 colors can only come from debug overlays, those share the last entry
+	uint16_t slots[PALETTE_HASH_SIZE];
+	memset(slots, 0, sizeof(slots));
+	uint32_t *src = context->output_stage, *palette = context->output_palette;
+	uint8_t *dst = context->output_row;
+	uint32_t count = 0, last = ~*src;
+	uint8_t index = 0;
+	for (int i = 0; i < LINEBUF_SIZE; i++)
+	{
+		uint32_t pixel = *(src++);
+		if (pixel != last) {
+			last = pixel;
+			uint32_t slot = pixel * 0x9E3779B1 >> 23;
+			while (slots[slot] && palette[slots[slot] - 1] != pixel)
+			{
+				slot = (slot + 1) & (PALETTE_HASH_SIZE - 1);
+			}
+			if (slots[slot]) {
+				index = slots[slot] - 1;
+			} else if (count < 256) {
+				palette[count] = pixel;
+				slots[slot] = ++count;
+				index = count - 1;
+			} else {
+				index = 255;
+			}
+		}
+		*(dst++) = index;
+	}
+}
+
+static void flush_output_line(vdp_context *context)
+{
+	if (!context->output_row) {
+		return;
+	}
+	if (context->fb_format == FRAMEBUFFER_INDEXED8) {
+		flush_indexed(context);
+	} else {
+		uint32_t *src = context->output_stage;
+		uint16_t *dst = (uint16_t *)context->output_row;
+		for (int i = 0; i < LINEBUF_SIZE; i++)
+		{
+			uint32_t pixel = *(src++);
+			*(dst++) = (pixel >> 8 & 0xF800) | (pixel >> 5 & 0x7E0) | (pixel >> 3 & 0x1F);
+		}
+	}
+	context->output_row = NULL;
 }
 
 static uint8_t color_map_init_done;
@@ -149,12 +270,15 @@ static uint8_t color_map_init_done;
 vdp_context *init_vdp_context(uint8_t region_pal, uint8_t has_max_vsram)
 {
 	vdp_context *context = calloc(1, sizeof(vdp_context) + VRAM_SIZE);
+	context->output_gen = 1;
+	context->line_number = VDP_NO_LINE;
+	context->dirty_first = VDP_NO_LINE;
 	if (headless) {
 		context->fb = malloc(512 * LINEBUF_SIZE * sizeof(uint32_t));
 		context->output_pitch = LINEBUF_SIZE * sizeof(uint32_t);
 	} else {
 		context->cur_buffer = FRAMEBUFFER_ODD;
-		context->fb = render_get_framebuffer(FRAMEBUFFER_ODD, &context->output_pitch);
+		acquire_framebuffer(context);
 	}
 	context->sprite_draws = MAX_SPRITES_LINE;
 	context->fifo_write = 0;
@@ -248,12 +372,17 @@ vdp_context *init_vdp_context(uint8_t region_pal, uint8_t has_max_vsram)
 		context->flags2 |= FLAG2_REGION_PAL;
 	}
 	update_video_params(context);
-	context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * context->border_top);
+	set_output_line(context, context->border_top);
 	return context;
 }
 
 void vdp_free(vdp_context *context)
 {
+	for (int i = 0; i < VDP_NUM_DEBUG_TYPES; i++)
+	{
+		free(context->debug_cache[i]);
+	}
+	free(context->output_stage);
 	free(context);
 }
 
@@ -600,12 +729,71 @@ static uint8_t is_active(vdp_context *context)
 	return context->state != INACTIVE && (context->regs[REG_MODE_2] & BIT_DISP_EN) != 0;
 }
 
+static void sprite_lines_clear(vdp_context *context, uint8_t sprite)
+{
+	uint32_t word = sprite >> 5, bit = 1 << (sprite & 31);
+	for (uint16_t line = context->sprite_line_start[sprite]; line < context->sprite_line_end[sprite]; line++)
+	{
+		context->sprite_lines[line][word] &= ~bit;
+	}
+}
+
+static void sprite_lines_set(vdp_context *context, uint8_t sprite)
+{
+	uint16_t address = sprite * 4;
+	uint16_t ymask;
+	uint8_t height_mult;
+	if (context->sprite_lines_mode == 2) {
+		ymask = 0x3FF;
+		height_mult = 16;
+	} else {
+		ymask = 0x1FF;
+		height_mult = 8;
+	}
+	uint16_t y = ((context->sat_cache[address] & 0x3) << 8 | context->sat_cache[address+1]) & ymask;
+	uint16_t end = y + ((context->sat_cache[address+2] & 0x3) + 1) * height_mult;
+	//scan_sprite_table masks the line it checks, so the bottom of a sprite never wraps to the top
+	if (end > ymask + 1) {
+		end = ymask + 1;
+	}
+	context->sprite_line_start[sprite] = y;
+	context->sprite_line_end[sprite] = end;
+	uint32_t word = sprite >> 5, bit = 1 << (sprite & 31);
+	for (uint16_t line = y; line < end; line++)
+	{
+		context->sprite_lines[line][word] |= bit;
+	}
+}
+
+static void rebuild_sprite_lines(vdp_context *context)
+{
+	memset(context->sprite_lines, 0, sizeof(context->sprite_lines));
+	context->sprite_lines_mode = context->double_res + 1;
+	for (uint8_t sprite = 0; sprite < MAX_SPRITES_FRAME; sprite++)
+	{
+		sprite_lines_set(context, sprite);
+	}
+}
+
+static void update_sprite_lines(vdp_context *context, uint16_t cache_address)
+{
+	if (!context->sprite_lines_mode || (cache_address & 3) == 3) {
+		//link changes don't affect which lines a sprite covers
+		return;
+	}
+	uint8_t sprite = cache_address >> 2;
+	sprite_lines_clear(context, sprite);
+	sprite_lines_set(context, sprite);
+}
+
 static void scan_sprite_table(uint32_t line, vdp_context * context)
 {
 	if (context->sprite_index && ((uint8_t)context->slot_counter) < context->max_sprites_line) {
+		if (context->sprite_lines_mode != context->double_res + 1) {
+			rebuild_sprite_lines(context);
+		}
 		line += 1;
 		uint16_t ymask, ymin;
-		uint8_t height_mult;
 		if (context->double_res) {
 			line *= 2;
 			if (context->flags2 & FLAG2_EVEN_FIELD) {
@@ -613,11 +801,9 @@ static void scan_sprite_table(uint32_t line, vdp_context * context)
 			}
 			ymask = 0x3FF;
 			ymin = 256;
-			height_mult = 16;
 		} else {
 			ymask = 0x1FF;
 			ymin = 128;
-			height_mult = 8;
 		}
 		context->sprite_index &= 0x7F;
 		//TODO: Implement squirelly behavior documented by Kabuto
@@ -628,11 +814,8 @@ static void scan_sprite_table(uint32_t line, vdp_context * context)
 		uint16_t address = context->sprite_index * 4;
 		line += ymin;
 		line &= ymask;
-		uint16_t y = ((context->sat_cache[address] & 0x3) << 8 | context->sat_cache[address+1]) & ymask;
-		uint8_t height = ((context->sat_cache[address+2] & 0x3) + 1) * height_mult;
-		//printf("Sprite %d | y: %d, height: %d\n", context->sprite_index, y, height);
-		if (y <= line && line < (y + height)) {
-			//printf("Sprite %d at y: %d with height %d is on line %d\n", context->sprite_index, y, height, line);
+		uint32_t *on_line = context->sprite_lines[line];
+		if (on_line[context->sprite_index >> 5] >> (context->sprite_index & 31) & 1) {
 			context->sprite_info_list[context->slot_counter].size = context->sat_cache[address+2];
 			context->sprite_info_list[context->slot_counter++].index = context->sprite_index;
 		}
@@ -645,11 +828,7 @@ static void scan_sprite_table(uint32_t line, vdp_context * context)
 				return;
 			}
 			address = context->sprite_index * 4;
-			y = ((context->sat_cache[address] & 0x3) << 8 | context->sat_cache[address+1]) & ymask;
-			height = ((context->sat_cache[address+2] & 0x3) + 1) * height_mult;
-			//printf("Sprite %d | y: %d, height: %d\n", context->sprite_index, y, height);
-			if (y <= line && line < (y + height)) {
-				//printf("Sprite %d at y: %d with height %d is on line %d\n", context->sprite_index, y, height, line);
+			if (on_line[context->sprite_index >> 5] >> (context->sprite_index & 31) & 1) {
 				context->sprite_info_list[context->slot_counter].size = context->sat_cache[address+2];
 				context->sprite_info_list[context->slot_counter++].index = context->sprite_index;
 			}
@@ -801,6 +980,8 @@ static void update_color_map(vdp_context *context, uint16_t index, uint16_t valu
 
 void write_cram_internal(vdp_context * context, uint16_t addr, uint16_t value)
 {
+	//even writes of the same value change output when they produce a CRAM dot
+	output_changed(context);
 	context->cram[addr] = value;
 	update_color_map(context, addr, value);
 }
@@ -854,6 +1035,7 @@ static void vdp_check_update_sat(vdp_context *context, uint32_t address, uint16_
 				cache_address = (cache_address & 3) | (cache_address >> 1 & 0x1FC);
 				context->sat_cache[cache_address] = value >> 8;
 				context->sat_cache[cache_address^1] = value;
+				update_sprite_lines(context, cache_address);
 			}
 		}
 	}
@@ -868,6 +1050,7 @@ void vdp_check_update_sat_byte(vdp_context *context, uint32_t address, uint8_t v
 				uint16_t cache_address = address - sat_address;
 				cache_address = (cache_address & 3) | (cache_address >> 1 & 0x1FC);
 				context->sat_cache[cache_address] = value;
+				update_sprite_lines(context, cache_address);
 			}
 		}
 	}
@@ -878,7 +1061,11 @@ static void write_vram_word(vdp_context *context, uint32_t address, uint16_t val
 	address = (address & 0x3FC) | (address >> 1 & 0xFC01) | (address >> 9 & 0x2);
 	address ^= 1;
 	//TODO: Support an option to actually have 128KB of VRAM
-	context->vdpmem[address] = value;
+	if (context->vdpmem[address] != (uint8_t)value) {
+		context->vdpmem[address] = value;
+		context->debug_vram_dirty[address >> 10] |= 1 << (address >> 5 & 31);
+		output_changed(context);
+	}
 }
 
 static void write_vram_byte(vdp_context *context, uint32_t address, uint8_t value)
@@ -888,7 +1075,11 @@ static void write_vram_byte(vdp_context *context, uint32_t address, uint8_t valu
 	} else {
 		address = mode4_address_map[address & 0x3FFF];
 	}
-	context->vdpmem[address] = value;
+	if (context->vdpmem[address] != value) {
+		context->vdpmem[address] = value;
+		context->debug_vram_dirty[address >> 10] |= 1 << (address >> 5 & 31);
+		output_changed(context);
+	}
 }
 
 #define DMA_FILL 0x80
@@ -947,6 +1138,7 @@ static void external_slot(vdp_context * context)
 		}
 		case VSRAM_WRITE:
 			if (((start->address/2) & 63) < context->vsram_size) {
+				uint16_t old_vsram = context->vsram[(start->address/2) & 63];
 				//printf("VSRAM Write: %X to %X @ frame: %d, vcounter: %d, hslot: %d, cycle: %d\n", start->value, start->address, context->frame, context->vcounter, context->hslot, context->cycles);
 				if (start->partial == 3) {
 					if (start->address & 1) {
@@ -959,6 +1151,9 @@ static void external_slot(vdp_context * context)
 				} else {
 					context->vsram[(start->address/2) & 63] = start->partial ? context->fifo[context->fifo_write].value : start->value;
 				}
+				if (context->vsram[(start->address/2) & 63] != old_vsram) {
+					output_changed(context);
+				}
 				uint8_t buffer[3] = {((start->address/2) & 63) + 128, context->vsram[(start->address/2) & 63] >> 8, context->vsram[(start->address/2) & 63]};
 				event_log(EVENT_VDP_INTRAM, context->cycles, sizeof(buffer), buffer);
 			}
@@ -1051,7 +1246,7 @@ static void run_dma_src(vdp_context * context, int32_t slot)
 			cur = context->fifo + context->fifo_write;
 			cur->cycle = context->cycles + ((context->regs[REG_MODE_4] & BIT_H40) ? 16 : 20)*FIFO_LATENCY;
 			cur->address = context->address;
-			cur->value = read_dma_value((context->regs[REG_DMASRC_H] << 16) | (context->regs[REG_DMASRC_M] << 8) | context->regs[REG_DMASRC_L]);
+			cur->value = read_dma_value(context->system, (context->regs[REG_DMASRC_H] << 16) | (context->regs[REG_DMASRC_M] << 8) | context->regs[REG_DMASRC_L]);
 			cur->cd = context->cd;
 			cur->partial = 0;
 			if (context->fifo_read < 0) {
@@ -1282,7 +1477,8 @@ static void fetch_map_mode4(uint16_t col, uint32_t line, vdp_context *context)
 	context->fetch_tmp[1] = context->vdpmem[address+1];
 }
 
-static uint8_t composite_normal(vdp_context *context, uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
+//debug_dst can be NULL when the layer debug view is closed, the callers below are specialized on that
+static inline uint8_t composite_normal(vdp_context *context, uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
 {
 	uint8_t pixel = bg_index;
 	uint8_t src = DBG_SRC_BG;
@@ -1298,14 +1494,16 @@ static uint8_t composite_normal(vdp_context *context, uint8_t *debug_dst, uint8_
 		pixel = sprite;
 		src = DBG_SRC_S;
 	}
-	*debug_dst = src;
+	if (debug_dst) {
+		*debug_dst = src;
+	}
 	return pixel;
 }
 typedef struct {
 	uint8_t index, intensity;
 } sh_pixel;
 
-static sh_pixel composite_highlight(vdp_context *context, uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
+static inline sh_pixel composite_highlight(vdp_context *context, uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
 {
 	uint8_t pixel = bg_index;
 	uint8_t src = DBG_SRC_BG;
@@ -1335,18 +1533,22 @@ static sh_pixel composite_highlight(vdp_context *context, uint8_t *debug_dst, ui
 			}
 		}
 	}
-	*debug_dst = src;
+	if (debug_dst) {
+		*debug_dst = src;
+	}
 	return (sh_pixel){.index = pixel, .intensity = intensity};
 }
 
-static void render_normal(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off)
+static inline void render_normal_common(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off)
 {
 	uint8_t *sprite_buf = context->linebuf + col * 8;
 	if (!col && (context->regs[REG_MODE_1] & BIT_COL0_MASK)) {
 		memset(dst, 0, 8);
-		memset(debug_dst, DBG_SRC_BG, 8);
+		if (debug_dst) {
+			memset(debug_dst, DBG_SRC_BG, 8);
+			debug_dst += 8;
+		}
 		dst += 8;
-		debug_dst += 8;
 		sprite_buf += 8;
 		plane_a_off += 8;
 		plane_b_off += 8;
@@ -1356,7 +1558,9 @@ static void render_normal(vdp_context *context, int32_t col, uint8_t *dst, uint8
 			plane_a = context->tmp_buf_a[plane_a_off & SCROLL_BUFFER_MASK];
 			plane_b = context->tmp_buf_b[plane_b_off & SCROLL_BUFFER_MASK];
 			*(dst++) = composite_normal(context, debug_dst, *sprite_buf, plane_a, plane_b, context->regs[REG_BG_COLOR]) & 0x3F;
-			debug_dst++;
+			if (debug_dst) {
+				debug_dst++;
+			}
 		}
 	} else {
 		for (int i = 0; i < 16; ++plane_a_off, ++plane_b_off, ++sprite_buf, ++i)
@@ -1365,19 +1569,23 @@ static void render_normal(vdp_context *context, int32_t col, uint8_t *dst, uint8
 			plane_a = context->tmp_buf_a[plane_a_off & SCROLL_BUFFER_MASK];
 			plane_b = context->tmp_buf_b[plane_b_off & SCROLL_BUFFER_MASK];
 			*(dst++) = composite_normal(context, debug_dst, *sprite_buf, plane_a, plane_b, context->regs[REG_BG_COLOR]) & 0x3F;
-			debug_dst++;
+			if (debug_dst) {
+				debug_dst++;
+			}
 		}
 	}
 }
 
-static void render_highlight(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off)
+static inline void render_highlight_common(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off)
 {
 	int start = 0;
 	if (!col && (context->regs[REG_MODE_1] & BIT_COL0_MASK)) {
 		memset(dst, SHADOW_OFFSET + (context->regs[REG_BG_COLOR] & 0x3F), 8);
-		memset(debug_dst, DBG_SRC_BG | DBG_SHADOW, 8);
+		if (debug_dst) {
+			memset(debug_dst, DBG_SRC_BG | DBG_SHADOW, 8);
+			debug_dst += 8;
+		}
 		dst += 8;
-		debug_dst += 8;
 		start = 8;
 	}
 	uint8_t *sprite_buf = context->linebuf + col * 8 + start;
@@ -1396,11 +1604,41 @@ static void render_highlight(vdp_context *context, int32_t col, uint8_t *dst, ui
 		} else {
 			final_pixel = (pixel.index & 0x3F) + SHADOW_OFFSET;
 		}
-		debug_dst++;
+		if (debug_dst) {
+			debug_dst++;
+		}
 		*(dst++) = final_pixel;
 	}
 }
 
+typedef void (*composite_fun)(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off);
+
+static void render_normal(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off)
+{
+	render_normal_common(context, col, dst, debug_dst, plane_a_off, plane_b_off);
+}
+
+static void render_normal_nodebug(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off)
+{
+	render_normal_common(context, col, dst, NULL, plane_a_off, plane_b_off);
+}
+
+static void render_highlight(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off)
+{
+	render_highlight_common(context, col, dst, debug_dst, plane_a_off, plane_b_off);
+}
+
+static void render_highlight_nodebug(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off)
+{
+	render_highlight_common(context, col, dst, NULL, plane_a_off, plane_b_off);
+}
+
+//indexed by whether the layer debug view is open and then by whether highlight mode is enabled
+static composite_fun const composite_funs[2][2] = {
+	{render_normal_nodebug, render_highlight_nodebug},
+	{render_normal, render_highlight}
+};
+
 static void render_testreg(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, int plane_a_off, int plane_b_off, uint8_t output_disabled, uint8_t test_layer)
 {
 	if (output_disabled) {
@@ -1637,18 +1875,16 @@ static void render_map_output(uint32_t line, int32_t col, vdp_context * context)
 		plane_b_off = context->buf_b_off - context->hscroll_b_fine;
 		//printf("A | tmp_buf offset: %d\n", 8 - (context->hscroll_a & 0x7));
 
-		if (context->regs[REG_MODE_4] & BIT_HILIGHT) {
-			if (output_disabled || test_layer) {
+		if (output_disabled || test_layer) {
+			if (context->regs[REG_MODE_4] & BIT_HILIGHT) {
 				render_testreg_highlight(context, col, dst, debug_dst, plane_a_off, plane_b_off, output_disabled, test_layer);
 			} else {
-				render_highlight(context, col, dst, debug_dst, plane_a_off, plane_b_off);
-			}
-		} else {
-			if (output_disabled || test_layer) {
 				render_testreg(context, col, dst, debug_dst, plane_a_off, plane_b_off, output_disabled, test_layer);
-			} else {
-				render_normal(context, col, dst, debug_dst, plane_a_off, plane_b_off);
 			}
+		} else {
+			composite_funs[context->enabled_debuggers >> VDP_DEBUG_COMPOSITE & 1][(context->regs[REG_MODE_4] & BIT_HILIGHT) != 0](
+				context, col, dst, debug_dst, plane_a_off, plane_b_off
+			);
 		}
 		dst += 16;
 	} else {
@@ -1886,11 +2122,34 @@ static void vdp_advance_line(vdp_context *context)
 	}
 }
 
+static uint8_t debug_tile_dirty(vdp_context *context, uint16_t tile)
+{
+	return context->debug_vram_dirty[tile >> 5] >> (tile & 31) & 1;
+}
+
+static void debug_cache_present(vdp_context *context, uint8_t debug_type, uint32_t width, uint32_t height)
+{
+	uint32_t pitch;
+	uint32_t *fb = render_get_framebuffer(context->debug_fb_indices[debug_type], &pitch);
+	uint32_t *src = context->debug_cache[debug_type];
+	for (uint32_t y = 0; y < height; y++)
+	{
+		memcpy(fb, src, width * sizeof(uint32_t));
+		fb += pitch / sizeof(uint32_t);
+		src += width;
+	}
+	render_framebuffer_updated(context->debug_fb_indices[debug_type], width);
+}
+
 static void vdp_update_per_frame_debug(vdp_context *context)
 {
+	if (context->enabled_debuggers & (1 << VDP_DEBUG_PLANE | 1 << VDP_DEBUG_VRAM | 1 << VDP_DEBUG_CRAM)) {
+		if (memcmp(context->debug_colors, context->colors, sizeof(context->colors))) {
+			memcpy(context->debug_colors, context->colors, sizeof(context->colors));
+			context->debug_valid = 0;
+		}
+	}
 	if (context->enabled_debuggers & (1 << VDP_DEBUG_PLANE)) {
-		uint32_t pitch;
-		uint32_t *fb = render_get_framebuffer(context->debug_fb_indices[VDP_DEBUG_PLANE], &pitch);
 		uint16_t hscroll_mask;
 		uint16_t v_mul;
 		uint16_t vscroll_mask = 0x1F | (context->regs[REG_SCROLL] & 0x30) << 1;
@@ -1937,6 +2196,17 @@ static void vdp_update_per_frame_debug(vdp_context *context)
 			vscroll_mask = 0x1F;
 			break;
 		}
+		uint64_t key = (uint64_t)context->regs[REG_BG_COLOR & 0x3F] << 48 | (uint64_t)table_address << 32
+			| v_mul << 16 | hscroll_mask << 8 | vscroll_mask;
+		uint8_t full = !(context->debug_valid & (1 << VDP_DEBUG_PLANE)) || key != context->debug_plane_key;
+		if (!context->debug_cache[VDP_DEBUG_PLANE]) {
+			context->debug_cache[VDP_DEBUG_PLANE] = malloc(1024 * 1024 * sizeof(uint32_t));
+			full = 1;
+		}
+		context->debug_plane_key = key;
+		context->debug_valid |= 1 << VDP_DEBUG_PLANE;
+		uint8_t changed = full;
+		uint32_t *fb = context->debug_cache[VDP_DEBUG_PLANE];
 		uint32_t bg_color = context->colors[context->regs[REG_BG_COLOR & 0x3F]];
 		for (uint16_t row = 0; row < 128; row++)
 		{
@@ -1947,9 +2217,13 @@ static void vdp_update_per_frame_debug(vdp_context *context)
 				//pccv hnnn nnnn nnnn
 				//
 				uint16_t entry = context->vdpmem[address] << 8 | context->vdpmem[address + 1];
+				if (!full && !debug_tile_dirty(context, address >> 5) && !debug_tile_dirty(context, entry & 0x7FF)) {
+					continue;
+				}
+				changed = 1;
 				uint8_t pal = entry >> 9 & 0x30;
 				
-				uint32_t *dst = fb + (row * pitch * 8 / sizeof(uint32_t)) + col * 8;
+				uint32_t *dst = fb + row * 1024 * 8 + col * 8;
 				address = (entry & 0x7FF) * 32;
 				int y_diff = 4;
 				if (entry & 0x1000) {
@@ -1981,26 +2255,37 @@ static void vdp_update_per_frame_debug(vdp_context *context)
 						*(row_dst++) = right ? context->colors[right|pal] : bg_color;
 					}
 					address += y_diff;
-					dst += pitch / sizeof(uint32_t);
+					dst += 1024;
 				}
 			}
 		}
-		render_framebuffer_updated(context->debug_fb_indices[VDP_DEBUG_PLANE], 1024);
+		if (changed) {
+			debug_cache_present(context, VDP_DEBUG_PLANE, 1024, 1024);
+		}
 	}
 	
 	if (context->enabled_debuggers & (1 << VDP_DEBUG_VRAM)) {
-		uint32_t pitch;
-		uint32_t *fb = render_get_framebuffer(context->debug_fb_indices[VDP_DEBUG_VRAM], &pitch);
-		
+		uint8_t full = !(context->debug_valid & (1 << VDP_DEBUG_VRAM));
+		if (!context->debug_cache[VDP_DEBUG_VRAM]) {
+			context->debug_cache[VDP_DEBUG_VRAM] = malloc(1024 * 512 * sizeof(uint32_t));
+			full = 1;
+		}
+		context->debug_valid |= 1 << VDP_DEBUG_VRAM;
+		uint8_t changed = full;
+		uint32_t *fb = context->debug_cache[VDP_DEBUG_VRAM];
 		uint8_t pal = (context->debug_modes[VDP_DEBUG_VRAM] % 4) << 4;
-		for (int y = 0; y < 512; y++)
+		for (uint16_t tile = 0; tile < VRAM_SIZE / 32; tile++)
 		{
-			uint32_t *line = fb + y * pitch / sizeof(uint32_t);
-			int row = y >> 4;
-			int yoff = y >> 1 & 7;
-			for (int col = 0; col < 64; col++)
+			if (!full && !debug_tile_dirty(context, tile)) {
+				continue;
+			}
+			changed = 1;
+			//each tile is drawn at double size in a 64 tile wide grid
+			uint32_t *dst = fb + (tile >> 6) * 16 * 1024 + (tile & 63) * 16;
+			for (int y = 0; y < 16; y++)
 			{
-				uint16_t address = (row * 64 + col) * 32 + yoff * 4;
+				uint32_t *line = dst + y * 1024;
+				uint16_t address = tile * 32 + (y >> 1) * 4;
 				for (int x = 0; x < 4; x++)
 				{
 					uint8_t byte = context->vdpmem[address++];
@@ -2013,11 +2298,19 @@ static void vdp_update_per_frame_debug(vdp_context *context)
 				}
 			}
 		}
-		
-		render_framebuffer_updated(context->debug_fb_indices[VDP_DEBUG_VRAM], 1024);
+		if (changed) {
+			debug_cache_present(context, VDP_DEBUG_VRAM, 1024, 512);
+		}
 	}
+	memset(context->debug_vram_dirty, 0, sizeof(context->debug_vram_dirty));
 	
-	if (context->enabled_debuggers & (1 << VDP_DEBUG_CRAM)) {
+	uint8_t mode5 = (context->regs[REG_MODE_2] & BIT_MODE_5) != 0;
+	if (mode5 != context->debug_cram_mode5) {
+		context->debug_cram_mode5 = mode5;
+		context->debug_valid &= ~(1 << VDP_DEBUG_CRAM);
+	}
+	if (context->enabled_debuggers & (1 << VDP_DEBUG_CRAM) && !(context->debug_valid & (1 << VDP_DEBUG_CRAM))) {
+		context->debug_valid |= 1 << VDP_DEBUG_CRAM;
 		uint32_t starting_line = 512 - 32*4;
 		uint32_t *line = context->debug_fbs[VDP_DEBUG_CRAM] 
 			+ context->debug_fb_pitch[VDP_DEBUG_CRAM]  * starting_line / sizeof(uint32_t);
@@ -2084,6 +2377,7 @@ void vdp_force_update_framebuffer(vdp_context *context)
 	if (!context->fb) {
 		return;
 	}
+	flush_output_line(context);
 	uint16_t lines_max = context->inactive_start + context->border_bot + context->border_top;
 			
 	uint16_t to_fill = lines_max - context->output_lines;
@@ -2092,13 +2386,44 @@ void vdp_force_update_framebuffer(vdp_context *context)
 		0,
 		to_fill * context->output_pitch
 	);
-	render_framebuffer_updated(context->cur_buffer, context->h40_lines > context->output_lines / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
-	context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
+	context->line_number = VDP_NO_LINE;
+	output_changed(context);
+	framebuffer_updated(context, context->h40_lines > context->output_lines / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
+	acquire_framebuffer(context);
 	vdp_update_per_frame_debug(context);
 }
 
+static void start_output_line(vdp_context *context, uint32_t output_line)
+{
+	context->line_number = output_line < VDP_MAX_OUTPUT_LINES ? output_line : VDP_NO_LINE;
+	context->line_start_gen = context->output_gen;
+}
+
+static void finish_output_line(vdp_context *context)
+{
+	if (context->line_number == VDP_NO_LINE) {
+		return;
+	}
+	//a line is unchanged from the last frame of the same field if it was drawn from the same VDP state
+	//and nothing affecting output was touched while either copy was being drawn
+	uint32_t *line_gen = context->line_gen[context->cur_buffer] + context->line_number;
+	uint8_t changed = context->output_gen != context->line_start_gen;
+	if (changed || *line_gen != context->line_start_gen) {
+		if (context->line_number < context->dirty_first) {
+			context->dirty_first = context->line_number;
+		}
+		if (context->line_number > context->dirty_last) {
+			context->dirty_last = context->line_number;
+		}
+	}
+	*line_gen = changed ? 0 : context->line_start_gen;
+	context->line_number = VDP_NO_LINE;
+}
+
 static void advance_output_line(vdp_context *context)
 {
+	finish_output_line(context);
+	flush_output_line(context);
 	//This function is kind of gross because of the need to deal with vertical border busting via mode changes
 	uint16_t lines_max = context->inactive_start + context->border_bot + context->border_top;
 	uint32_t output_line = context->vcounter;
@@ -2109,17 +2434,27 @@ static void advance_output_line(vdp_context *context)
 	
 	if (context->output_lines >= lines_max || (!context->pushed_frame && output_line == context->inactive_start + context->border_top)) {
 		//we've either filled up a full frame or we're at the bottom of screen in the current defined mode + border crop
-		if (!headless) {
-			render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
-			uint8_t is_even = context->flags2 & FLAG2_EVEN_FIELD;
-			if (context->vcounter <= context->inactive_start && (context->regs[REG_MODE_4] & BIT_INTERLACE)) {
-				is_even = !is_even;
+		if (context->sink || !headless) {
+			if (!context->suppress_output) {
+				if (!context->sink) {
+					render_framebuffer_dirty_lines(context->cur_buffer, context->dirty_first, context->dirty_last);
+				}
+				framebuffer_updated(context, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
+				//lines drawn in frames that aren't shown stay dirty until one is
+				context->dirty_first = VDP_NO_LINE;
+				context->dirty_last = 0;
+				uint8_t is_even = context->flags2 & FLAG2_EVEN_FIELD;
+				if (context->vcounter <= context->inactive_start && (context->regs[REG_MODE_4] & BIT_INTERLACE)) {
+					is_even = !is_even;
+				}
+				context->cur_buffer = is_even ? FRAMEBUFFER_EVEN : FRAMEBUFFER_ODD;
+				context->fb = NULL;
 			}
-			context->cur_buffer = is_even ? FRAMEBUFFER_EVEN : FRAMEBUFFER_ODD;
 			context->pushed_frame = 1;
-			context->fb = NULL;
 		}
-		vdp_update_per_frame_debug(context);
+		if (!context->suppress_output) {
+			vdp_update_per_frame_debug(context);
+		}
 		context->h40_lines = 0;
 		context->frame++;
 		context->output_lines = 0;
@@ -2149,10 +2484,11 @@ static void advance_output_line(vdp_context *context)
 		return;
 	}
 	if (!context->fb) {
-		context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
+		acquire_framebuffer(context);
 	}
 	output_line += context->top_offset;
-	context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * output_line);
+	set_output_line(context, output_line);
+	start_output_line(context, output_line);
 #ifdef DEBUG_FB_FILL
 	for (int i = 0; i < LINEBUF_SIZE; i++)
 	{
@@ -2166,8 +2502,12 @@ static void advance_output_line(vdp_context *context)
 
 void vdp_release_framebuffer(vdp_context *context)
 {
+	//the rest of this line will be drawn into whatever buffer is reacquired so it can't be tracked
+	context->line_number = VDP_NO_LINE;
+	output_changed(context);
 	if (context->fb) {
-		render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
+		flush_output_line(context);
+		framebuffer_updated(context, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
 		context->output = context->fb = NULL;
 	}
 }
@@ -2176,8 +2516,8 @@ void vdp_reacquire_framebuffer(vdp_context *context)
 {
 	uint16_t lines_max = context->inactive_start + context->border_bot + context->border_top;
 	if (context->output_lines <= lines_max && context->output_lines > 0) {
-		context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
-		context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * (context->output_lines - 1 + context->top_offset));
+		acquire_framebuffer(context);
+		set_output_line(context, context->output_lines - 1 + context->top_offset);
 	} else {
 		context->output = NULL;
 	}
@@ -2431,7 +2771,7 @@ static void draw_right_border(vdp_context *context)
 		if ((slot) == BG_START_SLOT + LINEBUF_SIZE/2) {\
 			advance_output_line(context);\
 			if (!context->output) {\
-				context->output = dummy_buffer;\
+				context->output = context->dummy_line;\
 			}\
 		}\
 		if (slot == 168 || slot == 247 || slot == 248) {\
@@ -2469,7 +2809,7 @@ static void draw_right_border(vdp_context *context)
 		if ((slot) == BG_START_SLOT + (256+HORIZ_BORDER)/2) {\
 			advance_output_line(context);\
 			if (!context->output) {\
-				context->output = dummy_buffer;\
+				context->output = context->dummy_line;\
 			}\
 		}\
 		if (slot == 136 || slot == 247 || slot == 248) {\
@@ -2503,7 +2843,7 @@ static void draw_right_border(vdp_context *context)
 		if ((slot) == BG_START_SLOT + (256+HORIZ_BORDER)/2) {\
 			advance_output_line(context);\
 			if (!context->output) {\
-				context->output = dummy_buffer;\
+				context->output = context->dummy_line;\
 			}\
 		}\
 		if ((slot) == 147) {\
@@ -2548,7 +2888,6 @@ static void draw_right_border(vdp_context *context)
 		render_sprite_cells_mode4(context);\
 		MODE4_CHECK_SLOT_LINE(CALC_SLOT(slot, 5))
 
-static uint32_t dummy_buffer[LINEBUF_SIZE];
 static void vdp_h40_line(vdp_context * context)
 {
 	uint16_t address;
@@ -2753,7 +3092,7 @@ static void vdp_h40(vdp_context * context, uint32_t target_cycles)
 	if (!context->output) {
 		//This shouldn't happen normally, but it can theoretically
 		//happen when doing border busting
-		context->output = dummy_buffer;
+		context->output = context->dummy_line;
 	}
 	switch(context->hslot)
 	{
@@ -2967,6 +3306,205 @@ static void vdp_h40(vdp_context * context, uint32_t target_cycles)
 	}
 }
 
+static void vdp_h32_line(vdp_context * context)
+{
+	uint16_t address;
+	uint32_t mask;
+	uint8_t bgindex = context->regs[REG_BG_COLOR] & 0x3F;
+	uint8_t test_layer = context->test_port >> 7 & 3;
+	
+	//133
+	render_sprite_cells(context);
+	//134
+	render_sprite_cells(context);
+	//135
+	context->sprite_index = 0x80;
+	context->slot_counter = 0;
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_b, context->buf_b_off,
+		context->col_1
+	);
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//136
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_b,
+		context->buf_b_off + 8,
+		context->col_2
+	);
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//137
+	draw_right_border(context);
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//Do palette lookup for end of previous line
+	uint8_t *src = context->compositebuf + (LINE_CHANGE_H32 - BG_START_SLOT) *2;
+	uint32_t *dst = context->output + (LINE_CHANGE_H32 - BG_START_SLOT) *2;
+	if (test_layer) {
+		for (int i = 0; i < 256 + HORIZ_BORDER - (LINE_CHANGE_H32 - BG_START_SLOT) * 2; i++)
+		{
+			*(dst++) = context->colors[*(src++)];
+		}
+	} else {
+		for (int i = 0; i < 256 + HORIZ_BORDER - (LINE_CHANGE_H32 - BG_START_SLOT) * 2; i++)
+		{
+			if (*src & 0x3F) {
+				*(dst++) = context->colors[*(src++)];
+			} else {
+				*(dst++) = context->colors[(*(src++) & 0xC0) | bgindex];
+			}
+		}
+	}
+	advance_output_line(context);
+	if (!context->output) {
+		context->output = context->dummy_line;
+	}
+	//138-147 and 233-242 (inclusive), 145 is an external slot
+	for (int i = 0; i < 19; i++)
+	{
+		render_sprite_cells(context);
+		scan_sprite_table(context->vcounter, context);
+	}
+	//243
+	if (!(context->regs[REG_MODE_3] & BIT_VSCROLL)) {
+		//See note in vdp_h32 for why this happens here
+		context->vscroll_latch[0] = context->vsram[0];
+		context->vscroll_latch[1] = context->vsram[1];
+	}
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_a,
+		context->buf_a_off,
+		context->col_1
+	);
+	//244
+	address = (context->regs[REG_HSCROLL] & 0x3F) << 10;
+	mask = 0;
+	if (context->regs[REG_MODE_3] & 0x2) {
+		mask |= 0xF8;
+	}
+	if (context->regs[REG_MODE_3] & 0x1) {
+		mask |= 0x7;
+	}
+	render_border_garbage(context, address, context->tmp_buf_a, context->buf_a_off+8, context->col_2);
+	address += (context->vcounter & mask) * 4;
+	context->hscroll_a = context->vdpmem[address] << 8 | context->vdpmem[address+1];
+	context->hscroll_a_fine = context->hscroll_a & 0xF;
+	context->hscroll_b = context->vdpmem[address+2] << 8 | context->vdpmem[address+3];
+	context->hscroll_b_fine = context->hscroll_b & 0xF;
+	//245-246
+	for (int i = 0; i < 2; i++)
+	{
+		render_sprite_cells(context);
+		scan_sprite_table(context->vcounter, context);
+	}
+	//247
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_b,
+		context->buf_b_off,
+		context->col_1
+	);
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//248
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_b,
+		context->buf_b_off + 8,
+		context->col_2
+	);
+	context->buf_a_off = (context->buf_a_off + SCROLL_BUFFER_DRAW) & SCROLL_BUFFER_MASK;
+	context->buf_b_off = (context->buf_b_off + SCROLL_BUFFER_DRAW) & SCROLL_BUFFER_MASK;
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//249
+	read_map_scroll_a(0, context->vcounter, context);
+	//250
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//251
+	if (context->cur_slot >= 0 && context->sprite_draw_list[context->cur_slot].x_pos) {
+		context->flags |= FLAG_DOT_OFLOW;
+	}
+	render_map_1(context);
+	scan_sprite_table(context->vcounter, context);//Just a guess
+	//252
+	render_map_2(context);
+	scan_sprite_table(context->vcounter, context);//Just a guess
+	//253
+	read_map_scroll_b(0, context->vcounter, context);
+	//254
+	render_sprite_cells(context);
+	scan_sprite_table(context->vcounter, context);
+	//255
+	render_map_3(context);
+	scan_sprite_table(context->vcounter, context);//Just a guess
+	//0
+	render_map_output(context->vcounter, 0, context);
+	scan_sprite_table(context->vcounter, context);//Just a guess
+	context->cur_slot = context->slot_counter;
+	context->sprite_x_offset = 0;
+	context->sprite_draws = MAX_SPRITES_LINE_H32;
+	//1-128, background planes, layer compositing and sprite rendering phase 2
+	for (int col = 2; col < 34; col+=2)
+	{
+		read_map_scroll_a(col, context->vcounter, context);
+		render_map_1(context);
+		render_map_2(context);
+		read_map_scroll_b(col, context->vcounter, context);
+		read_sprite_x(context->vcounter, context);
+		render_map_3(context);
+		render_map_output(context->vcounter, col, context);
+	}
+	//131
+	context->cur_slot = MAX_SPRITES_LINE_H32-1;
+	memset(context->linebuf, 0, LINEBUF_SIZE);
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_a, context->buf_a_off,
+		context->col_1
+	);
+	context->flags &= ~FLAG_MASKED;
+	render_sprite_cells(context);
+	//132
+	render_border_garbage(
+		context,
+		context->sprite_draw_list[context->cur_slot].address,
+		context->tmp_buf_a, context->buf_a_off + 8,
+		context->col_2
+	);
+	render_sprite_cells(context);
+	context->cycles += MCLKS_LINE;
+	vdp_advance_line(context);
+	src = context->compositebuf;
+	dst = context->output;
+	if (test_layer) {
+		for (int i = 0; i < (LINE_CHANGE_H32 - BG_START_SLOT) * 2; i++)
+		{
+			*(dst++) = context->colors[*(src++)];
+		}
+	} else {
+		for (int i = 0; i < (LINE_CHANGE_H32 - BG_START_SLOT) * 2; i++)
+		{
+			if (*src & 0x3F) {
+				*(dst++) = context->colors[*(src++)];
+			} else {
+				*(dst++) = context->colors[(*(src++) & 0xC0) | bgindex];
+			}
+		}
+	}
+}
+
 static void vdp_h32(vdp_context * context, uint32_t target_cycles)
 {
 	uint16_t address;
@@ -2977,13 +3515,20 @@ static void vdp_h32(vdp_context * context, uint32_t target_cycles)
 	if (!context->output) {
 		//This shouldn't happen normally, but it can theoretically
 		//happen when doing border busting
-		context->output = dummy_buffer;
+		context->output = context->dummy_line;
 	}
 	switch(context->hslot)
 	{
 	for (;;)
 	{
 	case 133:
+		//only consider doing a line at a time if the FIFO is empty, there are no pending reads and there is no DMA running
+		if (context->fifo_read == -1 && !(context->flags & FLAG_DMA_RUN) && ((context->cd & 1) || (context->flags & FLAG_READ_FETCHED))) {
+			while (target_cycles - context->cycles >= MCLKS_LINE && context->state != PREPARING && context->vcounter != context->inactive_start) {
+				vdp_h32_line(context);
+			}
+			CHECK_ONLY
+		}
 		OUTPUT_PIXEL(133)
 		if (context->state == PREPARING) {
 			external_slot(context);
@@ -3194,7 +3739,7 @@ static void vdp_h32_mode4(vdp_context * context, uint32_t target_cycles)
 	if (!context->output) {
 		//This shouldn't happen normally, but it can theoretically
 		//happen when doing border busting
-		context->output = dummy_buffer;
+		context->output = context->dummy_line;
 	}
 	switch(context->hslot)
 	{
@@ -3500,6 +4045,10 @@ static void vdp_inactive(vdp_context *context, uint32_t target_cycles, uint8_t i
 			context->pending_vint_start = context->cycles;
 		} else if (context->vcounter == context->inactive_start && context->hslot == 1 && (context->regs[REG_MODE_4] & BIT_INTERLACE)) {
 			context->flags2 ^= FLAG2_EVEN_FIELD;
+			if (context->double_res) {
+				//alternate fields fetch different lines of each tile
+				output_changed(context);
+			}
 		}
 		
 		if (dst) {
@@ -3775,6 +4324,9 @@ int vdp_control_port_write(vdp_context * context, uint16_t value)
 				}*/
 				uint8_t buffer[2] = {reg, value};
 				event_log(EVENT_VDP_REG, context->cycles, sizeof(buffer), buffer);
+				if (reg < REG_DMALEN_L && context->regs[reg] != (uint8_t)value) {
+					output_changed(context);
+				}
 				context->regs[reg] = value;
 				if (reg == REG_MODE_4) {
 					context->double_res = (value & (BIT_INTERLACE | BIT_DOUBLE_RES)) == (BIT_INTERLACE | BIT_DOUBLE_RES);
@@ -3919,6 +4471,9 @@ void vdp_data_port_write_pbc(vdp_context * context, uint8_t value)
 
 void vdp_test_port_write(vdp_context * context, uint16_t value)
 {
+	if (context->test_port != value) {
+		output_changed(context);
+	}
 	context->test_port = value;
 }
 
@@ -4164,7 +4719,9 @@ uint32_t vdp_next_hint(vdp_context * context)
 		}
 	} else {
 		hint_line = context->vcounter + context->hint_counter + 1;
-		if (context->vcounter < context->inactive_start) {
+		//the display stays active for part of the first inactive line, but the counter is reloaded
+		//rather than decremented at the end of it so the next interrupt is in the next frame
+		if (context->vcounter <= context->inactive_start) {
 			if (hint_line > context->inactive_start) {
 				hint_line = context->regs[REG_HINT];
 				if (hint_line > context->inactive_start) {
@@ -4418,6 +4975,8 @@ void vdp_deserialize(deserialize_buffer *buf, void *vcontext)
 	}
 	load_buffer16(buf, context->vsram, version > 1 ? MAX_VSRAM_SIZE : MIN_VSRAM_SIZE);
 	load_buffer8(buf, context->sat_cache, SAT_CACHE_SIZE);
+	context->sprite_lines_mode = 0;
+	context->debug_valid = 0;
 	for (int i = 0; i <= REG_DMASRC_H; i++)
 	{
 		context->regs[i] = load_int8(buf);
@@ -4535,6 +5094,56 @@ void vdp_deserialize(deserialize_buffer *buf, void *vcontext)
 	update_video_params(context);
 }
 
+//fifo through tmp_buf_b is emulated state, the fields before it belong to the frontend
+#define VDP_SNAPSHOT_START offsetof(vdp_context, fifo)
+#define VDP_SNAPSHOT_REGS (offsetof(vdp_context, enabled_debuggers) - VDP_SNAPSHOT_START)
+
+uint32_t vdp_snapshot_size(void)
+{
+	return VDP_SNAPSHOT_REGS + 1 + VRAM_SIZE;
+}
+
+uint8_t *vdp_save_snapshot(vdp_context *context, uint8_t *dst)
+{
+	memcpy(dst, ((uint8_t *)context) + VDP_SNAPSHOT_START, VDP_SNAPSHOT_REGS);
+	dst += VDP_SNAPSHOT_REGS;
+	*(dst++) = context->pushed_frame;
+	memcpy(dst, context->vdpmem, VRAM_SIZE);
+	return dst + VRAM_SIZE;
+}
+
+uint8_t *vdp_load_snapshot(vdp_context *context, uint8_t *src)
+{
+	uint8_t cur_buffer = context->cur_buffer;
+	memcpy(((uint8_t *)context) + VDP_SNAPSHOT_START, src, VDP_SNAPSHOT_REGS);
+	src += VDP_SNAPSHOT_REGS;
+	context->pushed_frame = *(src++);
+	if (context->enabled_debuggers & (1 << VDP_DEBUG_PLANE | 1 << VDP_DEBUG_VRAM)) {
+		for (uint16_t tile = 0; tile < VRAM_SIZE / 32; tile++)
+		{
+			if (memcmp(context->vdpmem + tile * 32, src + tile * 32, 32)) {
+				context->debug_vram_dirty[tile >> 5] |= 1 << (tile & 31);
+			}
+		}
+	}
+	memcpy(context->vdpmem, src, VRAM_SIZE);
+	context->line_number = VDP_NO_LINE;
+	context->sprite_lines_mode = 0;
+	output_changed(context);
+	if (context->fb) {
+		//the framebuffer that's currently locked stays in use, so keep drawing into the same one
+		context->cur_buffer = cur_buffer;
+	}
+	uint16_t lines_max = context->inactive_start + context->border_bot + context->border_top;
+	if (context->fb && context->output_lines <= lines_max && context->output_lines > 0) {
+		set_output_line(context, context->output_lines - 1 + context->top_offset);
+	} else {
+		context->output = NULL;
+		context->output_row = NULL;
+	}
+	return src + VRAM_SIZE;
+}
+
 static vdp_context *current_vdp;
 static void vdp_debug_window_close(uint8_t which)
 {
@@ -4553,6 +5162,8 @@ void vdp_toggle_debug_view(vdp_context *context, uint8_t debug_type)
 	if (context->enabled_debuggers & 1 << debug_type) {
 		render_destroy_window(context->debug_fb_indices[debug_type]);
 		context->enabled_debuggers &= ~(1 << debug_type);
+		free(context->debug_cache[debug_type]);
+		context->debug_cache[debug_type] = NULL;
 	} else {
 		uint32_t width,height;
 		uint8_t fetch_immediately = 0;
@@ -4587,6 +5198,7 @@ void vdp_toggle_debug_view(vdp_context *context, uint8_t debug_type)
 		context->debug_fb_indices[debug_type] = render_create_window(caption, width, height, vdp_debug_window_close);
 		if (context->debug_fb_indices[debug_type]) {
 			context->enabled_debuggers |= 1 << debug_type;
+			context->debug_valid &= ~(1 << debug_type);
 		}
 		if (fetch_immediately) {
 			context->debug_fbs[debug_type] = render_get_framebuffer(context->debug_fb_indices[debug_type], &context->debug_fb_pitch[debug_type]);
@@ -4604,6 +5216,7 @@ void vdp_inc_debug_mode(vdp_context *context)
 	{
 		if (context->enabled_debuggers & (1 << i) && context->debug_fb_indices[i] == active) {
 			context->debug_modes[i]++;
+			context->debug_valid &= ~(1 << i);
 			return;
 		}
 	}
@@ -4651,6 +5264,7 @@ void vdp_replay_event(vdp_context *context, uint8_t event, event_reader *reader)
 	{
 	case EVENT_VDP_REG: {
 		uint8_t value = load_int8(buffer);
+		output_changed(context);
 		context->regs[address] = value;
 		if (address == REG_MODE_4) {
 			context->double_res = (value & (BIT_INTERLACE | BIT_DOUBLE_RES)) == (BIT_INTERLACE | BIT_DOUBLE_RES);
@@ -4686,6 +5300,7 @@ void vdp_replay_event(vdp_context *context, uint8_t event, event_reader *reader)
 			write_cram(context, address, load_int16(buffer));
 		} else {
 			context->vsram[address&63] = load_int16(buffer);
+			output_changed(context);
 		}
 		break;
 	}
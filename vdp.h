@@ -163,20 +163,37 @@ enum {
 	VDP_NUM_DEBUG_TYPES
 };
 
+#define VDP_MAX_OUTPUT_LINES 320
+#define VDP_NO_LINE 0xFFFF
+
 typedef struct {
 	system_header  *system;
 	//pointer to current line in framebuffer
 	uint32_t       *output;
 	//pointer to current framebuffer
 	uint32_t       *fb;
+	//when the framebuffer isn't XRGB8888, lines are drawn into output_stage and converted into output_row once finished
+	uint8_t        *output_row;
+	uint32_t       *output_stage;
+	//per-line palettes for FRAMEBUFFER_INDEXED8
+	uint32_t       *palettes;
+	uint32_t       *output_palette;
 	uint8_t        *done_composite;
+	//replaces the render backend for the main framebuffers when set
+	struct video_sink *sink;
 	uint32_t       *debug_fbs[VDP_NUM_DEBUG_TYPES];
 	char           *kmod_msg_buffer;
 	uint32_t       kmod_buffer_storage;
 	uint32_t       kmod_buffer_length;
 	uint32_t       timer_start_cycle;
 	uint32_t       output_pitch;
+	int            palette_pitch;
 	uint32_t       debug_fb_pitch[VDP_NUM_DEBUG_TYPES];
+	//when set, finished frames are not handed to the renderer (used for run-ahead)
+	uint8_t        suppress_output;
+	uint8_t        fb_format;
+	//scratch line for output when there is no framebuffer to draw into
+	uint32_t       dummy_line[LINEBUF_SIZE];
 	fifo_entry     fifo[FIFO_SIZE];
 	int32_t        fifo_write;
 	int32_t        fifo_read;
@@ -245,6 +262,28 @@ typedef struct {
 	uint8_t        debug_fb_indices[VDP_NUM_DEBUG_TYPES];
 	uint8_t        debug_modes[VDP_NUM_DEBUG_TYPES];
 	uint8_t        pushed_frame;
+	//incremented whenever VRAM, CRAM, VSRAM or a register changes in a way that can affect output
+	uint32_t       output_gen;
+	uint32_t       line_start_gen;
+	uint16_t       line_number;
+	uint16_t       dirty_first;
+	uint16_t       dirty_last;
+	//value of output_gen when each line of each field was last drawn, 0 if it changed while it was drawn
+	uint32_t       line_gen[2][VDP_MAX_OUTPUT_LINES];
+	//which sprites in the SAT cache cover each Mode 5 sprite line, one bit per sprite index
+	uint32_t       sprite_lines[1024][(MAX_SPRITES_FRAME + 31) / 32];
+	uint16_t       sprite_line_start[MAX_SPRITES_FRAME];
+	uint16_t       sprite_line_end[MAX_SPRITES_FRAME];
+	//0 when sprite_lines needs a full rebuild, otherwise 1 + the value of double_res it was built for
+	uint8_t        sprite_lines_mode;
+	//debug views keep their own copy of what they drew so only tiles touched since the last frame are redrawn
+	uint32_t       *debug_cache[VDP_NUM_DEBUG_TYPES];
+	uint64_t       debug_plane_key;
+	uint32_t       debug_colors[CRAM_SIZE*4];
+	//one bit per 32-byte VRAM tile written since the debug views were last updated
+	uint32_t       debug_vram_dirty[VRAM_SIZE / (32 * 32)];
+	uint8_t        debug_valid;
+	uint8_t        debug_cram_mode5;
 	uint8_t        vdpmem[];
 } vdp_context;
 
@@ -285,13 +324,18 @@ void vdp_check_update_sat_byte(vdp_context *context, uint32_t address, uint8_t v
 void vdp_pbc_pause(vdp_context *context);
 void vdp_release_framebuffer(vdp_context *context);
 void vdp_reacquire_framebuffer(vdp_context *context);
+void vdp_set_video_sink(vdp_context *context, struct video_sink *sink);
 void vdp_serialize(vdp_context *context, serialize_buffer *buf);
 void vdp_deserialize(deserialize_buffer *buf, void *vcontext);
+//native-endian copies of the VDP state and VRAM for in-process snapshots
+uint32_t vdp_snapshot_size(void);
+uint8_t *vdp_save_snapshot(vdp_context *context, uint8_t *dst);
+uint8_t *vdp_load_snapshot(vdp_context *context, uint8_t *src);
 void vdp_force_update_framebuffer(vdp_context *context);
 void vdp_toggle_debug_view(vdp_context *context, uint8_t debug_type);
 void vdp_inc_debug_mode(vdp_context *context);
 //to be implemented by the host system
-uint16_t read_dma_value(uint32_t address);
+uint16_t read_dma_value(system_header *system, uint32_t address);
 void vdp_replay_event(vdp_context *context, uint8_t event, event_reader *reader);
 
 #endif //VDP_H_
@@ -0,0 +1,401 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "vdp.h"
+#include "render.h"
+#include "util.h"
+
+//Runs the VDP on its own with synthetic workloads and reports how long it takes to emulate a line and a frame
+//for each one. Nothing else is emulated, so this measures VDP changes without the noise of the CPU cores.
+//The scene contents come from a fixed seed so every run and every build draws exactly the same frames.
+
+#define FRAMEBUFFER_LINES 512
+#define WARMUP_FRAMES 30
+#define DEFAULT_FRAMES 600
+
+int headless = 0;
+system_header *current_system;
+
+static uint32_t framebuffers[2][LINEBUF_SIZE * FRAMEBUFFER_LINES];
+static uint32_t frames_done;
+static uint8_t frame_pushed;
+static uint32_t rand_state;
+
+uint16_t read_dma_value(system_header *system, uint32_t address)
+{
+	return address ^ address >> 7;
+}
+
+void init_terminal(void)
+{
+}
+
+uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b)
+{
+	return 255 << 24 | r << 16 | g << 8 | b;
+}
+
+uint8_t render_create_window(char *caption, uint32_t width, uint32_t height, window_close_handler close_handler)
+{
+	return 0;
+}
+
+void render_destroy_window(uint8_t which)
+{
+}
+
+uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
+{
+	*pitch = LINEBUF_SIZE * sizeof(uint32_t);
+	return framebuffers[which == FRAMEBUFFER_EVEN];
+}
+
+void render_framebuffer_dirty_lines(uint8_t which, uint32_t first_line, uint32_t last_line)
+{
+}
+
+framebuffer_format render_framebuffer_format(void)
+{
+	return FRAMEBUFFER_XRGB8888;
+}
+
+uint32_t *render_get_palettes(uint8_t which, int *pitch)
+{
+	//FRAMEBUFFER_INDEXED8 is never reported
+	*pitch = 0;
+	return NULL;
+}
+
+void render_framebuffer_updated(uint8_t which, int width)
+{
+	if (which <= FRAMEBUFFER_EVEN) {
+		frames_done++;
+		frame_pushed = 1;
+	}
+}
+
+uint8_t render_get_active_framebuffer(void)
+{
+	return FRAMEBUFFER_ODD;
+}
+
+uint32_t render_overscan_top()
+{
+	return 0;
+}
+
+uint32_t render_overscan_bot()
+{
+	return 0;
+}
+
+void render_errorbox(char *title, char *message)
+{
+}
+
+void render_infobox(char *title, char *message)
+{
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//xorshift32
+static uint32_t next_rand(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static void set_reg(vdp_context *context, uint8_t reg, uint8_t value)
+{
+	vdp_control_port_write(context, 0x8000 | reg << 8 | value);
+}
+
+//cd uses the same bit layout as context->cd, 1 for VRAM writes, 3 for CRAM, 5 for VSRAM, 0x20 set for DMA
+static int set_address(vdp_context *context, uint8_t cd, uint16_t address)
+{
+	vdp_control_port_write(context, (cd & 3) << 14 | (address & 0x3FFF));
+	return vdp_control_port_write(context, (cd & 0x3C) << 2 | address >> 14);
+}
+
+static void fill_random(vdp_context *context, uint8_t cd, uint16_t address, uint32_t words, uint16_t mask)
+{
+	set_address(context, cd, address);
+	for (uint32_t i = 0; i < words; i++)
+	{
+		vdp_data_port_write(context, next_rand() & mask);
+	}
+}
+
+#define PLANE_A  0xC000
+#define PLANE_B  0xE000
+#define SAT      0xF800
+#define HSCROLL  0xFC00
+#define DMA_DEST 0xA000
+
+//two 64x32 scrolling planes of random tiles with per-line horizontal and per-column vertical scroll
+static vdp_context *setup_planes(uint8_t mode_4)
+{
+	rand_state = 0x12345678;
+	vdp_context *context = init_vdp_context(0, 0);
+	set_reg(context, REG_MODE_1, BIT_PAL_SEL);
+	set_reg(context, REG_MODE_2, BIT_MODE_5 | BIT_DMA_ENABLE);
+	set_reg(context, REG_SCROLL_A, PLANE_A >> 10);
+	set_reg(context, REG_WINDOW, 0);
+	set_reg(context, REG_SCROLL_B, PLANE_B >> 13);
+	set_reg(context, REG_SAT, SAT >> 9);
+	set_reg(context, REG_BG_COLOR, 0);
+	set_reg(context, REG_HINT, 0xFF);
+	set_reg(context, REG_MODE_3, BIT_VSCROLL | 3);
+	set_reg(context, REG_MODE_4, mode_4);
+	set_reg(context, REG_HSCROLL, HSCROLL >> 10);
+	set_reg(context, REG_AUTOINC, 2);
+	set_reg(context, REG_SCROLL, 0x01);
+	set_reg(context, REG_WINDOW_H, 0);
+	set_reg(context, REG_WINDOW_V, 0);
+	//patterns
+	fill_random(context, 1, 0, PLANE_A / 2, 0xFFFF);
+	//name tables, tile numbers are kept below the name tables and about a quarter of the tiles have priority
+	set_address(context, 1, PLANE_A);
+	for (uint32_t i = 0; i < 2 * 64 * 32; i++)
+	{
+		uint32_t r = next_rand();
+		uint16_t entry = (r % (PLANE_A / 32)) | (r >> 16 & 0x7800);
+		if (!(r & 0x30000000)) {
+			entry |= 0x8000;
+		}
+		vdp_data_port_write(context, entry);
+	}
+	fill_random(context, 1, HSCROLL, 256 * 2, 0x3FF);
+	fill_random(context, 5, 0, 40, 0x3FF);
+	fill_random(context, 3, 0, 64, 0xEEE);
+	//a single sprite with a link of 0 that sits above the top of the screen
+	set_address(context, 1, SAT);
+	for (int i = 0; i < 4; i++)
+	{
+		vdp_data_port_write(context, 0);
+	}
+	set_reg(context, REG_MODE_2, BIT_DISP_EN | BIT_MODE_5 | BIT_DMA_ENABLE);
+	return context;
+}
+
+//80 linked sprites of random sizes spread over the screen, enough to hit the per-line limits regularly
+static void add_sprites(vdp_context *context)
+{
+	set_address(context, 1, SAT);
+	for (int i = 0; i < 80; i++)
+	{
+		uint32_t r = next_rand();
+		vdp_data_port_write(context, 128 - 16 + r % 256);
+		vdp_data_port_write(context, (r >> 8 & 0xF00) | (i < 79 ? i + 1 : 0));
+		r = next_rand();
+		vdp_data_port_write(context, (r % (PLANE_A / 32)) | (r >> 16 & 0xF800));
+		vdp_data_port_write(context, 128 - 16 + (r >> 11) % 352);
+	}
+}
+
+static vdp_context *setup_blank(void)
+{
+	vdp_context *context = setup_planes(BIT_H40);
+	set_reg(context, REG_MODE_2, BIT_MODE_5 | BIT_DMA_ENABLE);
+	return context;
+}
+
+static vdp_context *setup_h32(void)
+{
+	return setup_planes(0);
+}
+
+static vdp_context *setup_h40(void)
+{
+	return setup_planes(BIT_H40);
+}
+
+static vdp_context *setup_sprites(void)
+{
+	vdp_context *context = setup_planes(BIT_H40);
+	add_sprites(context);
+	return context;
+}
+
+static vdp_context *setup_shadow(void)
+{
+	vdp_context *context = setup_planes(BIT_H40 | BIT_HILIGHT);
+	add_sprites(context);
+	return context;
+}
+
+static vdp_context *setup_interlace(void)
+{
+	vdp_context *context = setup_planes(BIT_H40 | BIT_INTERLACE | BIT_DOUBLE_RES);
+	add_sprites(context);
+	return context;
+}
+
+static void set_dma_length(vdp_context *context, uint16_t length)
+{
+	set_reg(context, REG_DMALEN_L, length);
+	set_reg(context, REG_DMALEN_H, length >> 8);
+}
+
+//each frame DMA work is started right after the frame has been output, so mostly during vblank like a game would
+static void dma_fill(vdp_context *context)
+{
+	set_dma_length(context, 0x1000);
+	set_reg(context, REG_DMASRC_H, 0x80);
+	set_address(context, 0x21, DMA_DEST);
+	vdp_data_port_write(context, next_rand());
+}
+
+static void dma_copy(vdp_context *context)
+{
+	set_dma_length(context, 0x800);
+	set_reg(context, REG_DMASRC_L, (DMA_DEST + 0x1000) & 0xFF);
+	set_reg(context, REG_DMASRC_M, (DMA_DEST + 0x1000) >> 8);
+	set_reg(context, REG_DMASRC_H, 0xC0);
+	set_address(context, 0x30, DMA_DEST);
+}
+
+static void dma_68k(vdp_context *context)
+{
+	//0xFF0000, the start of work RAM
+	set_dma_length(context, 0x800);
+	set_reg(context, REG_DMASRC_L, 0);
+	set_reg(context, REG_DMASRC_M, 0x80);
+	set_reg(context, REG_DMASRC_H, 0x7F);
+	if (set_address(context, 0x21, DMA_DEST)) {
+		//the 68K would be stalled until the transfer is done
+		vdp_run_dma_done(context, context->cycles + MCLKS_LINE * 313);
+	}
+}
+
+typedef struct {
+	char        *name;
+	char        *description;
+	vdp_context *(*setup)(void);
+	void        (*frame_start)(vdp_context *context);
+} scenario;
+
+static scenario scenarios[] = {
+	{"blank", "H40 with the display disabled", setup_blank, NULL},
+	{"h32_planes", "H32, both planes with line scroll and column vscroll", setup_h32, NULL},
+	{"h40_planes", "H40, both planes with line scroll and column vscroll", setup_h40, NULL},
+	{"h40_sprites", "H40 planes and 80 sprites", setup_sprites, NULL},
+	{"h40_shadow", "H40 planes and 80 sprites in shadow/highlight mode", setup_shadow, NULL},
+	{"h40_interlace", "H40 planes and 80 sprites in interlace mode 2", setup_interlace, NULL},
+	{"h40_dma_fill", "H40 planes and a 4KB DMA fill every frame", setup_h40, dma_fill},
+	{"h40_dma_copy", "H40 planes and a 2KB DMA copy every frame", setup_h40, dma_copy},
+	{"h40_dma_68k", "H40 planes and a 4KB 68K to VRAM DMA every frame", setup_h40, dma_68k}
+};
+#define NUM_SCENARIOS (sizeof(scenarios)/sizeof(*scenarios))
+
+//runs whole lines until the requested number of frames has been output, returns the number of master clocks run
+static uint64_t run_frames(vdp_context *context, scenario *s, uint32_t frames)
+{
+	uint64_t mclks = 0;
+	uint32_t target = frames_done + frames;
+	while (frames_done < target)
+	{
+		uint32_t start = context->cycles;
+		vdp_run_context(context, context->cycles + MCLKS_LINE);
+		mclks += context->cycles - start;
+		if (frame_pushed) {
+			frame_pushed = 0;
+			start = context->cycles;
+			if (s->frame_start) {
+				s->frame_start(context);
+			}
+			mclks += context->cycles - start;
+			vdp_adjust_cycles(context, context->cycles);
+		}
+	}
+	return mclks;
+}
+
+static void run_scenario(scenario *s, uint32_t frames)
+{
+	vdp_context *context = s->setup();
+	run_frames(context, s, WARMUP_FRAMES);
+	uint64_t start = now_ns();
+	uint64_t mclks = run_frames(context, s, frames);
+	uint64_t elapsed = now_ns() - start;
+	uint64_t lines = mclks / MCLKS_LINE;
+	printf("%-16s %10.0f %8.1f\n", s->name, (double)elapsed / frames, (double)elapsed / lines);
+	vdp_free(context);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t frames = DEFAULT_FRAMES;
+	char **names = calloc(argc, sizeof(char *));
+	int num_names = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-') {
+			switch (argv[i][1])
+			{
+			case 'n':
+				i++;
+				if (i >= argc) {
+					fatal_error("-n must be followed by a frame count\n");
+				}
+				frames = atoi(argv[i]);
+				if (!frames) {
+					fatal_error("Frame count must be at least 1\n");
+				}
+				break;
+			case 'l':
+				for (int j = 0; j < NUM_SCENARIOS; j++)
+				{
+					printf("%-16s %s\n", scenarios[j].name, scenarios[j].description);
+				}
+				return 0;
+			case 'h':
+				puts("Usage: vdpbench [OPTIONS] [SCENARIO...]\n"
+					"Measures VDP emulation speed for synthetic workloads, runs every scenario if none are named\n\n"
+					"Options:\n"
+					"	-h          Print this help text\n"
+					"	-l          List the available scenarios\n"
+					"	-n FRAMES   Number of frames to time for each scenario, defaults to 600");
+				return 0;
+			default:
+				fatal_error("Unrecognized switch %s\n", argv[i]);
+			}
+		} else {
+			int j;
+			for (j = 0; j < NUM_SCENARIOS; j++)
+			{
+				if (!strcmp(argv[i], scenarios[j].name)) {
+					break;
+				}
+			}
+			if (j == NUM_SCENARIOS) {
+				fatal_error("Unknown scenario %s, use -l to list them\n", argv[i]);
+			}
+			names[num_names++] = argv[i];
+		}
+	}
+	printf("%-16s %10s %8s\n", "scenario", "ns/frame", "ns/line");
+	for (int i = 0; i < NUM_SCENARIOS; i++)
+	{
+		uint8_t selected = !num_names;
+		for (int j = 0; j < num_names && !selected; j++)
+		{
+			selected = !strcmp(names[j], scenarios[i].name);
+		}
+		if (selected) {
+			run_scenario(scenarios + i, frames);
+		}
+	}
+	free(names);
+	return 0;
+}
@@ -323,7 +323,7 @@ void xband_deserialize(deserialize_buffer *buf, genesis_context *gen)
 	}
 }
 
-rom_info xband_configure_rom(tern_node *rom_db, void *rom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks)
+rom_info xband_configure_rom(rom_database *rom_db, void *rom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks)
 {
 	rom_info info;
 	if (lock_on && lock_on_size) {
@@ -1379,3 +1379,29 @@ void ym_deserialize(deserialize_buffer *buf, void *vcontext)
 		context->last_status_cycle = context->write_cycle;
 	}
 }
+
+uint8_t *ym_save_snapshot(ym2612_context *context, uint8_t *dst)
+{
+	memcpy(dst, context, sizeof(ym2612_context));
+	return dst + sizeof(ym2612_context);
+}
+
+uint8_t *ym_load_snapshot(ym2612_context *context, uint8_t *src)
+{
+	//operator modulation pointers refer to the context itself so they survive the copy, but audio and logging don't
+	audio_source *audio = context->audio;
+	vgm_writer *vgm = context->vgm;
+	FILE *logfiles[NUM_CHANNELS];
+	for (int i = 0; i < NUM_CHANNELS; i++)
+	{
+		logfiles[i] = context->channels[i].logfile;
+	}
+	memcpy(context, src, sizeof(ym2612_context));
+	context->audio = audio;
+	context->vgm = vgm;
+	for (int i = 0; i < NUM_CHANNELS; i++)
+	{
+		context->channels[i].logfile = logfiles[i];
+	}
+	return src + sizeof(ym2612_context);
+}
@@ -154,6 +154,9 @@ void ym_print_channel_info(ym2612_context *context, int channel);
 void ym_print_timer_info(ym2612_context *context);
 void ym_serialize(ym2612_context *context, serialize_buffer *buf);
 void ym_deserialize(deserialize_buffer *buf, void *vcontext);
+//native-endian copies for in-process snapshots, only valid for the context they were taken from
+uint8_t *ym_save_snapshot(ym2612_context *context, uint8_t *dst);
+uint8_t *ym_load_snapshot(ym2612_context *context, uint8_t *src);
 
 #endif //YM2612_H_
 
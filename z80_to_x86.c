@@ -3983,3 +3983,49 @@ void z80_deserialize(deserialize_buffer *buf, void *vcontext)
 	context->native_pc = context->extra_pc = NULL;
 }
 
+//parts of z80_context that hold emulated state, the rest is host pointers and translation bookkeeping
+static const struct {
+	size_t start;
+	size_t end;
+} z80_snapshot_ranges[] = {
+	{offsetof(z80_context, sp), offsetof(z80_context, mem_pointers)},
+	{offsetof(z80_context, iff1), offsetof(z80_context, extra_pc)},
+	{offsetof(z80_context, sync_cycle), offsetof(z80_context, options)},
+	{offsetof(z80_context, int_enable_cycle), offsetof(z80_context, breakpoint_flags)},
+	{offsetof(z80_context, reset), offsetof(z80_context, ram_code_flags)}
+};
+#define NUM_Z80_SNAPSHOT_RANGES (sizeof(z80_snapshot_ranges)/sizeof(*z80_snapshot_ranges))
+
+uint32_t z80_snapshot_size(void)
+{
+	uint32_t size = 0;
+	for (int i = 0; i < NUM_Z80_SNAPSHOT_RANGES; i++)
+	{
+		size += z80_snapshot_ranges[i].end - z80_snapshot_ranges[i].start;
+	}
+	return size;
+}
+
+uint8_t *z80_save_snapshot(z80_context *context, uint8_t *dst)
+{
+	for (int i = 0; i < NUM_Z80_SNAPSHOT_RANGES; i++)
+	{
+		size_t size = z80_snapshot_ranges[i].end - z80_snapshot_ranges[i].start;
+		memcpy(dst, ((uint8_t *)context) + z80_snapshot_ranges[i].start, size);
+		dst += size;
+	}
+	return dst;
+}
+
+uint8_t *z80_load_snapshot(z80_context *context, uint8_t *src)
+{
+	for (int i = 0; i < NUM_Z80_SNAPSHOT_RANGES; i++)
+	{
+		size_t size = z80_snapshot_ranges[i].end - z80_snapshot_ranges[i].start;
+		memcpy(((uint8_t *)context) + z80_snapshot_ranges[i].start, src, size);
+		src += size;
+	}
+	context->native_pc = context->extra_pc = NULL;
+	return src;
+}
+
@@ -112,6 +112,10 @@ uint8_t z80_get_busack(z80_context * context, uint32_t cycle);
 void z80_adjust_cycles(z80_context * context, uint32_t deduction);
 void z80_serialize(z80_context *context, serialize_buffer *buf);
 void z80_deserialize(deserialize_buffer *buf, void *vcontext);
+//native-endian copies of the CPU state for in-process snapshots, must be taken at an instruction boundary
+uint32_t z80_snapshot_size(void);
+uint8_t *z80_save_snapshot(z80_context *context, uint8_t *dst);
+uint8_t *z80_load_snapshot(z80_context *context, uint8_t *src);
 
 #endif //Z80_TO_X86_H_
 